@@ -1,8 +1,31 @@
 #include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <chrono>
+#include <vector>
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 #include "camera.h" // Camera class
+#include "image_loader.h"   // Parallel batch image decoding
+#include "vertex_format.h"  // Compact vertex packing
+#include "vertex_layout.h"  // Compile-time vertex layouts
+#include "mesh_importer.h"  // OBJ and glTF mesh import
+#include "mesh_cache.h"     // Binary mesh cache files
+#include "mesh_optimizer.h" // Vertex cache, overdraw and fetch ordering
+#include "mesh_lod.h"       // Simplified levels of detail
+#include "mesh_meshlets.h"  // Meshlet clustering and culling
+#include "ring_buffer.h"    // Persistently mapped per-frame streaming
+#include "gpu_culling.h"    // Compute shader culling into indirect draws
+#include "occlusion_culling.h" // Software occlusion culling
+#include "scene_bvh.h"       // Bounding volume hierarchy over the scene
+#include "mesh_picking.h"    // Ray cast picking
+#include "loose_octree.h"    // Incrementally updated octree for moving objects
+#include "shader_cache.h"    // Linked program binaries on disk
+#include "shader_batch.h"    // Parallel shader builds and hot reload
+#include "shader_variants.h" // Shader permutations by feature
+#include "shader_reflection.h" // Program reflection and uniform blocks
+#include "gl_state.h"        // Redundant state call filtering
+#include "command_buffer.h"  // Draws recorded on the pool, issued on the GL thread
+#include "task_graph.h"      // The frame's work as dependent tasks
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"      // Image loading Utility functions
 
@@ -27,12 +50,74 @@ namespace
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 600;
 
+    // Fixed slots of the scene shaders: the model matrix's uniform location and the uniform block bindings
+    const GLint SCENE_MODEL_UNIFORM = 0;
+    const GLuint SCENE_FRAME_BLOCK = 0;
+    const GLuint SCENE_MATERIAL_BLOCK = 1;
+
+    // Far plane of the perspective projection; also what draw sort depths are normalized by
+    const float CAMERA_FAR_PLANE = 150.0f;
+
+    // Ortho projection: the view is 2 * WINDOW_WIDTH / ORTHO_SCALE by 2 * WINDOW_HEIGHT / ORTHO_SCALE units
+    const float ORTHO_SCALE = 150.0f;
+
+    // Objects per pool task when per-object render work is split across threads
+    const size_t RENDER_CHUNK_OBJECTS = 64;
+
     // Stores the GL data relative to a given mesh
     struct GLMesh
     {
         GLuint vao;         // Handle for the vertex array object
         GLuint vbos[2];     // Handles for the vertex buffer objects
-        GLuint nIndices;    // Number of indices of the mesh
+        GLuint nIndices;    // Number of indices of the mesh (of LOD 0 when it has several)
+        GLenum indexType;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+        glm::mat4 dequantize; // Maps packed positions back to model space; goes after the model matrix
+        std::vector<MeshLod> lods; // Index ranges of each level of detail, finest first
+        std::vector<Meshlet> meshlets; // Clusters of LOD 0, culled every frame
+        GLuint cullItemFirst;   // This mesh's first item in the GPU culling pass
+        PickMesh pick;          // LOD 0 triangles on the CPU, for picking
+    };
+
+    // One placement of an imported mesh in the scene
+    struct SceneObject
+    {
+        size_t mesh;        // Index into gImportedMeshes
+        glm::mat4 model;
+        int lod = 0;        // Level drawn last frame, so the selection can apply hysteresis
+        bool culled = false; // Outside the view or hidden behind the occluders this frame
+        bool moved = false;  // Listed in gMovedObjects: the model changed since the spatial indices last saw it
+    };
+
+    // A scene texture: either one RGB(A) texture, or the Y, Cb and Cr planes of a JPEG that the
+    // fragment shader converts to RGB
+    struct GLTexture
+    {
+        GLuint ids[3] = { 0, 0, 0 };                 // ids[0] is the RGB(A) texture or the Y plane
+        bool planarYCbCr = false;
+        glm::vec4 chromaTransform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f); // xy scale, zw offset from Y to chroma texture coordinates
+    };
+
+    // Opaque geometry rasterized into the occlusion buffer every frame
+    struct Occluder
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+        glm::mat4 model;
+    };
+
+    // The scene shaders' uniform blocks, member for member as std140 lays them out
+    struct SceneFrameParameters
+    {
+        glm::mat4 View;
+        glm::mat4 Projection;
+    };
+
+    struct SceneMaterialParameters
+    {
+        glm::vec4 ChromaTransform;
+        glm::vec4 BaseColor = glm::vec4(1.0f);
+        glm::vec3 LightDirection = glm::vec3(0.267f, 0.802f, 0.534f); // toward the light, unit length
+        float AlphaCutoff = 0.5f;
     };
 
     // Main GLFW window
@@ -40,9 +125,47 @@ namespace
     // Triangle mesh data
     GLMesh gMesh;
     GLMesh gMesh1;
-    GLuint tabletexture;
-    // Shader program
+    // Meshes imported from the files named on the command line
+    std::vector<GLMesh> gImportedMeshes;
+    std::vector<SceneObject> gSceneObjects;
+    // Draws of the imported meshes, recorded by the thread pool every frame and issued here
+    CommandQueue gDrawQueue;
+    bool gDrawsRecorded = false;
+    // The frame's work, from input to the last draw; the CPU parts run on the pool alongside the GL ones
+    TaskGraph gFrameGraph;
+    // The camera as the frame's culling saw it
+    glm::mat4 gFrameView;
+    glm::mat4 gFrameProjection;
+    // Per-frame GPU data streams through the ring; gIndirectBuffer only takes a frame that overflows it
+    RingBuffer gStreamBuffer;
+    GLuint gIndirectBuffer = 0;
+    // Culls the imported meshes on the GPU when its compute shader builds; the CPU path covers the rest
+    GpuCuller gGpuCuller;
+    GLuint gCullProgramId = 0; // the instanced scene variant, which GPU-culled draws use
+    // The table hides much of the scene; the imported meshes behind it are skipped before either cull path
+    OcclusionBuffer gOcclusion;
+    std::vector<Occluder> gOccluders;
+    // World bounds of gSceneObjects, for culling and spatial queries without scanning every object. The octree
+    // takes moves as they happen and serves the per-frame culling; the BVH serves picking and is only refit
+    // when a pick finds it stale, so a frame's updates cost what moved rather than the whole scene.
+    SceneBvh gSceneBvh;
+    LooseOctree gSceneOctree;
+    bool gSceneBvhStale = false;
+    std::vector<uint32_t> gMovedObjects;
+    int gSelectedObject = -1; // the last picked object, which the arrow keys move
+    GLTexture tabletexture;
+    // Every draw sets its state through this, so what the previous draw left bound isn't set again
+    GLStateCache gGlState;
+    // Shader program: the scene variant for tabletexture
     GLuint gProgramId;
+    // Parameters shared by the scene programs: the camera once a frame, the material once per batch of draws
+    ParameterBlock<SceneFrameParameters> gFrameParameters;
+    ParameterBlock<SceneMaterialParameters> gMaterialParameters;
+    // Program binaries from earlier runs, so warm starts skip shader compilation
+    ShaderCache gShaderCache;
+    // Every program the scene draws with, as variants of one pair of sources; edits to the source files are
+    // rebuilt in the background and swapped in
+    ShaderVariants gSceneShaders;
     // camera
     Camera gCamera(glm::vec3(0.0f, 0.0f, 5.0f));
     float gLastX = WINDOW_WIDTH / 2.0f;
@@ -64,46 +187,154 @@ void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
-void UCreateMesh(GLMesh& mesh);
+void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void UPickAtCursor(GLFWwindow* window);
+glm::mat4 UProjection();
+MeshData UCreateMesh(GLMesh& mesh);
+glm::mat4 UTableModel();
 void UDestroyMesh(GLMesh& mesh);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
+void UWatchShaders();
+uint32_t UMaterialKey(const GLTexture& texture, bool instanced);
+bool UResolvePrograms();
+bool UCheckSceneProgram(GLuint programId, unsigned extraAttributes, std::string& mismatch);
+bool UCheckSceneVariant(uint32_t key, GLuint programId, std::string& mismatch);
+void UCreateParameterBlocks();
+void UUploadFrameParameters();
+void UReloadShaders();
 void UCreateMesh2(GLMesh& mesh1);
+MeshData UMeshFromInterleaved(const GLfloat* verts, size_t floatCount, const GLushort* indices, size_t indexCount);
+PackedMesh UPackSceneMesh(const MeshData& data);
+void UCreateMeshFromPacked(const PackedMesh& packed, GLMesh& mesh);
+void UCreateMeshFromCache(const MeshCacheView& cache, GLMesh& mesh);
+void UCreateMeshBuffers(const void* vertices, size_t vertexBytes, const void* indices, size_t indexBytes, GLsizei stride, const VertexAttribute* attributes, size_t attributeCount, GLMesh& mesh);
+bool ULoadMeshFile(const std::string& filename, GLMesh& mesh);
+float UPixelsPerUnit(const glm::vec3& center, float radius);
+float UMaxScale(const glm::mat4& model);
 void URender2();
 void URender3();
 void URender4();
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void flipImageVertically(unsigned char* image, int width, int height, int channels);
-
-/* Vertex Shader Source Code*/
-const GLchar* vertexShaderSource = GLSL(440,
-    layout(location = 0) in vec3 position;
+void UBuildFrameGraph();
+void UBeginFrame();
+void UCullScene();
+void URecordImported();
+void URenderImported();
+void USelectObjectLod(SceneObject& object);
+void URecordObject(const SceneObject& object, const glm::mat4& viewProjection, CommandBuffer& buffer);
+void UCullObjects(const glm::mat4& viewProjection);
+BvhBounds UObjectBounds(const SceneObject& object);
+void UBuildSceneIndex();
+void UUpdateSceneIndex();
+bool URenderImportedGpu(const glm::mat4& view, const glm::mat4& projection);
+void UCreateGpuCulling();
+bool UCreateTexture(const char* filename, GLTexture& texture);
+bool UCreateTextures(const std::vector<const char*>& filenames, const std::vector<GLTexture*>& textures);
+bool UCreateTextureFromImage(const DecodedImage& image, GLTexture& texture);
+GLuint UCreateTexture2D(const unsigned char* pixels, int width, int height, GLenum internalFormat, GLenum format);
+void UBindTexture(const GLTexture& texture);
+
+/* Vertex Shader Source Code: one source for every variant, see shader_variants.h for the features*/
+constexpr GLchar vertexShaderSource[] = R"glsl(#version 440 core
+layout(location = 0) in vec3 position;
 layout(location = 2) in vec2 textureCoordinate;
+#ifdef INSTANCED
+layout(location = 4) in uint objectIndex; // one per instance, offset by the draw's baseInstance
+#endif
 
 out vec2 vertexTextureCoordinate;
+#ifdef LIT
+out vec3 vertexWorldPosition;
+#endif
+
+//Global variables for the transform matrices
+#ifdef INSTANCED
+// GPU-culled draws: the model matrix comes from the culling pass's object array
+struct CullObject
+{
+    mat4 model;
+    mat4 cullModel;
+    vec4 cameraScale;
+    uvec4 items;
+};
+layout(std430, binding = 0) readonly buffer Objects { CullObject objects[]; };
+#else
+layout(location = 0) uniform mat4 model; // SCENE_MODEL_UNIFORM
+#endif
+layout(std140, binding = 0) uniform Frame // SCENE_FRAME_BLOCK
+{
+    mat4 view;
+    mat4 projection;
+};
 
 void main()
 {
-    gl_Position = vec4(position.x, position.y, position.z, 1.0);
+#ifdef INSTANCED
+    vec4 worldPosition = objects[objectIndex].model * vec4(position, 1.0);
+#else
+    vec4 worldPosition = model * vec4(position, 1.0);
+#endif
+    gl_Position = projection * view * worldPosition; // transforms vertices to clip coordinates
     vertexTextureCoordinate = textureCoordinate;
+#ifdef LIT
+    vertexWorldPosition = worldPosition.xyz;
+#endif
 }
-);
+)glsl";
+
+// How the scene's vertices are packed: snorm16 positions and unorm16 texture coordinates, 8 + 4 bytes. Meshes
+// whose UVs tile or leave [0,1] keep float texture coordinates, 8 + 8 bytes; the shader reads either as a vec2.
+typedef VertexLayout<Position<snorm16x3>, TexCoord<unorm16x2>> SceneVertexLayout;
+typedef VertexLayout<Position<snorm16x3>, TexCoord<float2>> SceneTiledVertexLayout;
+static_assert(UVertexLayoutMatches<SceneVertexLayout>(vertexShaderSource), "SceneVertexLayout doesn't match the vertex shader inputs");
+static_assert(UVertexLayoutMatches<SceneTiledVertexLayout>(vertexShaderSource), "SceneTiledVertexLayout doesn't match the vertex shader inputs");
 
 
 /* Fragment Shader Source Code*/
-const GLchar* fragmentShaderSource = GLSL(440,
-    in vec2 vertexTextureCoordinate;
+const GLchar* fragmentShaderSource = R"glsl(#version 440 core
+in vec2 vertexTextureCoordinate;
+#ifdef LIT
+in vec3 vertexWorldPosition;
+#endif
 
 out vec4 fragmentColor;
 
-uniform sampler2D uTexture;
+layout(binding = 0) uniform sampler2D uTexture;   // RGB(A) texture, or the Y plane of a planar one
+layout(binding = 1) uniform sampler2D uTextureCb;
+layout(binding = 2) uniform sampler2D uTextureCr;
+layout(std140, binding = 1) uniform Material // SCENE_MATERIAL_BLOCK
+{
+    vec4 uChromaTransform;
+    vec4 uBaseColor;
+    vec3 uLightDirection; // toward the light, unit length
+    float uAlphaCutoff;
+};
 
 void main()
 {
-    fragmentColor = texture(uTexture, vertexTextureCoordinate); // Sends texture to the GPU for rendering
+#if defined(TEXTURED) && defined(PLANAR_YCBCR)
+    // JFIF full-range YCbCr to RGB; the bilinear filter does the chroma upsampling
+    vec2 chromaCoordinate = vertexTextureCoordinate * uChromaTransform.xy + uChromaTransform.zw;
+    float y = texture(uTexture, vertexTextureCoordinate).r;
+    float cb = texture(uTextureCb, chromaCoordinate).r - 128.0 / 255.0;
+    float cr = texture(uTextureCr, chromaCoordinate).r - 128.0 / 255.0;
+    vec4 color = vec4(y + 1.402 * cr, y - 0.344136 * cb - 0.714136 * cr, y + 1.772 * cb, 1.0);
+#elif defined(TEXTURED)
+    vec4 color = texture(uTexture, vertexTextureCoordinate); // Sends texture to the GPU for rendering
+#else
+    vec4 color = uBaseColor;
+#endif
+#ifdef ALPHA_TEST
+    if (color.a < uAlphaCutoff)
+        discard;
+#endif
+#ifdef LIT
+    // flat shading: the triangle's normal from the screen-space derivatives of its position
+    vec3 normal = normalize(cross(dFdx(vertexWorldPosition), dFdy(vertexWorldPosition)));
+    color.rgb *= 0.25 + 0.75 * max(dot(normal, uLightDirection), 0.0);
+#endif
+    fragmentColor = color;
 }
-);
+)glsl";
 
 
 int main(int argc, char* argv[])
@@ -111,23 +342,54 @@ int main(int argc, char* argv[])
     if (!UInitialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
 
-    // Create the mesh
-    UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
+    // Create the shader programs: the variants the scene can need build at once, on the driver's threads where
+    // it has them, while the meshes below load; variants seen on an earlier run come from their cached binaries
+    ShaderBatch::EnableParallelCompile();
+    gShaderCache.Create("program_");
+    UWatchShaders();
+    const uint32_t startupVariants[] = { // either kind of texture, drawn directly or GPU-culled
+        SHADER_TEXTURED, SHADER_TEXTURED | SHADER_PLANAR_YCBCR,
+        SHADER_TEXTURED | SHADER_INSTANCED, SHADER_TEXTURED | SHADER_PLANAR_YCBCR | SHADER_INSTANCED,
+    };
+    gSceneShaders.Precompile(startupVariants, sizeof(startupVariants) / sizeof(startupVariants[0]));
+    gGpuCuller.StartProgram(&gShaderCache);
+
+    MeshData table = UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
+    gOccluders.push_back(Occluder{ table.Positions, table.Indices, UTableModel() });
     UCreateMesh2(gMesh1); // Calls the function to create the Vertex Buffer Object
-    // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
-        return EXIT_FAILURE;
 
-    const char* texFilename = "Wood.jpg"; //start
-    if (!UCreateTexture(texFilename, tabletexture))
+    // Load any OBJ or glTF files given on the command line
+    for (int i = 1; i < argc; ++i)
     {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
+        GLMesh mesh;
+        if (ULoadMeshFile(argv[i], mesh))
+        {
+            SceneObject object;
+            object.mesh = gImportedMeshes.size();
+            object.model = glm::mat4(1.0f);
+            gSceneObjects.push_back(object);
+            gImportedMeshes.push_back(mesh);
+        }
     }
-    // Tell OpenGL for each sampler which texture unit it belongs to (only has to be done once).
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0.
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0); //end
+
+    // Decode every scene texture on the thread pool; uploads happen here as each one finishes
+    std::vector<const char*> texFilenames = { "Wood.jpg" }; //start
+    std::vector<GLTexture*> textures = { &tabletexture };
+    if (!UCreateTextures(texFilenames, textures))
+        return EXIT_FAILURE;
+    // The variants depend on the texture's kind, so they are picked once it is known, and checked against
+    // the parameter blocks
+    UCreateParameterBlocks();
+    if (!UResolvePrograms())
+        return EXIT_FAILURE; //end
+
+    glGenBuffers(1, &gIndirectBuffer);
+    if (!gStreamBuffer.Create(1 << 20, gGlState))
+        cerr << "Failed to map the stream buffer; per-frame data falls back to glBufferData" << endl;
+    UBuildSceneIndex();
+    UCreateGpuCulling();
+    gOcclusion.Create(256, 256 * WINDOW_HEIGHT / WINDOW_WIDTH);
+    UBuildFrameGraph();
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -140,23 +402,14 @@ int main(int argc, char* argv[])
         gDeltaTime = currentFrame - gLastFrame;
         gLastFrame = currentFrame;
 
-        // input
-        // -----
-        UProcessInput(gWindow);
-
-        // Render this frame
-
-            // Enable z-depth
-        glEnable(GL_DEPTH_TEST);
-
-        // Clear the frame and z buffers
-        //glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        URender();
-        URender2();
-        URender3();
-        URender4();
+        // input, scene updates, culling and rendering, as far in parallel as UBuildFrameGraph's
+        // dependencies let them
+        gGlState.BeginFrame();
+        if (!gFrameGraph.Run())
+        {
+            cerr << "The frame's tasks wait on each other in a cycle, through \"" << gFrameGraph.Cycle() << "\"" << endl;
+            break;
+        }
         glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
         glfwPollEvents();
     }
@@ -164,8 +417,35 @@ int main(int argc, char* argv[])
     // Release mesh data
     UDestroyMesh(gMesh);
     UDestroyMesh(gMesh1);
-    // Release shader program
-    UDestroyShaderProgram(gProgramId);
+    for (GLMesh& mesh : gImportedMeshes)
+        UDestroyMesh(mesh);
+    gGlState.DeleteBuffers(1, &gIndirectBuffer);
+    gGpuCuller.Destroy(gGlState);
+    const RingBufferStats& stream = gStreamBuffer.Stats();
+    cout << "Stream buffer: " << stream.Frames << " frames, " << stream.Stalls << " stalls (" << stream.StallMilliseconds << " ms), peak "
+        << stream.PeakBytes << " of " << gStreamBuffer.FrameBytes() << " bytes per frame, " << stream.Overflows << " overflows" << endl;
+    gStreamBuffer.Destroy(gGlState);
+    const OcclusionStats& occlusion = gOcclusion.Stats();
+    cout << "Occlusion: " << occlusion.Occluded << " of " << occlusion.Tested << " objects hidden in the last frame, "
+        << occlusion.OccluderTriangles << " occluder triangles rasterized in " << occlusion.RasterMilliseconds << " ms" << endl;
+    const ShaderCacheStats& shaders = gShaderCache.Stats();
+    cout << "Shader programs: " << shaders.Hits << " loaded from cached binaries in " << shaders.LoadMilliseconds << " ms, " << shaders.Misses
+        << " compiled (" << shaders.Rejected << " cached binaries rejected), " << shaders.Stored << " binaries stored" << endl;
+    const TaskGraphStats& frameTasks = gFrameGraph.Stats();
+    cout << "Frame tasks: " << frameTasks.Tasks << " (" << frameTasks.MainThreadTasks << " on the GL thread) took " << frameTasks.TaskMilliseconds
+        << " ms in " << frameTasks.Milliseconds << " ms in the last frame, on " << GetSharedThreadPool().GetThreadCount() << " pool threads" << endl;
+    const CommandQueueStats& recorded = gDrawQueue.Stats();
+    cout << "Draw recording: " << recorded.Draws << " draws of " << recorded.Commands << " commands from " << recorded.Buffers
+        << " buffers in the last frame, merged and sorted in " << recorded.SortMilliseconds << " ms" << endl;
+    const LooseOctreeStats& octree = gSceneOctree.Stats();
+    const GLStateStats& stateCalls = gGlState.FrameStats();
+    cout << "GL state calls: " << stateCalls.Issued << " issued, " << stateCalls.Skipped << " skipped as redundant in the last frame ("
+        << gGlState.TotalStats().Issued << " issued, " << gGlState.TotalStats().Skipped << " skipped in all)" << endl;
+    cout << "Scene octree: " << octree.Moves << " object moves, " << octree.Relinks << " changed node, " << octree.Nodes << " nodes" << endl;
+    // Release shader programs
+    gSceneShaders.Destroy();
+    gFrameParameters.Destroy(gGlState);
+    gMaterialParameters.Destroy(gGlState);
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -196,6 +476,7 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     }
     glfwMakeContextCurrent(*window);
     glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+    glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
 
     // GLEW: initialize
     // ----------------
@@ -234,46 +515,142 @@ void UProcessInput(GLFWwindow* window)
         gCamera.ProcessKeyboard(DOWN, gDeltaTime);
     if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
         ortho = !ortho;
+
+    // the arrow keys (and page up/down) slide the picked object around
+    if (gSelectedObject >= 0)
+    {
+        glm::vec3 step(0.0f);
+        if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+            step.x -= 1.0f;
+        if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+            step.x += 1.0f;
+        if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+            step.z -= 1.0f;
+        if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+            step.z += 1.0f;
+        if (glfwGetKey(window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)
+            step.y += 1.0f;
+        if (glfwGetKey(window, GLFW_KEY_PAGE_DOWN) == GLFW_PRESS)
+            step.y -= 1.0f;
+        if (step != glm::vec3(0.0f))
+        {
+            SceneObject& object = gSceneObjects[gSelectedObject];
+            object.model = glm::translate(step * (gCamera.MovementSpeed * gDeltaTime)) * object.model;
+            if (!object.moved)
+                gMovedObjects.push_back((uint32_t)gSelectedObject);
+            object.moved = true;
+        }
+    }
 }
 
-bool UCreateTexture(const char* filename, GLuint& textureId)
+bool UCreateTexture(const char* filename, GLTexture& texture)
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
-    {
-        flipImageVertically(image, width, height, channels);
+    return UCreateTextures({ filename }, { &texture });
+}
 
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
+// Decodes all the images in parallel and creates one texture per file, in completion order
+bool UCreateTextures(const std::vector<const char*>& filenames, const std::vector<GLTexture*>& textures)
+{
+    ImageDecodeOptions options;
+    options.FlipVertically = true; // OpenGL expects the first row at the bottom
+    options.PlanarYCbCr = true;    // JPEGs skip chroma upsampling and color conversion on the CPU
 
-        // Set the texture wrapping parameters.
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // Set texture filtering parameters.
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    std::vector<ImageRequest> requests;
+    for (const char* filename : filenames)
+        requests.push_back(ImageRequest::FromFile(filename, options));
 
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
+    bool success = true;
+    UDecodeImages(requests, [&](DecodedImage& image)
+    {
+        const char* filename = filenames[image.RequestIndex];
+        if (!image.Pixels)
         {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
+            cout << "Failed to load texture " << filename << ": " << image.FailureReason << endl;
+            success = false;
+        }
+        else if (!UCreateTextureFromImage(image, *textures[image.RequestIndex]))
+        {
+            cout << "Failed to load texture " << filename << endl;
+            success = false;
         }
+    });
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+    return success;
+}
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture.
+// Uploads an already decoded (and flipped) image: packed pixels into one texture, planes into one R8 texture each
+bool UCreateTextureFromImage(const DecodedImage& image, GLTexture& texture)
+{
+    if (image.PlaneCount == 3)
+    {
+        const ImagePlane& cb = image.Planes[1];
+        const ImagePlane& cr = image.Planes[2];
+        if (cb.Width != cr.Width || cb.Height != cr.Height)
+        {
+            cout << "Not implemented to handle Cb and Cr planes of different sizes" << endl;
+            return false;
+        }
 
+        // Rows of single-byte texels aren't padded to 4 bytes
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int i = 0; i < 3; ++i)
+            texture.ids[i] = UCreateTexture2D(image.Planes[i].Pixels, image.Planes[i].Width, image.Planes[i].Height, GL_R8, GL_RED);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        // Chroma samples can cover a little more than the image when its size isn't a multiple of the
+        // subsampling. Scale Y coordinates into the covered part; the rows were flipped, so the padding is at the bottom.
+        float scaleX = (float)image.Width / (cb.Width * cb.SubsampleX);
+        float scaleY = (float)image.Height / (cb.Height * cb.SubsampleY);
+        texture.chromaTransform = glm::vec4(scaleX, scaleY, 0.0f, 1.0f - scaleY);
+        texture.planarYCbCr = true;
         return true;
     }
 
-    // Error loading the image
-    return false;
+    if (image.Channels == 3)
+        texture.ids[0] = UCreateTexture2D(image.Pixels, image.Width, image.Height, GL_RGB8, GL_RGB);
+    else if (image.Channels == 4)
+        texture.ids[0] = UCreateTexture2D(image.Pixels, image.Width, image.Height, GL_RGBA8, GL_RGBA);
+    else
+    {
+        cout << "Not implemented to handle image with " << image.Channels << " channels" << endl;
+        return false;
+    }
+
+    texture.planarYCbCr = false;
+    return true;
+}
+
+// Creates a mipmapped, repeating 2D texture from tightly packed 8-bit rows
+GLuint UCreateTexture2D(const unsigned char* pixels, int width, int height, GLenum internalFormat, GLenum format)
+{
+    GLuint textureId;
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+
+    // Set the texture wrapping parameters.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // Set texture filtering parameters.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture.
+
+    return textureId;
+}
+
+// Binds a scene texture to units 0-2 and uploads its material parameters, which only costs a buffer update when
+// they differ from the last draw's; the texture's variant (UMaterialKey) must be in use
+void UBindTexture(const GLTexture& texture)
+{
+    gMaterialParameters.Staging().ChromaTransform = texture.chromaTransform;
+    gMaterialParameters.Upload(gGlState, gStreamBuffer);
+
+    for (GLuint i = 0; i < 3; ++i)
+        gGlState.BindTexture(i, GL_TEXTURE_2D, texture.ids[i]);
 }
 
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
@@ -302,6 +679,48 @@ void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
     gCamera.ProcessMouseScroll(yoffset);
 }
 
+// glfw: a left click picks the imported object under the cursor
+// -------------------------------------------------------------
+void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+        UPickAtCursor(window);
+}
+
+// Casts the cursor's ray through the scene BVH and each object's triangle BVH and reports the nearest hit
+void UPickAtCursor(GLFWwindow* window)
+{
+    double x, y;
+    int width, height;
+    glfwGetCursorPos(window, &x, &y);
+    glfwGetWindowSize(window, &width, &height);
+    if (width <= 0 || height <= 0)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    if (gSceneBvhStale)
+    {
+        gSceneBvh.Refit();
+        gSceneBvhStale = false;
+    }
+    glm::vec3 origin, direction;
+    UCursorRay(x, y, width, height, UProjection() * gCamera.GetViewMatrix(), origin, direction);
+    PickHit hit = UPickScene(gSceneBvh, origin, direction, 1.0f, [](uint32_t item, glm::mat4& worldFromMesh) -> const PickMesh*
+    {
+        const GLMesh& mesh = gImportedMeshes[gSceneObjects[item].mesh];
+        worldFromMesh = gSceneObjects[item].model * mesh.dequantize;
+        return mesh.pick.Indices.empty() ? nullptr : &mesh.pick;
+    });
+    double microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    gSelectedObject = hit.Hit ? (int)hit.Object : -1;
+    if (hit.Hit)
+        cout << "Picked object " << hit.Object << ", triangle " << hit.Triangle << " at (" << hit.Point.x << ", " << hit.Point.y << ", " << hit.Point.z
+            << ") in " << microseconds << " us; the arrow keys move it" << endl;
+    else
+        cout << "Nothing under the cursor (" << microseconds << " us)" << endl;
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
@@ -319,63 +738,46 @@ void URender()
     //glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     //glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // 1. Scales the object by 2
-    glm::mat4 scale = glm::scale(glm::vec3(27.0f, 0.2f, 140.0f));  // SURFACE AREA L X H X W
-    // 2. Rotates shape by 15 degrees in the x axis
-    glm::mat4 rotation = glm::rotate(0.0f, glm::vec3(0.0f, -5.0f, 0.0f)); // ROTATES SURFACE
-    // 3. Place object at the origin
-    glm::mat4 translation = glm::translate(glm::vec3(-1.0f, -3.0f, 0.0f));
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
-
-    // Transforms the camera: move the camera back (z axis)
-    //glm::mat4 view = glm::translate(glm::vec3(0.0f, 0.0f, -15.0f)); //CAMERA ZOOM
-        // camera 7/27/2021
-    glm::mat4 view = gCamera.GetViewMatrix();
-    // Switch betweeen perspective and ortho projection
-    glm::mat4 projection;
-
-    if (ortho) {
-        float ortho_scale = 150;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.5f, 150.0f);
-    }
+    // Model matrix: the table's placement, then the mesh's dequantization
+    glm::mat4 model = UTableModel() * gMesh.dequantize;
 
     // Set the shader to be used
 
 
-    glUseProgram(gProgramId);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view"); 
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+    gGlState.UseProgram(gProgramId);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Passes the model matrix to its slot; view and projection are in the frame's parameter block
+    glUniformMatrix4fv(SCENE_MODEL_UNIFORM, 1, GL_FALSE, glm::value_ptr(model));
 
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.vao);
+    gGlState.BindVertexArray(gMesh.vao);
 
-    glActiveTexture(GL_TEXTURE0);  //only have to change gtextureId to texture name
-    glBindTexture(GL_TEXTURE_2D, tabletexture);
+    UBindTexture(tabletexture);  //only have to change tabletexture to texture name
 
     // Draws the triangles
-    glDrawElements(GL_TRIANGLES, gMesh.nIndices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    glDrawElements(GL_TRIANGLES, gMesh.nIndices, gMesh.indexType, NULL); // Draws the triangle
 
     // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
     //glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 }
 
 
-// Implements the UCreateMesh function
-void UCreateMesh(GLMesh& mesh)
+// Where the table sits; also places it in the occlusion buffer
+glm::mat4 UTableModel()
+{
+    // 1. Scales the object by 2
+    glm::mat4 scale = glm::scale(glm::vec3(27.0f, 0.2f, 140.0f));  // SURFACE AREA L X H X W
+    // 2. Rotates shape by 15 degrees in the x axis
+    glm::mat4 rotation = glm::rotate(0.0f, glm::vec3(0.0f, -5.0f, 0.0f)); // ROTATES SURFACE
+    // 3. Place object at the origin
+    glm::mat4 translation = glm::translate(glm::vec3(-1.0f, -3.0f, 0.0f));
+    // Model matrix: transformations are applied right-to-left order
+    return translation * rotation * scale;
+}
+
+
+// Implements the UCreateMesh function; returns the unpacked mesh for the CPU-side users (the occlusion buffer)
+MeshData UCreateMesh(GLMesh& mesh)
 {
     // Position and Color data
     GLfloat verts[] = {
@@ -407,41 +809,18 @@ void UCreateMesh(GLMesh& mesh)
         1, 2, 7 // Triangle 12
     };
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
-    const GLuint floatsPerUV = 2;
-
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
-
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(2, mesh.vbos);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV);
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerColor)));
-    glEnableVertexAttribArray(2);
+    // Reorder for the vertex cache, pack into the compact vertex format and upload
+    MeshData data = UMeshFromInterleaved(verts, sizeof(verts) / sizeof(verts[0]), indices, sizeof(indices) / sizeof(indices[0]));
+    UOptimizeMesh(data);
+    UCreateMeshFromPacked(UPackSceneMesh(data), mesh);
+    return data;
 }
 
 
 void UDestroyMesh(GLMesh& mesh)
 {
     glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(2, mesh.vbos);
+    gGlState.DeleteBuffers(2, mesh.vbos);
 }
 
 
@@ -461,46 +840,22 @@ void URender2() // White airpod box
     // 3. Place object at the origin
     glm::mat4 translation = glm::translate(glm::vec3(-1.0f, -2.7f, -5.0f)); //Moves position of box (x,y,z)
     // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
-
-    // Transforms the camera: move the camera back (z axis)
-    //glm::mat4 view = glm::translate(glm::vec3(0.0f, 0.0f, -15.0f)); //MOVES CAMERA
-        // camera 7/27/2021
-    glm::mat4 view = gCamera.GetViewMatrix();
-    // Creates a perspective projection
-    glm::mat4 projection;
-    if (ortho) {
-        float ortho_scale = 150;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.5f, 150.0f);
-    }
+    glm::mat4 model = translation * rotation * scale * gMesh1.dequantize;
 
     // Set the shader to be used
 
-    glUseProgram(gProgramId);
+    gGlState.UseProgram(gProgramId);
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Passes the model matrix to its slot; view and projection are in the frame's parameter block
+    glUniformMatrix4fv(SCENE_MODEL_UNIFORM, 1, GL_FALSE, glm::value_ptr(model));
 
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh1.vao);
+    gGlState.BindVertexArray(gMesh1.vao);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tabletexture);
+    UBindTexture(tabletexture);
 
     // Draws the triangles
-    glDrawElements(GL_TRIANGLES, gMesh1.nIndices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    glDrawElements(GL_TRIANGLES, gMesh1.nIndices, gMesh1.indexType, NULL); // Draws the triangle
 
     // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
     //glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
@@ -523,46 +878,22 @@ void URender3() //second white box
     // 3. Place object at the origin
     glm::mat4 translation = glm::translate(glm::vec3(-4.0f, -2.7f, -5.0f)); //Moves position of box (x,y,z)
     // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
-
-    // Transforms the camera: move the camera back (z axis)
-    //glm::mat4 view = glm::translate(glm::vec3(0.0f, 0.0f, -15.0f)); //MOVES CAMERA
-        // camera 7/27/2021
-    glm::mat4 view = gCamera.GetViewMatrix();
-    // Creates a perspective projection
-    glm::mat4 projection;
-    if (ortho) {
-        float ortho_scale = 150;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.5f, 150.0f);
-    }
+    glm::mat4 model = translation * rotation * scale * gMesh1.dequantize;
 
     // Set the shader to be used
 
-    glUseProgram(gProgramId);
+    gGlState.UseProgram(gProgramId);
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Passes the model matrix to its slot; view and projection are in the frame's parameter block
+    glUniformMatrix4fv(SCENE_MODEL_UNIFORM, 1, GL_FALSE, glm::value_ptr(model));
 
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh1.vao);
+    gGlState.BindVertexArray(gMesh1.vao);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tabletexture);
+    UBindTexture(tabletexture);
 
     // Draws the triangles
-    glDrawElements(GL_TRIANGLES, gMesh1.nIndices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    glDrawElements(GL_TRIANGLES, gMesh1.nIndices, gMesh1.indexType, NULL); // Draws the triangle
 
     // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
     //glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
@@ -585,53 +916,343 @@ void URender4() //third white box object on table
     // 3. Place object at the origin
     glm::mat4 translation = glm::translate(glm::vec3(2.0f, -2.7f, -5.0f)); //Moves position of box (x,y,z)
     // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
-
-    // Transforms the camera: move the camera back (z axis)
-    //glm::mat4 view = glm::translate(glm::vec3(0.0f, 0.0f, -15.0f)); //MOVES CAMERA
-        // camera 7/27/2021
-    glm::mat4 view = gCamera.GetViewMatrix();
-    // Creates a perspective projection
-    glm::mat4 projection;
-    if (ortho) {
-        float ortho_scale = 150;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.5f, 150.0f);
-    }
+    glm::mat4 model = translation * rotation * scale * gMesh1.dequantize;
 
     // Set the shader to be used
 
-    glUseProgram(gProgramId);
+    gGlState.UseProgram(gProgramId);
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Passes the model matrix to its slot; view and projection are in the frame's parameter block
+    glUniformMatrix4fv(SCENE_MODEL_UNIFORM, 1, GL_FALSE, glm::value_ptr(model));
 
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh1.vao);
+    gGlState.BindVertexArray(gMesh1.vao);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tabletexture);
+    UBindTexture(tabletexture);
 
     // Draws the triangles
-    glDrawElements(GL_TRIANGLES, gMesh1.nIndices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    glDrawElements(GL_TRIANGLES, gMesh1.nIndices, gMesh1.indexType, NULL); // Draws the triangle
 
     // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
     //glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 }
 
 
-// Implements the UCreateMesh function
+// Sets up the frame's work once: input first, then the GL side (the stream buffer, the fixed meshes) on the
+// main thread while the pool updates the moved objects, culls and records; the imported meshes' draws join
+// the two. Every task that calls GL or GLFW is TASK_MAIN_THREAD.
+void UBuildFrameGraph()
+{
+    size_t input = gFrameGraph.Add("input", [] { UProcessInput(gWindow); UReloadShaders(); }, TASK_MAIN_THREAD);
+    size_t transforms = gFrameGraph.Add("transforms", UUpdateSceneIndex);
+    size_t begin = gFrameGraph.Add("begin frame", UBeginFrame, TASK_MAIN_THREAD);
+    size_t cull = gFrameGraph.Add("cull", UCullScene);
+    size_t record = gFrameGraph.Add("record draws", []
+    {
+        if (!gGpuCuller.IsReady() || !gCullProgramId)
+            URecordImported();
+    });
+    size_t imported = gFrameGraph.Add("imported draws", [] { URenderImported(); gStreamBuffer.EndFrame(); }, TASK_MAIN_THREAD);
+
+    // the camera, the moved objects and the programs come from the input
+    gFrameGraph.After(transforms, input);
+    gFrameGraph.After(begin, input);
+    gFrameGraph.After(cull, transforms);
+    gFrameGraph.After(record, cull);
+    gFrameGraph.After(imported, record);
+    gFrameGraph.After(imported, begin);
+}
+
+
+// Starts the frame on the GL side and draws the fixed meshes
+void UBeginFrame()
+{
+    gStreamBuffer.BeginFrame(gGlState);
+    UUploadFrameParameters();
+
+    // Enable z-depth
+    gGlState.Enable(GL_DEPTH_TEST);
+
+    // Clear the frame and z buffers
+    //glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    URender();
+    URender2();
+    URender3();
+    URender4();
+}
+
+
+// Culls the imported meshes and picks the levels of detail of what is left; CPU only
+void UCullScene()
+{
+    gFrameView = gCamera.GetViewMatrix();
+    gFrameProjection = UProjection();
+    gDrawsRecorded = false;
+    if (gSceneObjects.empty())
+        return;
+    UCullObjects(gFrameProjection * gFrameView);
+
+    // objects are independent, so the pool takes them in chunks
+    size_t chunks = (gSceneObjects.size() + RENDER_CHUNK_OBJECTS - 1) / RENDER_CHUNK_OBJECTS;
+    GetSharedThreadPool().ParallelFor(chunks, [](size_t chunk)
+    {
+        size_t end = std::min(gSceneObjects.size(), (chunk + 1) * RENDER_CHUNK_OBJECTS);
+        for (size_t i = chunk * RENDER_CHUNK_OBJECTS; i < end; ++i)
+            USelectObjectLod(gSceneObjects[i]);
+    });
+}
+
+
+// Culls on the CPU and records the draws, each chunk of objects into its own buffer; only executing them
+// touches GL
+void URecordImported()
+{
+    glm::mat4 viewProjection = gFrameProjection * gFrameView;
+    size_t chunks = (gSceneObjects.size() + RENDER_CHUNK_OBJECTS - 1) / RENDER_CHUNK_OBJECTS;
+    gDrawQueue.Begin(chunks);
+    GetSharedThreadPool().ParallelFor(chunks, [&viewProjection](size_t chunk)
+    {
+        CommandBuffer& buffer = gDrawQueue.Buffer(chunk);
+        size_t end = std::min(gSceneObjects.size(), (chunk + 1) * RENDER_CHUNK_OBJECTS);
+        for (size_t i = chunk * RENDER_CHUNK_OBJECTS; i < end; ++i)
+            URecordObject(gSceneObjects[i], viewProjection, buffer);
+    });
+    gDrawsRecorded = true;
+}
+
+
+// Draws the imported meshes, each at the level of detail whose error stays under a pixel, skipping the
+// meshlets that are off screen or face away
+void URenderImported()
+{
+    if (gSceneObjects.empty())
+        return;
+
+    if (gGpuCuller.IsReady() && gCullProgramId && URenderImportedGpu(gFrameView, gFrameProjection))
+        return;
+    // the GPU path couldn't fit its objects in the ring this frame; the CPU path records here instead
+    if (!gDrawsRecorded)
+        URecordImported();
+
+    // Imported meshes wind their front faces counter-clockwise. GL_CULL_FACE drops their back faces, which is
+    // what UMeshletFacesAway already removed whole meshlets of, so the two culls agree.
+    UBindTexture(tabletexture);
+    gGlState.Enable(GL_CULL_FACE);
+    gDrawQueue.Execute(gGlState, gStreamBuffer, gIndirectBuffer, SCENE_MODEL_UNIFORM);
+    gGlState.Disable(GL_CULL_FACE);
+}
+
+
+// Picks the level of detail whose error stays under a pixel; safe to run for different objects at once
+void USelectObjectLod(SceneObject& object)
+{
+    if (object.culled)
+        return;
+    const GLMesh& mesh = gImportedMeshes[object.mesh];
+
+    // LOD errors are in model units; the model matrix scales them by at most its longest axis
+    glm::vec3 center = glm::vec3(object.model * mesh.dequantize[3]);
+    glm::vec3 extent = glm::vec3(mesh.dequantize[0][0], mesh.dequantize[1][1], mesh.dequantize[2][2]);
+    float scale = UMaxScale(object.model);
+    float unitsToPixels = scale * UPixelsPerUnit(center, glm::length(extent) * scale);
+    object.lod = USelectLod(mesh.lods.data(), (int)mesh.lods.size(), unitsToPixels, object.lod);
+}
+
+
+// Records an object's draw on the CPU path: LOD 0 meshlet by meshlet, coarser levels as a whole, if at all
+// visible. Runs on pool threads, so it only reads the scene and writes buffer.
+void URecordObject(const SceneObject& object, const glm::mat4& viewProjection, CommandBuffer& buffer)
+{
+    if (object.culled)
+        return;
+    const GLMesh& mesh = gImportedMeshes[object.mesh];
+    std::vector<DrawElementsIndirectCommand>& commands = buffer.Commands();
+    size_t begin = commands.size();
+
+    glm::mat4 clipFromModel = viewProjection * object.model;
+    if (object.lod == 0 && !mesh.meshlets.empty())
+    {
+        glm::vec3 camera = glm::vec3(glm::inverse(object.model) * glm::vec4(gCamera.Position, 1.0f));
+        UCullMeshlets(mesh.meshlets.data(), mesh.meshlets.size(), Frustum(clipFromModel), camera, 0, commands);
+    }
+    else if (Frustum(clipFromModel * mesh.dequantize).IntersectsBox(glm::vec3(-1.0f), glm::vec3(1.0f)))
+    {
+        const MeshLod& lod = mesh.lods[object.lod];
+        commands.push_back(DrawElementsIndirectCommand{ lod.IndexCount, 1, lod.FirstIndex, 0, 0 });
+    }
+
+    // front to back within a program and mesh, so early depth testing rejects what the nearer objects hide
+    glm::vec3 center = glm::vec3(object.model * mesh.dequantize[3]);
+    float depth = glm::length(center - gCamera.Position) / CAMERA_FAR_PLANE;
+    buffer.Draw(UDrawSortKey(gProgramId, mesh.vao, depth), gProgramId, mesh.vao, mesh.indexType, object.model * mesh.dequantize, begin);
+}
+
+
+// Streams the objects to the culling pass and draws what it keeps, one multi-draw per mesh. Returns false,
+// leaving the frame to the CPU path, when the stream buffer has no room this frame.
+bool URenderImportedGpu(const glm::mat4& view, const glm::mat4& projection)
+{
+    RingAllocation allocation = gStreamBuffer.Allocate(gSceneObjects.size() * sizeof(GpuCullObject), gGpuCuller.ObjectAlignment());
+    if (!allocation.Pointer)
+        return false;
+
+    GpuCullObject* objects = (GpuCullObject*)allocation.Pointer;
+    for (size_t i = 0; i < gSceneObjects.size(); ++i)
+    {
+        const SceneObject& object = gSceneObjects[i];
+        const GLMesh& mesh = gImportedMeshes[object.mesh];
+        GpuCullObject cull;
+        cull.Model = object.model * mesh.dequantize;
+        cull.CullModel = object.model;
+        cull.CameraScale = glm::vec4(glm::vec3(glm::inverse(object.model) * glm::vec4(gCamera.Position, 1.0f)), UMaxScale(object.model));
+        UCullItemRange(object.lod, mesh.meshlets.size(), cull.ItemFirst, cull.ItemCount);
+        if (object.culled)
+            cull.ItemCount = 0;
+        cull.ItemFirst += mesh.cullItemFirst;
+        cull.CommandFirst = gGpuCuller.BatchFirstCommand(object.mesh);
+        cull.Batch = (uint32_t)object.mesh;
+        objects[i] = cull;
+    }
+    gGpuCuller.Cull(gGlState, gStreamBuffer.Buffer(), allocation.Offset, (GLuint)gSceneObjects.size(), Frustum(projection * view));
+
+    gGlState.UseProgram(gCullProgramId);
+    UBindTexture(tabletexture);
+
+    gGlState.Enable(GL_CULL_FACE);
+    for (size_t i = 0; i < gImportedMeshes.size(); ++i)
+    {
+        gGlState.BindVertexArray(gImportedMeshes[i].vao);
+        gGpuCuller.Draw(gGlState, i, gImportedMeshes[i].indexType);
+    }
+    gGlState.Disable(GL_CULL_FACE);
+    return true;
+}
+
+
+// Marks the imported objects neither cull path needs to look at: the octree finds the ones in the view, and of
+// those the ones whose bounds are hidden behind the occluders are dropped as well
+void UCullObjects(const glm::mat4& viewProjection)
+{
+    gOcclusion.Begin();
+    for (const Occluder& occluder : gOccluders)
+        gOcclusion.AddOccluder(occluder.positions.data(), occluder.indices.data(), occluder.indices.size(), viewProjection * occluder.model);
+    gOcclusion.Rasterize();
+
+    for (SceneObject& object : gSceneObjects)
+        object.culled = true;
+    gSceneOctree.QueryFrustum(Frustum(viewProjection), [&](uint32_t i)
+    {
+        SceneObject& object = gSceneObjects[i];
+        object.culled = gOcclusion.IsBoxOccluded(viewProjection * object.model * gImportedMeshes[object.mesh].dequantize);
+    });
+}
+
+
+// World bounds of a scene object: its mesh's dequantized box under the model matrix
+BvhBounds UObjectBounds(const SceneObject& object)
+{
+    return UTransformBounds(object.model * gImportedMeshes[object.mesh].dequantize, glm::vec3(-1.0f), glm::vec3(1.0f));
+}
+
+
+// Builds the BVH and the octree over the scene objects. The octree's cell is twice the scene's extent, so
+// objects can wander a good way before they end up in the root's catch-all list.
+void UBuildSceneIndex()
+{
+    std::vector<BvhBounds> bounds;
+    bounds.reserve(gSceneObjects.size());
+    BvhBounds scene;
+    for (const SceneObject& object : gSceneObjects)
+    {
+        bounds.push_back(UObjectBounds(object));
+        scene.Grow(bounds.back());
+    }
+    gSceneBvh.Build(bounds);
+
+    glm::vec3 extent = bounds.empty() ? glm::vec3(1.0f) : (scene.Upper - scene.Lower) * 0.5f;
+    gSceneOctree.Create(bounds.empty() ? glm::vec3(0.0f) : (scene.Lower + scene.Upper) * 0.5f, 2.0f * std::max(std::max(extent.x, extent.y), std::max(extent.z, 1.0f)));
+    for (size_t i = 0; i < bounds.size(); ++i)
+        gSceneOctree.Insert((uint32_t)i, bounds[i].Lower, bounds[i].Upper);
+}
+
+
+// Hands the objects that moved this frame to the octree in one batch and marks the BVH for a refit
+void UUpdateSceneIndex()
+{
+    if (gMovedObjects.empty())
+        return;
+    std::vector<OctreeMove> moves;
+    moves.reserve(gMovedObjects.size());
+    for (uint32_t i : gMovedObjects)
+    {
+        SceneObject& object = gSceneObjects[i];
+        BvhBounds bounds = UObjectBounds(object);
+        moves.push_back(OctreeMove{ i, bounds.Lower, bounds.Upper });
+        gSceneBvh.SetItemBounds(i, bounds);
+        object.moved = false;
+    }
+    gMovedObjects.clear();
+    gSceneOctree.MoveBatch(moves.data(), moves.size());
+    gSceneBvhStale = true;
+}
+
+
+// Builds the GPU culling pass over the imported meshes: their cull items, one batch of commands per mesh
+// for the instanced shader variant. Leaves gGpuCuller unready (so the CPU path draws) when anything fails.
+void UCreateGpuCulling()
+{
+    if (gSceneObjects.empty() || !gCullProgramId)
+        return;
+
+    std::vector<GpuCullItem> items;
+    std::vector<GLuint> capacities(gImportedMeshes.size(), 0);
+    for (GLMesh& mesh : gImportedMeshes)
+    {
+        glm::vec3 extent = glm::vec3(mesh.dequantize[0][0], mesh.dequantize[1][1], mesh.dequantize[2][2]);
+        mesh.cullItemFirst = UAppendCullItems(mesh.lods, mesh.meshlets, glm::vec4(glm::vec3(mesh.dequantize[3]), glm::length(extent)), items);
+    }
+    for (const SceneObject& object : gSceneObjects)
+        capacities[object.mesh] += (GLuint)std::max<size_t>(gImportedMeshes[object.mesh].meshlets.size(), 1);
+
+    if (!gGpuCuller.Create(items, capacities, (GLuint)gSceneObjects.size(), gGlState, &gShaderCache))
+    {
+        cerr << "GPU culling unavailable: " << gGpuCuller.FailureReason << endl << gGpuCuller.BuildLog();
+        return;
+    }
+    for (const GLMesh& mesh : gImportedMeshes)
+        gGpuCuller.AttachToVertexArray(gGlState, mesh.vao);
+}
+
+
+// The projection every render function sets up: perspective, or ortho when toggled with P
+glm::mat4 UProjection()
+{
+    if (ortho) {
+        return glm::ortho(-((float)WINDOW_WIDTH / ORTHO_SCALE), ((float)WINDOW_WIDTH / ORTHO_SCALE), -((float)WINDOW_HEIGHT / ORTHO_SCALE), ((float)WINDOW_HEIGHT / ORTHO_SCALE), 4.5f, 6.5f);
+    }
+    return glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.5f, CAMERA_FAR_PLANE);
+}
+
+
+// Longest axis of a transform's linear part, for scaling distances and radii conservatively
+float UMaxScale(const glm::mat4& model)
+{
+    return std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+}
+
+
+// How many pixels one world unit covers at the nearest point of a bounding sphere
+float UPixelsPerUnit(const glm::vec3& center, float radius)
+{
+    if (ortho)
+        return ORTHO_SCALE / 2.0f; // WINDOW_HEIGHT pixels over 2 * WINDOW_HEIGHT / ORTHO_SCALE units
+    float distance = std::max(glm::length(center - gCamera.Position) - radius, 0.5f);
+    return (float)WINDOW_HEIGHT / (2.0f * std::tan(glm::radians(gCamera.Zoom) * 0.5f) * distance);
+}
+
+
 void UCreateMesh2(GLMesh& mesh)
 {
     // Position and Color data
@@ -664,34 +1285,139 @@ void UCreateMesh2(GLMesh& mesh)
         1, 2, 7 // Triangle 12
     };
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
-    const GLuint floatsPerUV = 2;
+    // Reorder for the vertex cache, pack into the compact vertex format and upload
+    MeshData data = UMeshFromInterleaved(verts, sizeof(verts) / sizeof(verts[0]), indices, sizeof(indices) / sizeof(indices[0]));
+    UOptimizeMesh(data);
+    UCreateMeshFromPacked(UPackSceneMesh(data), mesh);
+}
+
+
+// Splits the position / color / UV float arrays the meshes are written as into a MeshData
+MeshData UMeshFromInterleaved(const GLfloat* verts, size_t floatCount, const GLushort* indices, size_t indexCount)
+{
+    const size_t floatsPerVertex = 3 + 4 + 2;
+
+    MeshData data;
+    for (size_t i = 0; i + floatsPerVertex <= floatCount; i += floatsPerVertex)
+    {
+        data.Positions.push_back(glm::vec3(verts[i], verts[i + 1], verts[i + 2]));
+        data.Colors.push_back(glm::vec4(verts[i + 3], verts[i + 4], verts[i + 5], verts[i + 6]));
+        data.TexCoords.push_back(glm::vec2(verts[i + 7], verts[i + 8]));
+    }
+    data.Indices.assign(indices, indices + indexCount);
+    return data;
+}
+
+
+// Packs a mesh for the scene shaders, in SceneVertexLayout unless its UVs need SceneTiledVertexLayout's floats
+PackedMesh UPackSceneMesh(const MeshData& data)
+{
+    if (UTexCoordsInUnitRange(data))
+        return UPackMesh<SceneVertexLayout>(data);
+    return UPackMesh<SceneTiledVertexLayout>(data);
+}
 
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
+
+// Uploads a packed mesh into a new VAO with its vertex and index buffers
+void UCreateMeshFromPacked(const PackedMesh& packed, GLMesh& mesh)
+{
+    mesh.nIndices = packed.Lods[0].IndexCount;
+    mesh.lods = packed.Lods;
+    mesh.meshlets = packed.Meshlets;
+    mesh.indexType = packed.IndexType;
+    mesh.dequantize = packed.Dequantize();
+    UCreateMeshBuffers(packed.Vertices.data(), packed.Vertices.size(), packed.Indices.data(), packed.Indices.size(), packed.Stride, packed.Attributes.data(), packed.Attributes.size(), mesh);
+}
+
+
+// Uploads a mesh straight from a mapped cache file; the driver copies out of the mapping
+void UCreateMeshFromCache(const MeshCacheView& cache, GLMesh& mesh)
+{
+    const MeshCacheHeader& header = cache.Header();
+    mesh.nIndices = header.Lods[0].IndexCount;
+    mesh.lods.assign(header.Lods, header.Lods + header.LodCount);
+    mesh.meshlets.assign(cache.Meshlets(), cache.Meshlets() + header.MeshletCount);
+    mesh.indexType = header.IndexType;
+    mesh.dequantize = cache.Dequantize();
+    UCreateMeshBuffers(cache.Vertices(), (size_t)header.VertexBytes, cache.Indices(), (size_t)header.IndexBytes, (GLsizei)header.Stride, header.Attributes, header.AttributeCount, mesh);
+}
+
+
+// Creates the VAO and immutable vertex and index buffers for already packed vertices
+void UCreateMeshBuffers(const void* vertices, size_t vertexBytes, const void* indices, size_t indexBytes, GLsizei stride, const VertexAttribute* attributes, size_t attributeCount, GLMesh& mesh)
+{
+    glGenVertexArrays(1, &mesh.vao);
+    gGlState.BindVertexArray(mesh.vao);
 
     // Create 2 buffers: first one for the vertex data; second one for the indices
     glGenBuffers(2, mesh.vbos);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    gGlState.BindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+    glBufferStorage(GL_ARRAY_BUFFER, vertexBytes, vertices, 0); // Sends vertex or coordinate data to the GPU
+    glBindVertexBuffer(0, mesh.vbos[0], 0, stride);
 
-    mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    gGlState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indices, 0);
 
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV);
+    // Describe each attribute; they all read from the vertex buffer on binding 0
+    for (size_t i = 0; i < attributeCount; ++i)
+    {
+        const VertexAttribute& attribute = attributes[i];
+        glVertexAttribFormat(attribute.Location, attribute.Components, attribute.Type, attribute.Normalized, attribute.Offset);
+        glVertexAttribBinding(attribute.Location, 0);
+        glEnableVertexAttribArray(attribute.Location);
+    }
+}
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+// Loads an OBJ or glTF file through its binary cache (<file>.meshcache). The cache is rebuilt when it is
+// missing, older than the file, or packed with a different vertex layout; rebuilding optimizes the
+// triangle and vertex order, builds meshlets and the LOD chain and prints the vertex cache statistics.
+bool ULoadMeshFile(const std::string& filename, GLMesh& mesh)
+{
+    std::string cacheFilename = filename + ".meshcache";
+    const std::array<VertexAttribute, SceneVertexLayout::Count> layout = SceneVertexLayout::Table();
+    const std::array<VertexAttribute, SceneTiledVertexLayout::Count> tiledLayout = SceneTiledVertexLayout::Table();
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerColor)));
-    glEnableVertexAttribArray(2);
+    MeshCacheView cache;
+    if (cache.Open(cacheFilename) && UMeshCacheIsFresh(cache, filename)
+        && (cache.HasAttributes(layout.data(), layout.size()) || cache.HasAttributes(tiledLayout.data(), tiledLayout.size())))
+    {
+        UCreateMeshFromCache(cache, mesh);
+        const MeshCacheHeader& header = cache.Header();
+        if (!UBuildPickMesh(cache.Vertices(), header.VertexCount, (GLsizei)header.Stride, header.Attributes, header.AttributeCount,
+            cache.Indices(), header.IndexType, header.Lods[0].FirstIndex, header.Lods[0].IndexCount, mesh.pick))
+            cerr << filename << " can't be picked: its positions or indices are unusable" << endl;
+        return true;
+    }
+    cache.Close();
+
+    ImportedMesh imported = UImportMesh(filename);
+    if (imported.FailureReason)
+    {
+        cerr << "Failed to import " << filename << ": " << imported.FailureReason << endl;
+        return false;
+    }
+    // Regrouping into meshlets reorders triangles again, so the vertices are renumbered after it
+    VertexCacheStats before, after;
+    UOptimizeMesh(imported.Mesh, &before);
+    UBuildMeshlets(imported.Mesh);
+    UOptimizeVertexFetch(imported.Mesh);
+    after = UAnalyzeVertexCache(imported.Mesh.Indices, imported.Mesh.Positions.size());
+    cout << filename << ": " << imported.Mesh.Indices.size() / 3 << " triangles, ACMR " << before.ACMR << " -> " << after.ACMR
+        << ", ATVR " << before.ATVR << " -> " << after.ATVR << ", " << imported.Mesh.Meshlets.size() << " meshlets" << endl;
+
+    UGenerateLods(imported.Mesh);
+    for (size_t i = 1; i < imported.Mesh.Lods.size(); ++i)
+        cout << "  LOD " << i << ": " << imported.Mesh.Lods[i].IndexCount / 3 << " triangles, error " << imported.Mesh.Lods[i].Error << endl;
+
+    PackedMesh packed = UPackSceneMesh(imported.Mesh);
+    if (!UWriteMeshCache(cacheFilename, packed, filename))
+        cerr << "Failed to write mesh cache " << cacheFilename << endl;
+    UCreateMeshFromPacked(packed, mesh);
+    if (!UBuildPickMesh(packed.Vertices.data(), packed.VertexCount, packed.Stride, packed.Attributes.data(), packed.Attributes.size(),
+        packed.Indices.data(), packed.IndexType, packed.Lods[0].FirstIndex, packed.Lods[0].IndexCount, mesh.pick))
+        cerr << filename << " can't be picked: its positions or indices are unusable" << endl;
+    return true;
 }
 
 
@@ -703,86 +1429,133 @@ void UCreateMesh2(GLMesh& mesh)
 
 
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+// Watches shaders/ for the scene sources. Without that directory the built-in sources are used as they are;
+// create it and the next start writes them out there for editing.
+void UWatchShaders()
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
+    const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    const char* files[] = { "shaders/scene.vert", "shaders/scene.frag" };
+    const char* sources[] = { vertexShaderSource, fragmentShaderSource };
+    gSceneShaders.Create(types, files, sources, 2, &gShaderCache);
+}
 
-    // Create a Shader program object.
-    programId = glCreateProgram();
 
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+// The shader variant that draws with a texture: planar YCbCr ones need the conversion
+uint32_t UMaterialKey(const GLTexture& texture, bool instanced)
+{
+    return SHADER_TEXTURED | (texture.planarYCbCr ? SHADER_PLANAR_YCBCR : 0) | (instanced ? SHADER_INSTANCED : 0);
+}
 
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
 
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+// Points gProgramId and gCullProgramId at tabletexture's variants, building any that weren't precompiled.
+// A missing scene program is fatal; without the instanced one the CPU path draws the imported meshes.
+bool UResolvePrograms()
+{
+    std::string mismatch;
+    gProgramId = gSceneShaders.Get(UMaterialKey(tabletexture, false));
+    if (!gProgramId)
     {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-
+        std::cout << "ERROR::SHADER::PROGRAM::BUILD_FAILED\n" << gSceneShaders.Error() << std::endl;
         return false;
     }
-
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+    if (!UCheckSceneVariant(UMaterialKey(tabletexture, false), gProgramId, mismatch))
     {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-
+        std::cout << "ERROR::SHADER::PROGRAM::LAYOUT_MISMATCH\n" << mismatch << std::endl;
         return false;
     }
+    gCullProgramId = gSceneShaders.Get(UMaterialKey(tabletexture, true));
+    if (!gCullProgramId)
+        cerr << "The instanced scene shaders didn't build\n" << gSceneShaders.Error() << endl;
+    else if (!UCheckSceneVariant(UMaterialKey(tabletexture, true), gCullProgramId, mismatch))
+    {
+        cerr << "The instanced scene shaders don't match the CPU side: " << mismatch << endl;
+        gCullProgramId = 0;
+    }
+    return true;
+}
 
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
 
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
+// Load-time check of a scene variant against what the CPU side feeds it: the vertex inputs (including any the
+// static_assert can't see for lack of an explicit location), the model matrix's slot and the parameter blocks.
+// extraAttributes are the locations fed besides SceneVertexLayout, such as GpuCuller's object index.
+bool UCheckSceneProgram(GLuint programId, unsigned extraAttributes, std::string& mismatch)
+{
+    ShaderReflection reflection;
+    reflection.Reflect(programId);
+    if ((reflection.AttributeMask() & ~(SceneVertexLayout::Mask() | extraAttributes)) != 0)
     {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-
+        mismatch = "the vertex shader reads attributes SceneVertexLayout doesn't provide";
+        return false;
+    }
+    for (const ReflectedAttribute& attribute : reflection.Attributes())
+        if (attribute.Location == GPU_CULL_OBJECT_ATTRIBUTE && (extraAttributes & (1u << GPU_CULL_OBJECT_ATTRIBUTE)) && attribute.Type != GL_UNSIGNED_INT)
+        {
+            mismatch = attribute.Name + " isn't the uint object index GpuCuller feeds";
+            return false;
+        }
+    const ReflectedUniform* model = reflection.FindUniform("model");
+    if (model && (model->Location != SCENE_MODEL_UNIFORM || model->Type != GL_FLOAT_MAT4))
+    {
+        mismatch = "model isn't a mat4 at location " + std::to_string(SCENE_MODEL_UNIFORM);
         return false;
     }
+    return gFrameParameters.Matches(reflection, mismatch) && gMaterialParameters.Matches(reflection, mismatch);
+}
 
-    glUseProgram(programId);    // Uses the shader program
 
-    return true;
+// UCheckSceneProgram with the extra inputs a variant's features add: instanced ones read GpuCuller's object index
+bool UCheckSceneVariant(uint32_t key, GLuint programId, std::string& mismatch)
+{
+    return UCheckSceneProgram(programId, (key & SHADER_INSTANCED) ? 1u << GPU_CULL_OBJECT_ATTRIBUTE : 0u, mismatch);
 }
 
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
+
+// The scene shaders' uniform blocks, with the field tables their layouts are checked against
+void UCreateParameterBlocks()
 {
-    for (int j = 0; j < height / 2; ++j)
-    {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
+    const ParameterField frameFields[] = {
+        PARAMETER_FIELD(SceneFrameParameters, View, "view", GL_FLOAT_MAT4),
+        PARAMETER_FIELD(SceneFrameParameters, Projection, "projection", GL_FLOAT_MAT4),
+    };
+    gFrameParameters.Create("Frame", SCENE_FRAME_BLOCK, frameFields, sizeof(frameFields) / sizeof(frameFields[0]), gGlState);
 
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
-    }
+    const ParameterField materialFields[] = {
+        PARAMETER_FIELD(SceneMaterialParameters, ChromaTransform, "uChromaTransform", GL_FLOAT_VEC4),
+        PARAMETER_FIELD(SceneMaterialParameters, BaseColor, "uBaseColor", GL_FLOAT_VEC4),
+        PARAMETER_FIELD(SceneMaterialParameters, LightDirection, "uLightDirection", GL_FLOAT_VEC3),
+        PARAMETER_FIELD(SceneMaterialParameters, AlphaCutoff, "uAlphaCutoff", GL_FLOAT),
+    };
+    gMaterialParameters.Create("Material", SCENE_MATERIAL_BLOCK, materialFields, sizeof(materialFields) / sizeof(materialFields[0]), gGlState);
 }
 
-void UDestroyShaderProgram(GLuint programId)
+
+// The camera's matrices, which every scene draw this frame reads from the frame block
+void UUploadFrameParameters()
+{
+    SceneFrameParameters& frame = gFrameParameters.Staging();
+    frame.View = gCamera.GetViewMatrix();
+    frame.Projection = UProjection();
+    gFrameParameters.Upload(gGlState, gStreamBuffer);
+}
+
+
+// Swaps in the variants once the edited sources have finished building and pass the layout checks; a broken
+// or mismatched edit keeps the old ones running
+void UReloadShaders()
 {
-    glDeleteProgram(programId);
+    ShaderReload_Result result = gSceneShaders.Update(UCheckSceneVariant);
+    if (result == SHADER_RELOAD_SWAPPED)
+    {
+        gGlState.Forget(GL_STATE_PROGRAM); // a new program can get the name of a deleted one
+        // every variant passed the checks before the swap, so this only fails if one went missing since
+        if (!UResolvePrograms())
+        {
+            cerr << "The reloaded scene shaders can't draw the scene; stopping" << endl;
+            glfwSetWindowShouldClose(gWindow, true);
+            return;
+        }
+        cout << "Reloaded the scene shaders (" << gSceneShaders.Count() << " variants)" << endl;
+    }
+    else if (result == SHADER_RELOAD_FAILED)
+        cerr << "The edited scene shaders didn't build or don't match the CPU side; keeping the old programs\n" << gSceneShaders.Error() << endl;
 }
@@ -0,0 +1,203 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "gl_state.h"
+#include "mesh_meshlets.h"
+#include "ring_buffer.h"
+
+// Recorded draws. Deciding what to draw (culling, level of detail, the per-draw data) is CPU work that splits
+// across the thread pool, but GL calls have to come from the context's thread. So pool tasks record into
+// CommandBuffers, one per task and never shared, appending compact draw records and the indirect commands they
+// draw to plain arrays that keep their capacity from frame to frame. The GL thread then merges every buffer,
+// sorts the draws by state (program, then vertex array, then front to back), copies all their indirect
+// commands into the ring buffer in that order and issues them through the state cache.
+
+#define COMMAND_QUEUE_DEPTH_BITS 24
+
+// What a recorded draw needs from the GL thread: its state, its model matrix and a range of its buffer's commands
+struct RecordedDraw
+{
+	uint64_t SortKey;
+	GLuint Program;
+	GLuint VertexArray;
+	GLenum IndexType;
+	uint32_t FirstCommand;
+	uint32_t CommandCount;
+	glm::mat4 Model;
+};
+
+struct CommandQueueStats
+{
+	uint32_t Buffers = 0;     // recording buffers used last frame
+	uint32_t Draws = 0;       // multi-draws issued last frame
+	uint32_t Commands = 0;    // indirect commands they drew
+	double SortMilliseconds = 0.0;
+};
+
+// Sorts by program, then vertex array, then near to far; depth is the draw's distance over the far plane's.
+// Names wider than their fields only weaken the grouping, never the result.
+inline uint64_t UDrawSortKey(GLuint program, GLuint vertexArray, float depth)
+{
+	const uint64_t depthMask = (1ull << COMMAND_QUEUE_DEPTH_BITS) - 1;
+	uint64_t quantized = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * (float)depthMask);
+	return ((uint64_t)(program & 0xFFFF) << 48) | ((uint64_t)(vertexArray & 0xFFFFFF) << COMMAND_QUEUE_DEPTH_BITS) | quantized;
+}
+
+class CommandBuffer
+{
+public:
+	void Reset()
+	{
+		draws.clear();
+		commands.clear();
+	}
+
+	// Records a draw of the commands appended to Commands() since begin (a Commands().size() taken before
+	// appending them); nothing is recorded when there are none
+	void Draw(uint64_t sortKey, GLuint program, GLuint vertexArray, GLenum indexType, const glm::mat4& model, size_t begin)
+	{
+		if (commands.size() <= begin)
+			return;
+		draws.push_back(RecordedDraw{ sortKey, program, vertexArray, indexType, (uint32_t)begin, (uint32_t)(commands.size() - begin), model });
+	}
+
+	// the buffer's indirect commands, for recording code to append to
+	std::vector<DrawElementsIndirectCommand>& Commands()
+	{
+		return commands;
+	}
+
+	const std::vector<DrawElementsIndirectCommand>& Commands() const
+	{
+		return commands;
+	}
+
+	const std::vector<RecordedDraw>& Draws() const
+	{
+		return draws;
+	}
+
+private:
+	std::vector<RecordedDraw> draws;
+	std::vector<DrawElementsIndirectCommand> commands;
+};
+
+// Owns no GL objects; fallbackBuffer belongs to the caller.
+class CommandQueue
+{
+public:
+	// Hands out bufferCount empty buffers for this frame's recording tasks
+	void Begin(size_t bufferCount)
+	{
+		if (buffers.size() < bufferCount)
+			buffers.resize(bufferCount);
+		used = bufferCount;
+		for (size_t i = 0; i < used; ++i)
+			buffers[i].Reset();
+	}
+
+	// the buffer of recording task index; each task must only touch its own
+	CommandBuffer& Buffer(size_t index)
+	{
+		return buffers[index];
+	}
+
+	// GL thread only. Merges and sorts what was recorded since Begin() and draws it with modelLocation set per
+	// draw. The commands go to the ring; a frame that doesn't fit takes fallbackBuffer instead.
+	void Execute(GLStateCache& state, RingBuffer& ring, GLuint fallbackBuffer, GLint modelLocation)
+	{
+		auto start = std::chrono::steady_clock::now();
+		merged.clear();
+		size_t commandCount = 0;
+		for (size_t b = 0; b < used; ++b)
+		{
+			const std::vector<RecordedDraw>& draws = buffers[b].Draws();
+			for (size_t d = 0; d < draws.size(); ++d)
+				merged.push_back(Entry{ draws[d].SortKey, (uint32_t)b, (uint32_t)d });
+			commandCount += buffers[b].Commands().size();
+		}
+		// ties keep recording order, so a frame draws the same way whichever thread recorded what
+		std::sort(merged.begin(), merged.end(), [](const Entry& a, const Entry& b)
+		{
+			return a.Key != b.Key ? a.Key < b.Key : (a.Buffer != b.Buffer ? a.Buffer < b.Buffer : a.Draw < b.Draw);
+		});
+		stats.SortMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		stats.Buffers = (uint32_t)used;
+		stats.Draws = (uint32_t)merged.size();
+		stats.Commands = (uint32_t)commandCount;
+		if (merged.empty())
+			return;
+
+		// The commands in draw order, so each draw's range stays contiguous
+		size_t commandBytes = commandCount * sizeof(DrawElementsIndirectCommand);
+		RingAllocation allocation = ring.Allocate(commandBytes, sizeof(GLuint));
+		DrawElementsIndirectCommand* out = (DrawElementsIndirectCommand*)allocation.Pointer;
+		if (!out)
+		{
+			staging.resize(commandCount);
+			out = staging.data();
+		}
+		offsets.resize(merged.size());
+		size_t written = 0;
+		for (size_t i = 0; i < merged.size(); ++i)
+		{
+			const CommandBuffer& buffer = buffers[merged[i].Buffer];
+			const RecordedDraw& draw = buffer.Draws()[merged[i].Draw];
+			memcpy(out + written, buffer.Commands().data() + draw.FirstCommand, draw.CommandCount * sizeof(DrawElementsIndirectCommand));
+			offsets[i] = written;
+			written += draw.CommandCount;
+		}
+
+		GLintptr base = allocation.Offset;
+		if (allocation.Pointer)
+			state.BindBuffer(GL_DRAW_INDIRECT_BUFFER, ring.Buffer());
+		else
+		{
+			// The ring grows before the next frame; this one takes the slow path
+			state.BindBuffer(GL_DRAW_INDIRECT_BUFFER, fallbackBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, commandBytes, staging.data(), GL_STREAM_DRAW);
+			base = 0;
+		}
+
+		for (size_t i = 0; i < merged.size(); ++i)
+		{
+			const RecordedDraw& draw = buffers[merged[i].Buffer].Draws()[merged[i].Draw];
+			state.UseProgram(draw.Program);
+			state.BindVertexArray(draw.VertexArray);
+			glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(draw.Model));
+			glMultiDrawElementsIndirect(GL_TRIANGLES, draw.IndexType, (const void*)(base + offsets[i] * sizeof(DrawElementsIndirectCommand)), (GLsizei)draw.CommandCount, 0);
+		}
+	}
+
+	const CommandQueueStats& Stats() const
+	{
+		return stats;
+	}
+
+private:
+	struct Entry
+	{
+		uint64_t Key;
+		uint32_t Buffer;
+		uint32_t Draw;
+	};
+
+	std::vector<CommandBuffer> buffers;
+	size_t used = 0;
+	std::vector<Entry> merged;
+	std::vector<size_t> offsets;
+	std::vector<DrawElementsIndirectCommand> staging;
+	CommandQueueStats stats;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+// The six clip planes of a view volume (Gribb and Hartmann). Built from projection * view * model the planes
+// are in that model's space, so bounds can be tested without transforming them first.
+struct Frustum
+{
+	glm::vec4 Planes[6]; // left, right, bottom, top, near, far; xyz is the unit inward normal, w the offset
+
+	Frustum() {}
+
+	explicit Frustum(const glm::mat4& clipFromSpace)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+			for (int side = 0; side < 2; ++side)
+			{
+				glm::vec4& plane = Planes[axis * 2 + side];
+				float sign = side == 0 ? 1.0f : -1.0f;
+				for (int column = 0; column < 4; ++column)
+					plane[column] = clipFromSpace[column][3] + sign * clipFromSpace[column][axis];
+				float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+				if (length > 0.0f)
+					plane = plane * (1.0f / length);
+			}
+	}
+
+	// false only when the sphere lies entirely outside one of the planes
+	bool IntersectsSphere(const glm::vec3& center, float radius) const
+	{
+		for (const glm::vec4& plane : Planes)
+			if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+				return false;
+		return true;
+	}
+
+	// false only when the box lies entirely outside one of the planes
+	bool IntersectsBox(const glm::vec3& lower, const glm::vec3& upper) const
+	{
+		for (const glm::vec4& plane : Planes)
+		{
+			// the corner furthest along the plane normal
+			glm::vec3 corner(plane.x >= 0.0f ? upper.x : lower.x, plane.y >= 0.0f ? upper.y : lower.y, plane.z >= 0.0f ? upper.z : lower.z);
+			if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
+
+#endif
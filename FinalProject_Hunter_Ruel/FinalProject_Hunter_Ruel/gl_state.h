@@ -0,0 +1,272 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+// GL state cache. The draw code sets state through it rather than calling GL directly, and it only passes on the
+// calls that change something: binding the program, vertex array or texture that is already bound, or enabling
+// what is already enabled, costs a comparison instead of a trip through the driver. It counts the calls it
+// issued and the ones it skipped, per frame and in total.
+//
+// The cache only knows what went through it, so the helpers that bind for the draw code (RingBuffer,
+// ParameterBlock, GpuCuller) take it too. Code that still sets the same state directly has to be followed by
+// Forget() for what it touched, and a deleted object's name can come back for a new one, so delete buffers
+// through DeleteBuffers() and forget whatever else was bound when deleting it. Everything starts out unknown,
+// so the first call for each piece of state is always issued.
+
+#define GL_STATE_TEXTURE_UNITS 16
+#define GL_STATE_UNKNOWN 0xFFFFFFFFu
+
+struct GLStateStats
+{
+	uint64_t Issued = 0;    // calls that reached GL
+	uint64_t Skipped = 0;   // calls that would have set what was already set
+};
+
+enum GLState_Part
+{
+	GL_STATE_PROGRAM = 1 << 0,
+	GL_STATE_VERTEX_ARRAY = 1 << 1,
+	GL_STATE_TEXTURES = 1 << 2,      // the active unit and every unit's binding
+	GL_STATE_BUFFERS = 1 << 3,
+	GL_STATE_CAPABILITIES = 1 << 4,
+	GL_STATE_ALL = 0x1F
+};
+
+class GLStateCache
+{
+public:
+	GLStateCache()
+	{
+		Forget(GL_STATE_ALL);
+	}
+
+	// Starts counting a new frame; FrameStats() then reports the frame that just ended
+	void BeginFrame()
+	{
+		lastFrame = frame;
+		frame = GLStateStats();
+	}
+
+	// Marks state as unknown after it was set behind the cache's back; the next call for it is issued
+	void Forget(int parts)
+	{
+		if (parts & GL_STATE_PROGRAM)
+			program = GL_STATE_UNKNOWN;
+		if (parts & GL_STATE_VERTEX_ARRAY)
+			vertexArray = GL_STATE_UNKNOWN;
+		if (parts & GL_STATE_TEXTURES)
+		{
+			activeUnit = GL_STATE_UNKNOWN;
+			for (TextureBinding& binding : textures)
+				binding = TextureBinding();
+		}
+		if (parts & GL_STATE_BUFFERS)
+			for (GLuint& buffer : buffers)
+				buffer = GL_STATE_UNKNOWN;
+		if (parts & GL_STATE_CAPABILITIES)
+			for (int& enabled : capabilities)
+				enabled = -1;
+	}
+
+	void UseProgram(GLuint programId)
+	{
+		if (skip(program == programId))
+			return;
+		program = programId;
+		glUseProgram(programId);
+	}
+
+	void BindVertexArray(GLuint vao)
+	{
+		if (skip(vertexArray == vao))
+			return;
+		vertexArray = vao;
+		glBindVertexArray(vao);
+	}
+
+	// Binds texture to unit, making the unit active first only when it has to be
+	void BindTexture(GLuint unit, GLenum target, GLuint texture)
+	{
+		if (unit >= GL_STATE_TEXTURE_UNITS)
+		{
+			ActiveTexture(unit);
+			issue();
+			glBindTexture(target, texture);
+			return;
+		}
+		TextureBinding& binding = textures[unit];
+		if (skip(binding.Target == target && binding.Texture == texture))
+			return;
+		ActiveTexture(unit);
+		binding.Target = target;
+		binding.Texture = texture;
+		glBindTexture(target, texture);
+	}
+
+	void ActiveTexture(GLuint unit)
+	{
+		if (skip(activeUnit == unit))
+			return;
+		activeUnit = unit;
+		glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	// Binds buffer to one of the generic targets; GL_ELEMENT_ARRAY_BUFFER belongs to the vertex array and isn't
+	// cached, nor are targets the cache has no slot for
+	void BindBuffer(GLenum target, GLuint buffer)
+	{
+		int slot = bufferSlot(target);
+		if (slot < 0)
+		{
+			issue();
+			glBindBuffer(target, buffer);
+			return;
+		}
+		if (skip(buffers[slot] == buffer))
+			return;
+		buffers[slot] = buffer;
+		glBindBuffer(target, buffer);
+	}
+
+	// Binds a range of buffer to an indexed binding point. Indexed bindings aren't cached and are always
+	// issued, but GL binds the buffer to the generic target as well, so that slot follows.
+	void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+	{
+		issue();
+		recordBuffer(target, buffer);
+		glBindBufferRange(target, index, buffer, offset, size);
+	}
+
+	void BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+	{
+		issue();
+		recordBuffer(target, buffer);
+		glBindBufferBase(target, index, buffer);
+	}
+
+	// Deletes buffers; GL unbinds a deleted buffer from every target it was bound to, so those slots go back to 0
+	void DeleteBuffers(GLsizei count, const GLuint* ids)
+	{
+		for (GLsizei i = 0; i < count; ++i)
+			for (GLuint& buffer : buffers)
+				if (ids[i] && buffer == ids[i])
+					buffer = 0;
+		issue();
+		glDeleteBuffers(count, ids);
+	}
+
+	void Enable(GLenum capability)
+	{
+		setCapability(capability, true);
+	}
+
+	void Disable(GLenum capability)
+	{
+		setCapability(capability, false);
+	}
+
+	// calls in the last frame that BeginFrame() closed
+	const GLStateStats& FrameStats() const
+	{
+		return lastFrame;
+	}
+
+	const GLStateStats& TotalStats() const
+	{
+		return total;
+	}
+
+private:
+	enum { BUFFER_SLOTS = 6, CAPABILITY_SLOTS = 7 };
+
+	struct TextureBinding
+	{
+		GLenum Target = GL_STATE_UNKNOWN;
+		GLuint Texture = GL_STATE_UNKNOWN;
+	};
+
+	GLuint program;
+	GLuint vertexArray;
+	GLuint activeUnit;
+	TextureBinding textures[GL_STATE_TEXTURE_UNITS];
+	GLuint buffers[BUFFER_SLOTS];
+	int capabilities[CAPABILITY_SLOTS];   // -1 unknown, 0 disabled, 1 enabled
+	GLStateStats frame, lastFrame, total;
+
+	// counts the call; true when it is redundant and should be skipped
+	bool skip(bool redundant)
+	{
+		if (!redundant)
+		{
+			issue();
+			return false;
+		}
+		++frame.Skipped;
+		++total.Skipped;
+		return true;
+	}
+
+	void issue()
+	{
+		++frame.Issued;
+		++total.Issued;
+	}
+
+	static int bufferSlot(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER: return 0;
+		case GL_DRAW_INDIRECT_BUFFER: return 1;
+		case GL_UNIFORM_BUFFER: return 2;
+		case GL_SHADER_STORAGE_BUFFER: return 3;
+		case GL_COPY_WRITE_BUFFER: return 4;
+		case GL_PARAMETER_BUFFER_ARB: return 5;
+		default: return -1;
+		}
+	}
+
+	void recordBuffer(GLenum target, GLuint buffer)
+	{
+		int slot = bufferSlot(target);
+		if (slot >= 0)
+			buffers[slot] = buffer;
+	}
+
+	static int capabilitySlot(GLenum capability)
+	{
+		switch (capability)
+		{
+		case GL_DEPTH_TEST: return 0;
+		case GL_CULL_FACE: return 1;
+		case GL_BLEND: return 2;
+		case GL_SCISSOR_TEST: return 3;
+		case GL_STENCIL_TEST: return 4;
+		case GL_POLYGON_OFFSET_FILL: return 5;
+		case GL_RASTERIZER_DISCARD: return 6;
+		default: return -1;
+		}
+	}
+
+	void setCapability(GLenum capability, bool enable)
+	{
+		int slot = capabilitySlot(capability);
+		if (slot >= 0)
+		{
+			if (skip(capabilities[slot] == (enable ? 1 : 0)))
+				return;
+			capabilities[slot] = enable ? 1 : 0;
+		}
+		else
+			issue();
+		if (enable)
+			glEnable(capability);
+		else
+			glDisable(capability);
+	}
+};
+
+#endif
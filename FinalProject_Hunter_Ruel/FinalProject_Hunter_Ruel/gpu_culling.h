@@ -0,0 +1,381 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "frustum.h"
+#include "gl_state.h"
+#include "mesh_meshlets.h"
+#include "shader_batch.h"
+#include "shader_cache.h"
+#include "vertex_format.h"
+
+// GPU-driven culling. Every mesh's cull items (its LOD 0 meshlets, then one item per coarser level) live in
+// a static SSBO. Each frame the application streams one GpuCullObject per scene object, naming the items of
+// the level it picked, and a compute pass with one work group per object tests those items against the
+// frustum and the normal cones. Survivors are appended with atomic counters to their mesh's range of the
+// command buffer, which glMultiDrawElementsIndirectCount (or a fixed-count draw over a zeroed buffer, where
+// ARB_indirect_parameters is missing) then draws without the CPU ever seeing the result.
+//
+// baseInstance carries the object index into the draw. Vertex shaders read it through an instanced vertex
+// attribute (AttachToVertexArray), which honors baseInstance without needing gl_BaseInstance (GL 4.6).
+
+#define GPU_CULL_OBJECT_ATTRIBUTE 4   // "layout(location = 4) in uint objectIndex" in the vertex shader
+#define GPU_CULL_OBJECT_BINDING 1     // vertex buffer binding of the object index stream
+#define GPU_CULL_OBJECTS_SSBO 0       // shader storage binding of the GpuCullObject array
+
+// One scene object for the current frame (std430 layout)
+struct GpuCullObject
+{
+	glm::mat4 Model;         // full model matrix for the vertex shader, dequantization included
+	glm::mat4 CullModel;     // from the cull items' space to world space
+	glm::vec4 CameraScale;   // xyz: camera position in the cull items' space; w: longest axis scale of CullModel
+	uint32_t ItemFirst;
+	uint32_t ItemCount;
+	uint32_t CommandFirst;   // start of this object's mesh's range in the command buffer
+	uint32_t Batch;          // which draw count this object adds to
+};
+static_assert(sizeof(GpuCullObject) == 160, "GpuCullObject must match the std430 layout");
+
+// A bounding sphere and normal cone over a range of indices (std430 layout)
+struct GpuCullItem
+{
+	glm::vec4 Sphere;        // center, radius
+	glm::vec4 Cone;          // axis, cutoff; a cutoff of 1 never culls
+	uint32_t FirstIndex;
+	uint32_t IndexCount;
+	uint32_t Padding[2];
+};
+static_assert(sizeof(GpuCullItem) == 48, "GpuCullItem must match the std430 layout");
+
+constexpr GLchar gpuCullShaderSource[] = R"glsl(#version 440 core
+layout(local_size_x = 64) in;
+
+struct CullObject
+{
+	mat4 model;
+	mat4 cullModel;
+	vec4 cameraScale;
+	uint itemFirst;
+	uint itemCount;
+	uint commandFirst;
+	uint batch;
+};
+
+struct CullItem
+{
+	vec4 sphere;
+	vec4 cone;
+	uint firstIndex;
+	uint indexCount;
+	uint padding0;
+	uint padding1;
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Objects { CullObject objects[]; };
+layout(std430, binding = 1) readonly buffer Items { CullItem items[]; };
+layout(std430, binding = 2) writeonly buffer Commands { DrawCommand commands[]; };
+layout(std430, binding = 3) buffer Counts { uint counts[]; };
+
+uniform vec4 uFrustum[6]; // world-space planes, inward unit normals
+
+void main()
+{
+	// objects past one row of work groups go on in further rows; the last row can run past the array
+	uint objectIndex = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+	if (objectIndex >= uint(objects.length()))
+		return;
+	CullObject object = objects[objectIndex];
+	for (uint i = gl_LocalInvocationID.x; i < object.itemCount; i += gl_WorkGroupSize.x)
+	{
+		CullItem item = items[object.itemFirst + i];
+
+		vec3 center = (object.cullModel * vec4(item.sphere.xyz, 1.0)).xyz;
+		float radius = item.sphere.w * object.cameraScale.w;
+		bool visible = true;
+		for (int p = 0; p < 6; ++p)
+			visible = visible && dot(uFrustum[p].xyz, center) + uFrustum[p].w >= -radius;
+
+		// the cone test runs in the items' own space, like UMeshletFacesAway
+		vec3 toCenter = item.sphere.xyz - object.cameraScale.xyz;
+		visible = visible && dot(toCenter, item.cone.xyz) < item.cone.w * length(toCenter) + item.sphere.w;
+
+		if (visible)
+		{
+			uint slot = atomicAdd(counts[object.batch], 1u);
+			commands[object.commandFirst + slot] = DrawCommand(item.indexCount, 1u, item.firstIndex, 0, objectIndex);
+		}
+	}
+}
+)glsl";
+
+// Appends a mesh's cull items: its meshlets (or all of LOD 0 when it has none), then one per coarser level.
+// sphere bounds the whole mesh in the same space as the meshlets. Returns the index of the first item.
+inline uint32_t UAppendCullItems(const std::vector<MeshLod>& lods, const std::vector<Meshlet>& meshlets, const glm::vec4& sphere, std::vector<GpuCullItem>& items)
+{
+	uint32_t first = (uint32_t)items.size();
+	for (const Meshlet& meshlet : meshlets)
+	{
+		GpuCullItem item = {};
+		item.Sphere = glm::vec4(meshlet.Center, meshlet.Radius);
+		item.Cone = glm::vec4(meshlet.ConeAxis, meshlet.ConeCutoff);
+		item.FirstIndex = meshlet.FirstIndex;
+		item.IndexCount = meshlet.IndexCount;
+		items.push_back(item);
+	}
+	for (size_t lod = meshlets.empty() ? 0 : 1; lod < lods.size(); ++lod)
+	{
+		GpuCullItem item = {};
+		item.Sphere = sphere;
+		item.Cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+		item.FirstIndex = lods[lod].FirstIndex;
+		item.IndexCount = lods[lod].IndexCount;
+		items.push_back(item);
+	}
+	return first;
+}
+
+// the items UAppendCullItems wrote for one level of detail, relative to the mesh's first item
+inline void UCullItemRange(size_t lod, size_t meshletCount, uint32_t& first, uint32_t& count)
+{
+	if (meshletCount == 0)
+	{
+		first = (uint32_t)lod;
+		count = 1;
+	}
+	else if (lod == 0)
+	{
+		first = 0;
+		count = (uint32_t)meshletCount;
+	}
+	else
+	{
+		first = (uint32_t)(meshletCount + lod - 1);
+		count = 1;
+	}
+}
+
+class GpuCuller
+{
+public:
+	const char* FailureReason = nullptr;
+
+	// Starts building the compute program without waiting for it, so it can compile alongside the scene
+	// shaders; with a shaderCache it comes from (and goes to) its binaries. Create() collects it.
+	void StartProgram(ShaderCache* shaderCache = nullptr)
+	{
+		destroyProgram();
+		const GLenum type = GL_COMPUTE_SHADER;
+		const char* source = gpuCullShaderSource;
+		programBuild.Add(&type, &source, 1);
+		programBuild.Start(shaderCache);
+	}
+
+	// batchCapacities[b] is the most commands batch b can produce in a frame: the sum, over the objects
+	// drawn with it, of their largest item count. maxObjects bounds the objects per Cull call. Waits for the
+	// program StartProgram() began, starting it first when nobody did.
+	bool Create(const std::vector<GpuCullItem>& items, const std::vector<GLuint>& batchCapacities, GLuint maxObjects, GLStateCache& state, ShaderCache* shaderCache = nullptr)
+	{
+		destroyBuffers(state);
+		if (programBuild.Size() == 0)
+			StartProgram(shaderCache);
+		programBuild.Wait();
+		program = programBuild[0].Program;
+		buildLog = programBuild[0].Log;
+		programBuild.Clear();
+		if (!program)
+			return fail(state, "the culling compute shader failed to build");
+		frustumLocation = glGetUniformLocation(program, "uFrustum");
+
+		batchFirst.clear();
+		batchCapacity = batchCapacities;
+		GLuint commandCount = 0;
+		for (GLuint capacity : batchCapacities)
+		{
+			batchFirst.push_back(commandCount);
+			commandCount += capacity;
+		}
+		drawCount = GLEW_ARB_indirect_parameters != 0;
+
+		std::vector<GLuint> objectIndices(maxObjects);
+		for (GLuint i = 0; i < maxObjects; ++i)
+			objectIndices[i] = i;
+
+		glGenBuffers(4, buffers);
+		state.BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[ITEMS]);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(items.size(), 1) * sizeof(GpuCullItem), items.empty() ? NULL : items.data(), 0);
+		state.BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[COMMANDS]);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, std::max<GLuint>(commandCount, 1) * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_STORAGE_BIT);
+		state.BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[COUNTS]);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(batchCapacities.size(), 1) * sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+		state.BindBuffer(GL_ARRAY_BUFFER, buffers[OBJECT_INDICES]);
+		glBufferStorage(GL_ARRAY_BUFFER, std::max<GLuint>(maxObjects, 1) * sizeof(GLuint), objectIndices.data(), 0);
+
+		GLint alignment = 16;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		objectAlignment = (size_t)alignment;
+		GLint groupsX = 65535;  // the least GL guarantees
+		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &groupsX);
+		maxGroupsX = (GLuint)std::max(groupsX, 1);
+		return true;
+	}
+
+	void Destroy(GLStateCache& state)
+	{
+		destroyProgram();
+		destroyBuffers(state);
+	}
+
+	bool IsReady() const
+	{
+		return program != 0;
+	}
+
+	// the compile and link errors when Create() failed to build the program
+	const std::string& BuildLog() const
+	{
+		return buildLog;
+	}
+
+	// true when draws take their count from the GPU; otherwise they walk the whole zeroed capacity
+	bool UsesDrawCount() const
+	{
+		return drawCount;
+	}
+
+	// the alignment the GpuCullObject array needs when it is bound at an offset
+	size_t ObjectAlignment() const
+	{
+		return objectAlignment;
+	}
+
+	GLuint BatchFirstCommand(size_t batch) const
+	{
+		return batchFirst[batch];
+	}
+
+	// Feeds the object index stream to GPU_CULL_OBJECT_ATTRIBUTE of a vertex array, one index per instance
+	void AttachToVertexArray(GLStateCache& state, GLuint vao) const
+	{
+		state.BindVertexArray(vao);
+		glBindVertexBuffer(GPU_CULL_OBJECT_BINDING, buffers[OBJECT_INDICES], 0, sizeof(GLuint));
+		glVertexBindingDivisor(GPU_CULL_OBJECT_BINDING, 1);
+		glVertexAttribIFormat(GPU_CULL_OBJECT_ATTRIBUTE, 1, GL_UNSIGNED_INT, 0);
+		glVertexAttribBinding(GPU_CULL_OBJECT_ATTRIBUTE, GPU_CULL_OBJECT_BINDING);
+		glEnableVertexAttribArray(GPU_CULL_OBJECT_ATTRIBUTE);
+	}
+
+	// Culls objectCount GpuCullObjects read from objectBuffer at objectOffset (a multiple of ObjectAlignment).
+	// The object array stays bound to GPU_CULL_OBJECTS_SSBO for the vertex shaders of the draws that follow.
+	void Cull(GLStateCache& state, GLuint objectBuffer, GLintptr objectOffset, GLuint objectCount, const Frustum& frustum)
+	{
+		const GLuint zero = 0;
+		state.BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[COUNTS]);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		if (!drawCount)
+		{
+			// the fixed-count draws read every slot, so the ones nothing was written to must draw nothing
+			state.BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[COMMANDS]);
+			glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		}
+		if (objectCount == 0)
+			return;
+
+		state.UseProgram(program);
+		glUniform4fv(frustumLocation, 6, &frustum.Planes[0].x);
+		state.BindBufferRange(GL_SHADER_STORAGE_BUFFER, GPU_CULL_OBJECTS_SSBO, objectBuffer, objectOffset, objectCount * sizeof(GpuCullObject));
+		state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers[ITEMS]);
+		state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers[COMMANDS]);
+		state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, buffers[COUNTS]);
+		GLuint rowGroups = std::min(objectCount, maxGroupsX);
+		glDispatchCompute(rowGroups, (objectCount + rowGroups - 1) / rowGroups, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// Draws what Cull kept of one batch; the batch's vertex array has to be bound
+	void Draw(GLStateCache& state, size_t batch, GLenum indexType) const
+	{
+		const void* first = (const void*)(batchFirst[batch] * sizeof(DrawElementsIndirectCommand));
+		state.BindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers[COMMANDS]);
+		if (drawCount)
+		{
+			state.BindBuffer(GL_PARAMETER_BUFFER_ARB, buffers[COUNTS]);
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, indexType, first, (GLintptr)(batch * sizeof(GLuint)), (GLsizei)batchCapacity[batch], 0);
+		}
+		else
+			glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, first, (GLsizei)batchCapacity[batch], 0);
+	}
+
+	// The commands Cull wrote, read back for debugging and tests; stalls until the GPU is done
+	std::vector<DrawElementsIndirectCommand> ReadCommands(GLStateCache& state, size_t batch) const
+	{
+		GLuint count = batchCapacity[batch];
+		state.BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[COUNTS]);
+		if (drawCount)
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, batch * sizeof(GLuint), sizeof(GLuint), &count);
+		std::vector<DrawElementsIndirectCommand> commands(count);
+		state.BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[COMMANDS]);
+		if (count > 0)
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, batchFirst[batch] * sizeof(DrawElementsIndirectCommand), count * sizeof(DrawElementsIndirectCommand), commands.data());
+		return commands;
+	}
+
+private:
+	enum Buffer_Role { ITEMS, COMMANDS, COUNTS, OBJECT_INDICES };
+
+	ShaderBatch programBuild;   // the compute program while it builds
+	std::string buildLog;
+	GLuint program = 0;
+	GLuint buffers[4] = { 0, 0, 0, 0 };
+	GLint frustumLocation = -1;
+	std::vector<GLuint> batchFirst, batchCapacity;
+	size_t objectAlignment = 16;
+	GLuint maxGroupsX = 65535;  // work groups in one row of a dispatch
+	bool drawCount = false;
+
+	// the program, or its build while it is still running
+	void destroyProgram()
+	{
+		if (programBuild.Size() != 0)
+		{
+			programBuild.Wait();
+			if (programBuild[0].Program)
+				glDeleteProgram(programBuild[0].Program);
+			programBuild.Clear();
+		}
+		if (program)
+			glDeleteProgram(program);
+		program = 0;
+	}
+
+	void destroyBuffers(GLStateCache& state)
+	{
+		if (buffers[0])
+			state.DeleteBuffers(4, buffers);
+		buffers[0] = buffers[1] = buffers[2] = buffers[3] = 0;
+	}
+
+	bool fail(GLStateCache& state, const char* reason)
+	{
+		Destroy(state);
+		FailureReason = reason;
+		return false;
+	}
+};
+
+#endif
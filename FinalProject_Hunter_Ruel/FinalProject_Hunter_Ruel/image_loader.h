@@ -0,0 +1,177 @@
+#ifndef IMAGE_LOADER_H
+#define IMAGE_LOADER_H
+
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "stb_image.h"
+#include "thread_pool.h"
+
+// Decode settings that stb_image otherwise keeps in process-wide globals. Each request carries its own copy
+// and the worker applies it through the thread-local stbi_*_thread setters right before decoding.
+struct ImageDecodeOptions
+{
+	bool FlipVertically = false;
+	int DesiredChannels = 0; // 0 keeps the channel count of the file
+	float LdrToHdrGamma = 2.2f;
+	float LdrToHdrScale = 1.0f;
+	float HdrToLdrGamma = 2.2f;
+	float HdrToLdrScale = 1.0f;
+	bool MemoryMap = true;   // decode files straight from a mapping instead of stb_image's stdio reads
+	bool PlanarYCbCr = false; // YCbCr JPEGs come back as Y, Cb and Cr planes, color conversion is left to the shader
+};
+
+// One image to decode, either a file on disk or an encoded blob already in memory.
+// A memory blob has to stay alive until UDecodeImages returns.
+struct ImageRequest
+{
+	std::string Filename;
+	const unsigned char* Buffer = nullptr;
+	size_t BufferLength = 0;
+	ImageDecodeOptions Options;
+
+	static ImageRequest FromFile(const std::string& filename, const ImageDecodeOptions& options = ImageDecodeOptions())
+	{
+		ImageRequest request;
+		request.Filename = filename;
+		request.Options = options;
+		return request;
+	}
+
+	static ImageRequest FromMemory(const unsigned char* buffer, size_t length, const ImageDecodeOptions& options = ImageDecodeOptions())
+	{
+		ImageRequest request;
+		request.Buffer = buffer;
+		request.BufferLength = length;
+		request.Options = options;
+		return request;
+	}
+};
+
+// One channel of a planar image at its own resolution
+struct ImagePlane
+{
+	const unsigned char* Pixels = nullptr; // tightly packed rows, pointing into DecodedImage::Pixels
+	int Width = 0;
+	int Height = 0;
+	int SubsampleX = 1; // image pixels covered by one sample in each direction
+	int SubsampleY = 1;
+};
+
+// Result handed to the completion callback. Pixels is freed after the callback returns unless the callback
+// takes ownership by setting it to nullptr (and later releasing it with stbi_image_free).
+struct DecodedImage
+{
+	size_t RequestIndex = 0;
+	unsigned char* Pixels = nullptr;
+	int Width = 0;
+	int Height = 0;
+	int Channels = 0;                     // channels in Pixels (DesiredChannels when it was set)
+	const char* FailureReason = nullptr;  // stbi_failure_reason() of the decoding thread, nullptr on success
+	int PlaneCount = 0;                   // 3 when PlanarYCbCr applied: Pixels then holds the Y, Cb, Cr planes back to back
+	ImagePlane Planes[3];
+};
+
+// decodes a single request on the calling thread, using only per-call state
+inline DecodedImage UDecodeImage(const ImageRequest& request, size_t requestIndex = 0)
+{
+	const ImageDecodeOptions& options = request.Options;
+	stbi_set_flip_vertically_on_load_thread(options.FlipVertically ? 1 : 0);
+	stbi_ldr_to_hdr_gamma_thread(options.LdrToHdrGamma);
+	stbi_ldr_to_hdr_scale_thread(options.LdrToHdrScale);
+	stbi_hdr_to_ldr_gamma_thread(options.HdrToLdrGamma);
+	stbi_hdr_to_ldr_scale_thread(options.HdrToLdrScale);
+
+	DecodedImage image;
+	image.RequestIndex = requestIndex;
+
+	int channelsInFile = 0;
+	MappedFile file;
+	const unsigned char* encoded = request.Buffer;
+	int encodedLength = (int)request.BufferLength;
+	if (!encoded && options.MemoryMap && file.Open(request.Filename.c_str()) && file.Size() <= INT_MAX)
+	{
+		encoded = file.Data();
+		encodedLength = (int)file.Size();
+	}
+
+	// planes only come out of an in-memory decode; streamed files and non-YCbCr images fall through to RGB
+	if (encoded && options.PlanarYCbCr && (options.DesiredChannels == 0 || options.DesiredChannels == 3))
+	{
+		int width[3], height[3], subsampleX[3], subsampleY[3];
+		image.Pixels = stbi_load_jpeg_ycbcr_from_memory(encoded, encodedLength, &image.Width, &image.Height, width, height, subsampleX, subsampleY);
+		if (image.Pixels)
+		{
+			const unsigned char* plane = image.Pixels;
+			for (int i = 0; i < 3; ++i)
+			{
+				image.Planes[i].Pixels = plane;
+				image.Planes[i].Width = width[i];
+				image.Planes[i].Height = height[i];
+				image.Planes[i].SubsampleX = subsampleX[i];
+				image.Planes[i].SubsampleY = subsampleY[i];
+				plane += (size_t)width[i] * height[i];
+			}
+			image.PlaneCount = 3;
+			image.Channels = 3;
+			return image;
+		}
+	}
+
+	if (encoded)
+		image.Pixels = stbi_load_from_memory(encoded, encodedLength, &image.Width, &image.Height, &channelsInFile, options.DesiredChannels);
+	else // pipes, devices and anything else that can't be mapped stream through stdio
+		image.Pixels = stbi_load(request.Filename.c_str(), &image.Width, &image.Height, &channelsInFile, options.DesiredChannels);
+
+	if (image.Pixels)
+		image.Channels = options.DesiredChannels ? options.DesiredChannels : channelsInFile;
+	else
+		image.FailureReason = stbi_failure_reason();
+
+	return image;
+}
+
+// Decodes every request on the pool and calls onDecoded once per request, in completion order.
+// The callback always runs on the calling thread, so it can upload straight to OpenGL.
+inline void UDecodeImages(const std::vector<ImageRequest>& requests, const std::function<void(DecodedImage&)>& onDecoded, ThreadPool& pool = GetSharedThreadPool())
+{
+	std::mutex completedMutex;
+	std::condition_variable completedCondition;
+	std::deque<DecodedImage> completed;
+
+	for (size_t i = 0; i < requests.size(); ++i)
+	{
+		pool.Submit([&, i]
+		{
+			DecodedImage image = UDecodeImage(requests[i], i);
+			// notify under the lock: the caller may return (destroying these locals) as soon as it is released
+			std::lock_guard<std::mutex> lock(completedMutex);
+			completed.push_back(image);
+			completedCondition.notify_one();
+		});
+	}
+
+	for (size_t delivered = 0; delivered < requests.size(); ++delivered)
+	{
+		DecodedImage image;
+		{
+			std::unique_lock<std::mutex> lock(completedMutex);
+			completedCondition.wait(lock, [&] { return !completed.empty(); });
+			image = completed.front();
+			completed.pop_front();
+		}
+
+		onDecoded(image);
+		if (image.Pixels)
+			stbi_image_free(image.Pixels);
+	}
+}
+
+#endif
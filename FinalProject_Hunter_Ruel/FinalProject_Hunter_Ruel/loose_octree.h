@@ -0,0 +1,348 @@
+#ifndef LOOSE_OCTREE_H
+#define LOOSE_OCTREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+#include "thread_pool.h"
+
+// Loose octree for objects that move. Every node's cell is doubled in size to get its loose bounds, and an
+// object lives in the node whose cell holds its center at the depth where its size fits those bounds. Because
+// the bounds overlap, a moving object only has to be relinked once it leaves its node's loose bounds; until
+// then a move is just a box update, so the cost of a frame's updates follows the objects that moved, not the
+// size of the scene. The root also holds whatever lies outside the octree's cell, so nothing is ever lost.
+
+#define LOOSE_OCTREE_MAX_DEPTH 6
+#define LOOSE_OCTREE_BATCH_CHUNK 256  // moves one job checks in MoveBatch()
+#define LOOSE_OCTREE_NONE 0xFFFFFFFFu
+
+// how a box relates to a query volume
+enum Octree_Overlap
+{
+	OCTREE_OUTSIDE,
+	OCTREE_PARTLY,
+	OCTREE_INSIDE
+};
+
+struct OctreeMove
+{
+	uint32_t Id;
+	glm::vec3 Lower;
+	glm::vec3 Upper;
+};
+
+struct LooseOctreeStats
+{
+	uint64_t Moves = 0;    // object box updates
+	uint64_t Relinks = 0;  // of those, the ones that had to change node
+	size_t Nodes = 0;      // nodes in use
+};
+
+class LooseOctree
+{
+public:
+	// The octree's cell is center +- halfSize; maxDepth is capped at LOOSE_OCTREE_MAX_DEPTH
+	void Create(const glm::vec3& center, float halfSize, int maxDepth = LOOSE_OCTREE_MAX_DEPTH)
+	{
+		nodes.assign(1, Node());
+		nodes[0].Center = center;
+		nodes[0].HalfSize = halfSize;
+		freeNodes.clear();
+		objects.clear();
+		depthLimit = std::min(std::max(maxDepth, 0), LOOSE_OCTREE_MAX_DEPTH);
+		stats = LooseOctreeStats();
+		stats.Nodes = 1;
+	}
+
+	// Adds object id (any index; the table grows to fit) with its box
+	void Insert(uint32_t id, const glm::vec3& lower, const glm::vec3& upper)
+	{
+		if (id >= objects.size())
+			objects.resize(id + 1);
+		if (objects[id].Node != LOOSE_OCTREE_NONE)
+			unlink(id);
+		link(id, lower, upper);
+	}
+
+	void Remove(uint32_t id)
+	{
+		if (id < objects.size() && objects[id].Node != LOOSE_OCTREE_NONE)
+			unlink(id);
+	}
+
+	// Updates one inserted object's box; returns true when it had to move to another node
+	bool Move(uint32_t id, const glm::vec3& lower, const glm::vec3& upper)
+	{
+		Object& object = objects[id];
+		++stats.Moves;
+		if (staysPut(object.Node, lower, upper))
+		{
+			Item& item = nodes[object.Node].Items[object.Slot];
+			item.Lower = lower;
+			item.Upper = upper;
+			return false;
+		}
+		unlink(id);
+		link(id, lower, upper);
+		++stats.Relinks;
+		return true;
+	}
+
+	// Updates many boxes at once. The boxes are written and checked against their nodes in parallel; only the
+	// objects that left their node's loose bounds are then relinked, on the calling thread. An id may appear at
+	// most once per batch.
+	void MoveBatch(const OctreeMove* moves, size_t count)
+	{
+		size_t chunks = (count + LOOSE_OCTREE_BATCH_CHUNK - 1) / LOOSE_OCTREE_BATCH_CHUNK;
+		std::vector<std::vector<const OctreeMove*>> relink(chunks);
+		GetSharedThreadPool().ParallelFor(chunks, [&](size_t chunk)
+		{
+			size_t end = std::min(count, (chunk + 1) * LOOSE_OCTREE_BATCH_CHUNK);
+			for (size_t i = chunk * LOOSE_OCTREE_BATCH_CHUNK; i < end; ++i)
+			{
+				const Object& object = objects[moves[i].Id];
+				if (staysPut(object.Node, moves[i].Lower, moves[i].Upper))
+				{
+					Item& item = nodes[object.Node].Items[object.Slot];
+					item.Lower = moves[i].Lower;
+					item.Upper = moves[i].Upper;
+				}
+				else
+					relink[chunk].push_back(&moves[i]);
+			}
+		});
+		stats.Moves += count;
+		for (const std::vector<const OctreeMove*>& pending : relink)
+			for (const OctreeMove* move : pending)
+			{
+				unlink(move->Id);
+				link(move->Id, move->Lower, move->Upper);
+				++stats.Relinks;
+			}
+	}
+
+	// visit(id) for every object whose box is at least partly inside the frustum
+	template <typename Visit>
+	void QueryFrustum(const Frustum& frustum, Visit&& visit) const
+	{
+		traverse([&](const glm::vec3& lower, const glm::vec3& upper) -> int
+		{
+			int overlap = OCTREE_INSIDE;
+			for (const glm::vec4& plane : frustum.Planes)
+			{
+				glm::vec3 nearest(plane.x >= 0.0f ? lower.x : upper.x, plane.y >= 0.0f ? lower.y : upper.y, plane.z >= 0.0f ? lower.z : upper.z);
+				glm::vec3 furthest(plane.x >= 0.0f ? upper.x : lower.x, plane.y >= 0.0f ? upper.y : lower.y, plane.z >= 0.0f ? upper.z : lower.z);
+				if (glm::dot(glm::vec3(plane), furthest) + plane.w < 0.0f)
+					return OCTREE_OUTSIDE;
+				if (glm::dot(glm::vec3(plane), nearest) + plane.w < 0.0f)
+					overlap = OCTREE_PARTLY;
+			}
+			return overlap;
+		}, visit);
+	}
+
+	// visit(id) for every object whose box overlaps [lower, upper]
+	template <typename Visit>
+	void QueryBox(const glm::vec3& lower, const glm::vec3& upper, Visit&& visit) const
+	{
+		traverse([&](const glm::vec3& boxLower, const glm::vec3& boxUpper) -> int
+		{
+			if (boxLower.x > upper.x || lower.x > boxUpper.x || boxLower.y > upper.y || lower.y > boxUpper.y || boxLower.z > upper.z || lower.z > boxUpper.z)
+				return OCTREE_OUTSIDE;
+			bool inside = boxLower.x >= lower.x && boxUpper.x <= upper.x && boxLower.y >= lower.y && boxUpper.y <= upper.y && boxLower.z >= lower.z && boxUpper.z <= upper.z;
+			return inside ? OCTREE_INSIDE : OCTREE_PARTLY;
+		}, visit);
+	}
+
+	// visit(id) for every object whose box is within radius of center
+	template <typename Visit>
+	void QuerySphere(const glm::vec3& center, float radius, Visit&& visit) const
+	{
+		traverse([&](const glm::vec3& lower, const glm::vec3& upper) -> int
+		{
+			glm::vec3 outside = glm::max(glm::max(lower - center, center - upper), glm::vec3(0.0f));
+			if (glm::dot(outside, outside) > radius * radius)
+				return OCTREE_OUTSIDE;
+			glm::vec3 corner = glm::max(glm::abs(lower - center), glm::abs(upper - center));
+			return glm::dot(corner, corner) <= radius * radius ? OCTREE_INSIDE : OCTREE_PARTLY;
+		}, visit);
+	}
+
+	const LooseOctreeStats& Stats() const
+	{
+		return stats;
+	}
+
+private:
+	// the boxes live in the nodes so queries read them in order
+	struct Item
+	{
+		glm::vec3 Lower, Upper;
+		uint32_t Id;
+	};
+
+	struct Node
+	{
+		glm::vec3 Center = glm::vec3(0.0f);
+		float HalfSize = 0.0f;            // of the cell; the loose bounds are twice that
+		uint32_t Parent = LOOSE_OCTREE_NONE;
+		uint32_t Children[8] = { LOOSE_OCTREE_NONE, LOOSE_OCTREE_NONE, LOOSE_OCTREE_NONE, LOOSE_OCTREE_NONE,
+			LOOSE_OCTREE_NONE, LOOSE_OCTREE_NONE, LOOSE_OCTREE_NONE, LOOSE_OCTREE_NONE };
+		uint32_t ChildCount = 0;
+		std::vector<Item> Items;
+	};
+
+	struct Object
+	{
+		uint32_t Node = LOOSE_OCTREE_NONE;
+		uint32_t Slot = 0;  // index in the node's Items
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> freeNodes;
+	std::vector<Object> objects;
+	int depthLimit = LOOSE_OCTREE_MAX_DEPTH;
+	LooseOctreeStats stats;
+
+	// still inside its node's loose bounds (the root takes anything)
+	bool staysPut(uint32_t index, const glm::vec3& lower, const glm::vec3& upper) const
+	{
+		if (index == 0)
+			return fitsRoot(lower, upper) == false || depthFor(lower, upper) == 0;
+		const Node& node = nodes[index];
+		glm::vec3 looseLower = node.Center - glm::vec3(node.HalfSize * 2.0f), looseUpper = node.Center + glm::vec3(node.HalfSize * 2.0f);
+		return lower.x >= looseLower.x && lower.y >= looseLower.y && lower.z >= looseLower.z &&
+			upper.x <= looseUpper.x && upper.y <= looseUpper.y && upper.z <= looseUpper.z;
+	}
+
+	bool fitsRoot(const glm::vec3& lower, const glm::vec3& upper) const
+	{
+		glm::vec3 center = (lower + upper) * 0.5f, offset = glm::abs(center - nodes[0].Center);
+		return offset.x <= nodes[0].HalfSize && offset.y <= nodes[0].HalfSize && offset.z <= nodes[0].HalfSize;
+	}
+
+	// the deepest level whose loose bounds hold the object from anywhere in the cell: half size at least the
+	// object's largest half extent
+	int depthFor(const glm::vec3& lower, const glm::vec3& upper) const
+	{
+		glm::vec3 half = (upper - lower) * 0.5f;
+		float extent = std::max(half.x, std::max(half.y, half.z));
+		if (extent <= 0.0f)
+			return depthLimit;
+		int depth = (int)std::floor(std::log2(nodes[0].HalfSize / extent));
+		return std::min(std::max(depth, 0), depthLimit);
+	}
+
+	void link(uint32_t id, const glm::vec3& lower, const glm::vec3& upper)
+	{
+		uint32_t index = 0;
+		if (fitsRoot(lower, upper))
+		{
+			glm::vec3 center = (lower + upper) * 0.5f;
+			for (int depth = depthFor(lower, upper); depth > 0; --depth)
+			{
+				int octant = (center.x >= nodes[index].Center.x ? 1 : 0) | (center.y >= nodes[index].Center.y ? 2 : 0) | (center.z >= nodes[index].Center.z ? 4 : 0);
+				if (nodes[index].Children[octant] == LOOSE_OCTREE_NONE)
+				{
+					uint32_t child = allocateNode();
+					Node& parent = nodes[index];
+					float half = parent.HalfSize * 0.5f;
+					nodes[child].Center = parent.Center + glm::vec3(octant & 1 ? half : -half, octant & 2 ? half : -half, octant & 4 ? half : -half);
+					nodes[child].HalfSize = half;
+					nodes[child].Parent = index;
+					parent.Children[octant] = child;
+					++parent.ChildCount;
+				}
+				index = nodes[index].Children[octant];
+			}
+		}
+		Object& object = objects[id];
+		object.Node = index;
+		object.Slot = (uint32_t)nodes[index].Items.size();
+		nodes[index].Items.push_back({ lower, upper, id });
+	}
+
+	// takes the object out of its node, then frees the nodes left with neither objects nor children
+	void unlink(uint32_t id)
+	{
+		Object& object = objects[id];
+		uint32_t index = object.Node;
+		std::vector<Item>& items = nodes[index].Items;
+		items[object.Slot] = items.back();
+		objects[items.back().Id].Slot = object.Slot;
+		items.pop_back();
+		object.Node = LOOSE_OCTREE_NONE;
+
+		while (index != 0 && nodes[index].Items.empty() && nodes[index].ChildCount == 0)
+		{
+			uint32_t parent = nodes[index].Parent;
+			for (uint32_t& child : nodes[parent].Children)
+				if (child == index)
+					child = LOOSE_OCTREE_NONE;
+			--nodes[parent].ChildCount;
+			nodes[index] = Node();
+			freeNodes.push_back(index);
+			--stats.Nodes;
+			index = parent;
+		}
+	}
+
+	uint32_t allocateNode()
+	{
+		++stats.Nodes;
+		if (!freeNodes.empty())
+		{
+			uint32_t index = freeNodes.back();
+			freeNodes.pop_back();
+			return index;
+		}
+		nodes.push_back(Node());
+		return (uint32_t)nodes.size() - 1;
+	}
+
+	// depth-first over the nodes whose loose bounds overlap the query; the root is always entered since it also
+	// holds the objects outside the octree. Below a node that is wholly inside, nothing is tested any more.
+	template <typename Overlap, typename Visit>
+	void traverse(Overlap&& overlap, Visit& visit) const
+	{
+		if (nodes.empty())
+			return;
+		struct Entry
+		{
+			uint32_t Node;
+			bool Inside;
+		};
+		Entry stack[LOOSE_OCTREE_MAX_DEPTH * 7 + 8];
+		int size = 0;
+		stack[size++] = { 0, false };
+		while (size > 0)
+		{
+			Entry entry = stack[--size];
+			const Node& node = nodes[entry.Node];
+			for (const Item& item : node.Items)
+				if (entry.Inside || overlap(item.Lower, item.Upper) != OCTREE_OUTSIDE)
+					visit(item.Id);
+			for (uint32_t child : node.Children)
+			{
+				if (child == LOOSE_OCTREE_NONE)
+					continue;
+				if (entry.Inside)
+				{
+					stack[size++] = { child, true };
+					continue;
+				}
+				glm::vec3 loose(nodes[child].HalfSize * 2.0f);
+				int childOverlap = overlap(nodes[child].Center - loose, nodes[child].Center + loose);
+				if (childOverlap != OCTREE_OUTSIDE)
+					stack[size++] = { child, childOverlap == OCTREE_INSIDE };
+			}
+		}
+	}
+};
+
+#endif
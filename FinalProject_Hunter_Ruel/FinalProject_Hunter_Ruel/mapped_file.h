@@ -0,0 +1,195 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// How the mapped bytes are going to be read; passed on to the OS as a paging hint
+enum MappedFile_Access {
+	ACCESS_SEQUENTIAL, // one front-to-back pass (decoders, parsers): aggressive read-ahead, pages dropped behind
+	ACCESS_RANDOM      // scattered reads (caches indexed by offset): no read-ahead
+};
+
+// A read-only view of a whole file through the virtual memory system. Reading it costs page faults
+// instead of read() calls and there is no copy into a user-space buffer. Open() fails for anything
+// that can't be mapped (missing or empty files, pipes, devices); callers fall back to streaming.
+class MappedFile
+{
+public:
+	MappedFile() {}
+
+	explicit MappedFile(const char* path, MappedFile_Access access = ACCESS_SEQUENTIAL)
+	{
+		Open(path, access);
+	}
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept
+	{
+		*this = static_cast<MappedFile&&>(other);
+	}
+
+	MappedFile& operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Close();
+			data = other.data;
+			size = other.size;
+#ifdef _WIN32
+			mapping = other.mapping;
+			other.mapping = NULL;
+#endif
+			other.data = nullptr;
+			other.size = 0;
+		}
+		return *this;
+	}
+
+	bool Open(const char* path, MappedFile_Access access = ACCESS_SEQUENTIAL)
+	{
+		Close();
+#ifdef _WIN32
+		DWORD flags = access == ACCESS_SEQUENTIAL ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file); // the mapping keeps the file open
+		if (!mapping)
+			return false;
+
+		data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!data)
+		{
+			CloseHandle(mapping);
+			mapping = NULL;
+			return false;
+		}
+		size = (size_t)fileSize.QuadPart;
+#else
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // the mapping keeps the file open
+		if (view == MAP_FAILED)
+			return false;
+
+		madvise(view, (size_t)info.st_size, access == ACCESS_SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+		if (access == ACCESS_SEQUENTIAL)
+			madvise(view, (size_t)info.st_size, MADV_WILLNEED);
+
+		data = (const unsigned char*)view;
+		size = (size_t)info.st_size;
+#endif
+		return true;
+	}
+
+	void Close()
+	{
+		if (!data)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		mapping = NULL;
+#else
+		munmap((void*)data, size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	bool IsOpen() const
+	{
+		return data != nullptr;
+	}
+
+	const unsigned char* Data() const
+	{
+		return data;
+	}
+
+	size_t Size() const
+	{
+		return size;
+	}
+
+private:
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE mapping = NULL;
+#endif
+};
+
+// Size and modification time of a file, zero when it doesn't exist. The time is as fine as the file system
+// keeps it (nanoseconds on POSIX, 100 ns ticks on Windows) rather than whole seconds, so saving a file twice
+// within a second still changes it; it is only meant to be compared with an earlier stamp.
+inline void UFileStamp(const std::string& filename, uint64_t& size, int64_t& time)
+{
+	size = 0;
+	time = 0;
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &info))
+		return;
+	size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	time = (int64_t)(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime);
+#else
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+		return;
+	size = (uint64_t)info.st_size;
+#ifdef __APPLE__
+	time = (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+	time = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+#endif
+}
+
+#endif
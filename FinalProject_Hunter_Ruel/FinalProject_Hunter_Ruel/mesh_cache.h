@@ -0,0 +1,219 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "mapped_file.h"
+#include "vertex_format.h"
+
+// Binary mesh cache. A cache file is a PackedMesh exactly as the GPU wants it: a header, then the vertex
+// stream, the index stream and the meshlet table, each starting on a page boundary. Loading maps the file and hands the streams
+// straight to glBufferStorage, so a warm load costs the page-ins and the driver's copy, with no parsing.
+// Files are little-endian and only read back on the machine architecture that wrote them.
+
+#define MESH_CACHE_MAGIC 0x4853454Du   // "MESH"
+#define MESH_CACHE_VERSION 4u       // 2: triangle and vertex order optimized, 3: LOD chain, 4: meshlets
+#define MESH_CACHE_ALIGNMENT 4096u
+#define MESH_CACHE_MAX_ATTRIBUTES 8
+#define MESH_CACHE_MAX_LODS 8
+
+struct MeshCacheHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint64_t SourceSize;               // size and modification time of the file the mesh was imported from
+	int64_t SourceTime;
+	uint32_t VertexCount;
+	uint32_t IndexCount;
+	uint32_t Stride;
+	uint32_t IndexType;
+	uint32_t AttributeCount;
+	uint32_t MeshletCount;
+	float DequantizeScale[3];
+	float DequantizeOffset[3];
+	uint64_t VertexOffset;             // byte offsets from the start of the file, multiples of MESH_CACHE_ALIGNMENT
+	uint64_t VertexBytes;
+	uint64_t IndexOffset;
+	uint64_t IndexBytes;
+	uint64_t MeshletOffset;
+	uint64_t MeshletBytes;
+	VertexAttribute Attributes[MESH_CACHE_MAX_ATTRIBUTES];
+	uint32_t LodCount;
+	MeshLod Lods[MESH_CACHE_MAX_LODS];  // index ranges into the index stream, LOD 0 first
+};
+
+// A cache file mapped for reading. The stream pointers are only valid while the view is open.
+class MeshCacheView
+{
+public:
+	// fails for missing, truncated or foreign files; callers then re-import and rewrite the cache
+	bool Open(const std::string& filename)
+	{
+		Close();
+		if (!file.Open(filename.c_str()) || file.Size() < sizeof(MeshCacheHeader))
+			return fail();
+
+		memcpy(&header, file.Data(), sizeof(header));
+		uint64_t size = file.Size();
+		if (header.Magic != MESH_CACHE_MAGIC || header.Version != MESH_CACHE_VERSION ||
+			header.AttributeCount > MESH_CACHE_MAX_ATTRIBUTES || header.Stride == 0 ||
+			(header.IndexType != GL_UNSIGNED_SHORT && header.IndexType != GL_UNSIGNED_INT) ||
+			header.VertexOffset > size || header.VertexBytes > size - header.VertexOffset ||
+			header.IndexOffset > size || header.IndexBytes > size - header.IndexOffset ||
+			header.MeshletOffset > size || header.MeshletBytes > size - header.MeshletOffset ||
+			header.MeshletBytes != (uint64_t)header.MeshletCount * sizeof(Meshlet) ||
+			header.VertexBytes != (uint64_t)header.VertexCount * header.Stride ||
+			header.IndexBytes != (uint64_t)header.IndexCount * (header.IndexType == GL_UNSIGNED_INT ? 4 : 2) ||
+			header.LodCount == 0 || header.LodCount > MESH_CACHE_MAX_LODS)
+			return fail();
+		for (uint32_t i = 0; i < header.LodCount; ++i)
+			if (header.Lods[i].FirstIndex > header.IndexCount || header.Lods[i].IndexCount > header.IndexCount - header.Lods[i].FirstIndex)
+				return fail();
+		for (uint32_t i = 0; i < header.MeshletCount; ++i)
+			if (Meshlets()[i].FirstIndex > header.IndexCount || Meshlets()[i].IndexCount > header.IndexCount - Meshlets()[i].FirstIndex)
+				return fail();
+		return true;
+	}
+
+	void Close()
+	{
+		file.Close();
+	}
+
+	bool IsOpen() const
+	{
+		return file.IsOpen();
+	}
+
+	const MeshCacheHeader& Header() const
+	{
+		return header;
+	}
+
+	const unsigned char* Vertices() const
+	{
+		return file.Data() + header.VertexOffset;
+	}
+
+	const unsigned char* Indices() const
+	{
+		return file.Data() + header.IndexOffset;
+	}
+
+	const Meshlet* Meshlets() const
+	{
+		return (const Meshlet*)(file.Data() + header.MeshletOffset);
+	}
+
+	glm::mat4 Dequantize() const
+	{
+		glm::vec3 scale(header.DequantizeScale[0], header.DequantizeScale[1], header.DequantizeScale[2]);
+		glm::vec3 offset(header.DequantizeOffset[0], header.DequantizeOffset[1], header.DequantizeOffset[2]);
+		return glm::scale(glm::translate(glm::mat4(1.0f), offset), scale);
+	}
+
+	// true when the vertices are packed with exactly these attributes, e.g. a VertexLayout's Table()
+	bool HasAttributes(const VertexAttribute* attributes, size_t count) const
+	{
+		if (count != header.AttributeCount)
+			return false;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const VertexAttribute& a = header.Attributes[i];
+			const VertexAttribute& b = attributes[i];
+			if (a.Location != b.Location || a.Components != b.Components || a.Type != b.Type || a.Normalized != b.Normalized || a.Offset != b.Offset)
+				return false;
+		}
+		return true;
+	}
+
+private:
+	MappedFile file;
+	MeshCacheHeader header = {};
+
+	bool fail()
+	{
+		file.Close();
+		return false;
+	}
+};
+
+// true when the cache header was written from the current version of the source file
+inline bool UMeshCacheIsFresh(const MeshCacheView& cache, const std::string& sourceFilename)
+{
+	uint64_t size;
+	int64_t time;
+	UFileStamp(sourceFilename, size, time);
+	return cache.Header().SourceSize == size && cache.Header().SourceTime == time;
+}
+
+// Writes a packed mesh as a cache file stamped with its source file. The data goes to a temporary file that
+// is renamed over the cache, so a crash mid-write never leaves a truncated cache behind.
+inline bool UWriteMeshCache(const std::string& filename, const PackedMesh& packed, const std::string& sourceFilename)
+{
+	if (packed.Attributes.size() > MESH_CACHE_MAX_ATTRIBUTES || packed.Lods.empty() || packed.Lods.size() > MESH_CACHE_MAX_LODS)
+		return false;
+
+	MeshCacheHeader header = {};
+	header.Magic = MESH_CACHE_MAGIC;
+	header.Version = MESH_CACHE_VERSION;
+	UFileStamp(sourceFilename, header.SourceSize, header.SourceTime);
+	header.VertexCount = packed.VertexCount;
+	header.IndexCount = packed.IndexCount;
+	header.Stride = (uint32_t)packed.Stride;
+	header.IndexType = packed.IndexType;
+	header.AttributeCount = (uint32_t)packed.Attributes.size();
+	header.MeshletCount = (uint32_t)packed.Meshlets.size();
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		header.DequantizeScale[axis] = packed.DequantizeScale[axis];
+		header.DequantizeOffset[axis] = packed.DequantizeOffset[axis];
+	}
+	auto align = [](uint64_t offset) { return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(uint64_t)(MESH_CACHE_ALIGNMENT - 1); };
+	header.VertexOffset = align(sizeof(header));
+	header.VertexBytes = packed.Vertices.size();
+	header.IndexOffset = align(header.VertexOffset + header.VertexBytes);
+	header.IndexBytes = packed.Indices.size();
+	header.MeshletOffset = align(header.IndexOffset + header.IndexBytes);
+	header.MeshletBytes = packed.Meshlets.size() * sizeof(Meshlet);
+	for (size_t i = 0; i < packed.Attributes.size(); ++i)
+		header.Attributes[i] = packed.Attributes[i];
+	header.LodCount = (uint32_t)packed.Lods.size();
+	for (size_t i = 0; i < packed.Lods.size(); ++i)
+		header.Lods[i] = packed.Lods[i];
+
+	std::string temporary = filename + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if (!file)
+		return false;
+
+	static const unsigned char padding[MESH_CACHE_ALIGNMENT] = {};
+	uint64_t written = 0;
+	auto write = [&](const void* data, uint64_t bytes)
+	{
+		written += bytes;
+		return bytes == 0 || fwrite(data, 1, (size_t)bytes, file) == bytes;
+	};
+	bool ok = write(&header, sizeof(header)) &&
+		write(padding, header.VertexOffset - written) &&
+		write(packed.Vertices.data(), header.VertexBytes) &&
+		write(padding, header.IndexOffset - written) &&
+		write(packed.Indices.data(), header.IndexBytes) &&
+		write(padding, header.MeshletOffset - written) &&
+		write(packed.Meshlets.data(), header.MeshletBytes);
+	ok = fclose(file) == 0 && ok;
+
+	if (ok)
+	{
+		remove(filename.c_str()); // rename() won't replace an existing file on Windows
+		ok = rename(temporary.c_str(), filename.c_str()) == 0;
+	}
+	if (!ok)
+		remove(temporary.c_str());
+	return ok;
+}
+
+#endif
@@ -0,0 +1,1018 @@
+#ifndef MESH_IMPORTER_H
+#define MESH_IMPORTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "vertex_format.h"
+
+// Imports Wavefront OBJ and binary glTF 2.0 (.glb) files into a MeshData. The file is read through a memory
+// mapping; OBJ text is split into chunks at line boundaries and parsed on the thread pool. Identical vertices
+// are merged through a hash table, and UPackMesh picks 16- or 32-bit indices from the resulting vertex count.
+
+struct MeshImportOptions
+{
+	bool Deduplicate = true;           // merge vertices whose attributes are all identical
+	size_t ChunkSize = 1 << 20;        // bytes of OBJ text per parse task
+};
+
+// Result of an import. FailureReason is a static string, nullptr on success.
+struct ImportedMesh
+{
+	MeshData Mesh;
+	const char* FailureReason = nullptr;
+	size_t SourceVertices = 0;         // vertices before deduplication (OBJ face corners, glTF accessor elements)
+};
+
+// Number parsing. Digit runs are converted eight at a time with SWAR arithmetic on a 64-bit load; anything
+// that can't be rounded exactly from a 64-bit mantissa and a small power of ten goes through strtod.
+
+// true when the 8 bytes (little-endian) are all ASCII digits
+inline bool UIsEightDigits(uint64_t chunk)
+{
+	return (((chunk + 0x4646464646464646ull) | (chunk - 0x3030303030303030ull)) & 0x8080808080808080ull) == 0;
+}
+
+inline uint32_t UParseEightDigits(uint64_t chunk)
+{
+	chunk -= 0x3030303030303030ull;
+	chunk = chunk * 10 + (chunk >> 8);
+	chunk = ((chunk & 0x000000FF000000FFull) * 0x000F424000000064ull + ((chunk >> 16) & 0x000000FF000000FFull) * 0x0000271000000001ull) >> 32;
+	return (uint32_t)chunk;
+}
+
+// accumulates a run of digits into mantissa, returning where it stopped
+inline const char* UParseDigits(const char* p, const char* end, uint64_t& mantissa, int& digits)
+{
+	uint64_t chunk;
+	while (end - p >= 8 && (memcpy(&chunk, p, 8), UIsEightDigits(chunk)))
+	{
+		if (digits + 8 <= 19)
+			mantissa = mantissa * 100000000u + UParseEightDigits(chunk);
+		digits += 8;
+		p += 8;
+	}
+	while (p < end && (unsigned)(*p - '0') < 10)
+	{
+		if (digits < 19)
+			mantissa = mantissa * 10 + (unsigned)(*p - '0');
+		++digits;
+		++p;
+	}
+	return p;
+}
+
+// Parses a decimal number at p. Returns the first character after it, or nullptr when p doesn't start a number.
+inline const char* UParseNumber(const char* p, const char* end, double& value)
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	const char* start = p;
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+'))
+		++p;
+
+	uint64_t mantissa = 0;
+	int digits = 0;
+	p = UParseDigits(p, end, mantissa, digits);
+	int integerDigits = digits;
+	int exponent = 0;
+	if (p < end && *p == '.')
+	{
+		p = UParseDigits(p + 1, end, mantissa, digits);
+		exponent = integerDigits - digits;
+	}
+	if (digits == 0)
+		return nullptr;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* e = p + 1;
+		bool negativeExponent = e < end && *e == '-';
+		if (e < end && (*e == '-' || *e == '+'))
+			++e;
+		if (e < end && (unsigned)(*e - '0') < 10)
+		{
+			int explicitExponent = 0;
+			for (; e < end && (unsigned)(*e - '0') < 10; ++e)
+				if (explicitExponent < 100000)
+					explicitExponent = explicitExponent * 10 + (*e - '0');
+			exponent += negativeExponent ? -explicitExponent : explicitExponent;
+			p = e;
+		}
+	}
+
+	// exact when the mantissa fits a double and the power of ten is exactly representable
+	if (digits <= 19 && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double d = (double)mantissa;
+		d = exponent < 0 ? d / powers[-exponent] : d * powers[exponent];
+		value = negative ? -d : d;
+		return p;
+	}
+
+	char text[128];
+	size_t length = std::min<size_t>((size_t)(p - start), sizeof(text) - 1);
+	memcpy(text, start, length);
+	text[length] = '\0';
+	value = strtod(text, nullptr);
+	return p;
+}
+
+inline const char* UParseFloat(const char* p, const char* end, float& value)
+{
+	double d;
+	p = UParseNumber(p, end, d);
+	if (p)
+		value = (float)d;
+	return p;
+}
+
+inline const char* USkipBlanks(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		++p;
+	return p;
+}
+
+inline const char* USkipLine(const char* p, const char* end)
+{
+	const char* newline = (const char*)memchr(p, '\n', (size_t)(end - p));
+	return newline ? newline + 1 : end;
+}
+
+// Vertex deduplication by value: open addressing over item indices. Fills remap with each item's vertex index and
+// returns, per vertex, the first item that produced it.
+template <class Hash, class Equal>
+std::vector<uint32_t> UDeduplicate(size_t count, const Hash& hash, const Equal& equal, std::vector<uint32_t>& remap)
+{
+	size_t capacity = 16;
+	while (capacity < count + count / 2)
+		capacity *= 2;
+	std::vector<uint32_t> table(capacity, UINT32_MAX); // vertex index, or UINT32_MAX when empty
+	std::vector<uint32_t> unique;
+	remap.resize(count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t slot = hash(i) & (capacity - 1);
+		for (size_t probe = 1;; ++probe)
+		{
+			uint32_t vertex = table[slot];
+			if (vertex == UINT32_MAX)
+			{
+				table[slot] = (uint32_t)unique.size();
+				remap[i] = (uint32_t)unique.size();
+				unique.push_back((uint32_t)i);
+				break;
+			}
+			if (equal(unique[vertex], i))
+			{
+				remap[i] = vertex;
+				break;
+			}
+			slot = (slot + probe) & (capacity - 1); // triangular probing visits every slot of a power of two table
+		}
+	}
+	return unique;
+}
+
+inline uint64_t UHashMix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb53ca6c5a3a9ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// ---- OBJ
+
+// One face corner: 0-based indices into the position, texcoord and normal lists, -1 when absent. An index
+// taken from a negative OBJ index counts from the start of its chunk until the chunk offsets are known.
+struct ObjCorner
+{
+	int32_t Index[3];
+	uint32_t Relative;  // bit k set when Index[k] is chunk-relative
+};
+
+struct ObjChunk
+{
+	const char* Begin = nullptr;
+	const char* End = nullptr;
+	std::vector<glm::vec3> Positions;
+	std::vector<glm::vec4> Colors;     // "v x y z r g b" extension, parallel to Positions when present
+	std::vector<glm::vec2> TexCoords;
+	std::vector<glm::vec3> Normals;
+	std::vector<ObjCorner> Corners;    // three per triangle, polygons fanned
+	size_t Base[3] = { 0, 0, 0 };      // positions, texcoords and normals in the chunks before this one
+	const char* FailureReason = nullptr;
+};
+
+inline const char* UParseFloats(const char* p, const char* end, float* values, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		p = USkipBlanks(p, end);
+		if (!(p = UParseFloat(p, end, values[i])))
+			return nullptr;
+	}
+	return p;
+}
+
+inline void UParseObjChunk(ObjChunk& chunk)
+{
+	const char* p = chunk.Begin;
+	const char* end = chunk.End;
+	std::vector<ObjCorner> polygon;
+
+	while (p < end)
+	{
+		p = USkipBlanks(p, end);
+		if (p + 1 < end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			float v[6];
+			if (!(p = UParseFloats(p + 1, end, v, 3)))
+			{
+				chunk.FailureReason = "bad OBJ vertex position";
+				return;
+			}
+			chunk.Positions.push_back(glm::vec3(v[0], v[1], v[2]));
+			const char* color = UParseFloats(p, end, v + 3, 3);
+			if (color)
+			{
+				chunk.Colors.resize(chunk.Positions.size() - 1, glm::vec4(1.0f));
+				chunk.Colors.push_back(glm::vec4(v[3], v[4], v[5], 1.0f));
+				p = color;
+			}
+		}
+		else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			float v[2];
+			if (!(p = UParseFloats(p + 2, end, v, 2)))
+			{
+				chunk.FailureReason = "bad OBJ texture coordinate";
+				return;
+			}
+			chunk.TexCoords.push_back(glm::vec2(v[0], v[1]));
+		}
+		else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			float v[3];
+			if (!(p = UParseFloats(p + 2, end, v, 3)))
+			{
+				chunk.FailureReason = "bad OBJ normal";
+				return;
+			}
+			chunk.Normals.push_back(glm::vec3(v[0], v[1], v[2]));
+		}
+		else if (p + 1 < end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			polygon.clear();
+			p = USkipBlanks(p + 1, end);
+			while (p < end && *p != '\n' && *p != '#')
+			{
+				ObjCorner corner = { { -1, -1, -1 }, 0 };
+				size_t counts[3] = { chunk.Positions.size(), chunk.TexCoords.size(), chunk.Normals.size() };
+				for (int k = 0; k < 3; ++k)
+				{
+					if (k > 0)
+					{
+						if (p >= end || *p != '/')
+							break;
+						++p;
+						if (p < end && *p == '/') // "v//n"
+							continue;
+					}
+					bool negative = p < end && *p == '-';
+					uint64_t value = 0;
+					int digits = 0;
+					p = UParseDigits(p + (negative ? 1 : 0), end, value, digits);
+					if (digits == 0 || digits > 10 || value == 0 || value > INT32_MAX)
+					{
+						chunk.FailureReason = "bad OBJ face index";
+						return;
+					}
+					if (negative)
+					{
+						corner.Index[k] = (int32_t)((int64_t)counts[k] - (int64_t)value);
+						corner.Relative |= 1 << k;
+					}
+					else
+						corner.Index[k] = (int32_t)value - 1;
+				}
+				polygon.push_back(corner);
+				p = USkipBlanks(p, end);
+			}
+			for (size_t i = 2; i < polygon.size(); ++i)
+			{
+				chunk.Corners.push_back(polygon[0]);
+				chunk.Corners.push_back(polygon[i - 1]);
+				chunk.Corners.push_back(polygon[i]);
+			}
+		}
+		p = USkipLine(p, end);
+	}
+	if (!chunk.Colors.empty())
+		chunk.Colors.resize(chunk.Positions.size(), glm::vec4(1.0f));
+}
+
+inline ImportedMesh UImportObj(const char* text, size_t length, const MeshImportOptions& options, ThreadPool& pool)
+{
+	ImportedMesh result;
+	const char* end = text + length;
+
+	// chunks end just after a newline so no line is split
+	std::vector<ObjChunk> chunks;
+	for (const char* p = text; p < end;)
+	{
+		const char* chunkEnd = p + std::min<size_t>(options.ChunkSize, (size_t)(end - p));
+		chunkEnd = chunkEnd < end ? USkipLine(chunkEnd, end) : end;
+		chunks.emplace_back();
+		chunks.back().Begin = p;
+		chunks.back().End = chunkEnd;
+		p = chunkEnd;
+	}
+	pool.ParallelFor(chunks.size(), [&](size_t i) { UParseObjChunk(chunks[i]); });
+
+	size_t totals[3] = { 0, 0, 0 }, cornerCount = 0;
+	bool hasColors = false;
+	for (ObjChunk& chunk : chunks)
+	{
+		if (chunk.FailureReason)
+		{
+			result.FailureReason = chunk.FailureReason;
+			return result;
+		}
+		chunk.Base[0] = totals[0];
+		chunk.Base[1] = totals[1];
+		chunk.Base[2] = totals[2];
+		totals[0] += chunk.Positions.size();
+		totals[1] += chunk.TexCoords.size();
+		totals[2] += chunk.Normals.size();
+		cornerCount += chunk.Corners.size();
+		hasColors = hasColors || !chunk.Colors.empty();
+	}
+	if (cornerCount == 0)
+	{
+		result.FailureReason = "OBJ has no faces";
+		return result;
+	}
+	if (cornerCount > UINT32_MAX)
+	{
+		result.FailureReason = "OBJ too large";
+		return result;
+	}
+
+	// gather the attribute lists and resolve every corner to absolute indices
+	std::vector<glm::vec3> positions, normals;
+	std::vector<glm::vec4> colors;
+	std::vector<glm::vec2> texCoords;
+	positions.reserve(totals[0]);
+	texCoords.reserve(totals[1]);
+	normals.reserve(totals[2]);
+	std::vector<size_t> cornerBase;
+	size_t cornersBefore = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		if (hasColors)
+		{
+			chunk.Colors.resize(chunk.Positions.size(), glm::vec4(1.0f));
+			colors.insert(colors.end(), chunk.Colors.begin(), chunk.Colors.end());
+		}
+		positions.insert(positions.end(), chunk.Positions.begin(), chunk.Positions.end());
+		texCoords.insert(texCoords.end(), chunk.TexCoords.begin(), chunk.TexCoords.end());
+		normals.insert(normals.end(), chunk.Normals.begin(), chunk.Normals.end());
+		cornerBase.push_back(cornersBefore);
+		cornersBefore += chunk.Corners.size();
+	}
+
+	std::vector<uint32_t> corners(cornerCount * 3); // position, texcoord, normal; UINT32_MAX when absent
+	const char* failure = nullptr;
+	std::mutex failureMutex;
+	pool.ParallelFor(chunks.size(), [&](size_t c)
+	{
+		const ObjChunk& chunk = chunks[c];
+		uint32_t* out = corners.data() + cornerBase[c] * 3;
+		for (const ObjCorner& corner : chunk.Corners)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				int64_t index = corner.Index[k];
+				if ((corner.Relative >> k) & 1)
+					index += (int64_t)chunk.Base[k];
+				if (corner.Index[k] >= 0 || ((corner.Relative >> k) & 1))
+				{
+					if (index < 0 || index >= (int64_t)totals[k])
+					{
+						std::lock_guard<std::mutex> lock(failureMutex);
+						failure = "OBJ face index out of range";
+						return;
+					}
+					*out++ = (uint32_t)index;
+				}
+				else
+					*out++ = UINT32_MAX;
+			}
+		}
+	});
+	if (failure)
+	{
+		result.FailureReason = failure;
+		chunks.clear();
+		return result;
+	}
+	chunks.clear();
+
+	// One vertex per distinct position/texcoord/normal triple. The table is keyed on the position index:
+	// each position chains the vertices built on it, and since faces mostly reference nearby indices the
+	// chains stay in cache, which a general-purpose hash of the triple wouldn't.
+	std::vector<uint32_t> remap(cornerCount), unique;
+	if (options.Deduplicate)
+	{
+		std::vector<uint32_t> newest(totals[0], UINT32_MAX);   // per position: the last vertex built on it
+		std::vector<uint32_t> previous;                         // per vertex: the vertex built on its position before it
+		std::vector<uint64_t> attributes;                       // per vertex: texcoord << 32 | normal
+		for (size_t i = 0; i < cornerCount; ++i)
+		{
+			const uint32_t* key = corners.data() + i * 3;
+			uint64_t rest = (uint64_t)key[1] << 32 | key[2];
+			uint32_t vertex = newest[key[0]];
+			while (vertex != UINT32_MAX && attributes[vertex] != rest)
+				vertex = previous[vertex];
+			if (vertex == UINT32_MAX)
+			{
+				vertex = (uint32_t)unique.size();
+				unique.push_back((uint32_t)i);
+				previous.push_back(newest[key[0]]);
+				attributes.push_back(rest);
+				newest[key[0]] = vertex;
+			}
+			remap[i] = vertex;
+		}
+	}
+	else
+	{
+		unique.resize(cornerCount);
+		for (size_t i = 0; i < cornerCount; ++i)
+			remap[i] = unique[i] = (uint32_t)i;
+	}
+
+	MeshData& mesh = result.Mesh;
+	size_t vertexCount = unique.size();
+	bool anyTexCoord = false, anyNormal = false;
+	for (size_t i = 0; i < cornerCount && !(anyTexCoord && anyNormal); ++i)
+	{
+		anyTexCoord = anyTexCoord || corners[i * 3 + 1] != UINT32_MAX;
+		anyNormal = anyNormal || corners[i * 3 + 2] != UINT32_MAX;
+	}
+	mesh.Positions.resize(vertexCount);
+	if (hasColors)
+		mesh.Colors.resize(vertexCount);
+	if (anyTexCoord)
+		mesh.TexCoords.resize(vertexCount);
+	if (anyNormal)
+		mesh.Normals.resize(vertexCount);
+
+	const size_t block = 1 << 16;
+	pool.ParallelFor((vertexCount + block - 1) / block, [&](size_t b)
+	{
+		for (size_t v = b * block; v < std::min(vertexCount, (b + 1) * block); ++v)
+		{
+			const uint32_t* key = corners.data() + (size_t)unique[v] * 3;
+			mesh.Positions[v] = positions[key[0]];
+			if (hasColors)
+				mesh.Colors[v] = colors[key[0]];
+			if (anyTexCoord)
+				mesh.TexCoords[v] = key[1] != UINT32_MAX ? texCoords[key[1]] : glm::vec2(0.0f);
+			if (anyNormal)
+				mesh.Normals[v] = key[2] != UINT32_MAX ? normals[key[2]] : glm::vec3(0.0f);
+		}
+	});
+	mesh.Indices.swap(remap);
+	result.SourceVertices = cornerCount;
+	return result;
+}
+
+// ---- glTF
+
+// Just enough JSON for a glTF header: the whole document as a tree
+struct JsonValue
+{
+	enum Json_Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+	Json_Type Type = JSON_NULL;
+	double Number = 0.0;
+	std::string String;
+	std::vector<JsonValue> Items;                          // array elements, or object member values
+	std::vector<std::string> Keys;                         // object member names, parallel to Items
+
+	const JsonValue* Find(const char* key) const
+	{
+		for (size_t i = 0; i < Keys.size(); ++i)
+			if (Keys[i] == key)
+				return &Items[i];
+		return nullptr;
+	}
+
+	const JsonValue* At(size_t index) const
+	{
+		return Type == JSON_ARRAY && index < Items.size() ? &Items[index] : nullptr;
+	}
+
+	double NumberOr(const char* key, double fallback) const
+	{
+		const JsonValue* value = Find(key);
+		return value && value->Type == JSON_NUMBER ? value->Number : fallback;
+	}
+};
+
+inline const char* UParseJsonString(const char* p, const char* end, std::string& out)
+{
+	for (++p; p < end && *p != '"'; ++p)
+	{
+		if (*p != '\\')
+		{
+			out += *p;
+			continue;
+		}
+		if (++p >= end)
+			return nullptr;
+		switch (*p)
+		{
+		case 'b': out += '\b'; break;
+		case 'f': out += '\f'; break;
+		case 'n': out += '\n'; break;
+		case 'r': out += '\r'; break;
+		case 't': out += '\t'; break;
+		case 'u': // glTF names are only compared against ASCII keys
+			if (end - p < 5)
+				return nullptr;
+			out += '?';
+			p += 4;
+			break;
+		default: out += *p; break;
+		}
+	}
+	return p < end ? p + 1 : nullptr;
+}
+
+inline const char* UParseJson(const char* p, const char* end, JsonValue& value, int depth = 0)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		++p;
+	if (p >= end || depth > 64)
+		return nullptr;
+
+	if (*p == '{' || *p == '[')
+	{
+		bool object = *p == '{';
+		char close = object ? '}' : ']';
+		value.Type = object ? JsonValue::JSON_OBJECT : JsonValue::JSON_ARRAY;
+		for (++p;;)
+		{
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == ','))
+				++p;
+			if (p >= end)
+				return nullptr;
+			if (*p == close)
+				return p + 1;
+			if (object)
+			{
+				value.Keys.emplace_back();
+				if (*p != '"' || !(p = UParseJsonString(p, end, value.Keys.back())))
+					return nullptr;
+				while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+					++p;
+				if (p >= end || *p++ != ':')
+					return nullptr;
+			}
+			value.Items.emplace_back();
+			if (!(p = UParseJson(p, end, value.Items.back(), depth + 1)))
+				return nullptr;
+		}
+	}
+	if (*p == '"')
+	{
+		value.Type = JsonValue::JSON_STRING;
+		return UParseJsonString(p, end, value.String);
+	}
+	if (end - p >= 4 && (memcmp(p, "true", 4) == 0 || memcmp(p, "null", 4) == 0))
+	{
+		value.Type = *p == 't' ? JsonValue::JSON_BOOL : JsonValue::JSON_NULL;
+		value.Number = *p == 't' ? 1.0 : 0.0;
+		return p + 4;
+	}
+	if (end - p >= 5 && memcmp(p, "false", 5) == 0)
+	{
+		value.Type = JsonValue::JSON_BOOL;
+		return p + 5;
+	}
+	value.Type = JsonValue::JSON_NUMBER;
+	return UParseNumber(p, end, value.Number);
+}
+
+struct GltfDocument
+{
+	JsonValue Json;
+	const unsigned char* Binary = nullptr;  // the GLB BIN chunk, buffer 0
+	size_t BinaryLength = 0;
+};
+
+// Where an accessor's elements live in the BIN chunk
+struct GltfAccessor
+{
+	const unsigned char* Data = nullptr;
+	size_t Count = 0;
+	size_t Stride = 0;
+	int ComponentType = 0;
+	size_t ComponentSize = 0;
+	int Components = 0;
+	bool Normalized = false;
+};
+
+// Fails for accessors this importer doesn't handle (sparse, external buffers) and ones that run past their view
+inline bool UResolveGltfAccessor(const GltfDocument& document, int accessorIndex, GltfAccessor& out)
+{
+	const JsonValue* accessors = document.Json.Find("accessors");
+	const JsonValue* accessor = accessors && accessorIndex >= 0 ? accessors->At((size_t)accessorIndex) : nullptr;
+	if (!accessor || accessor->Find("sparse"))
+		return false;
+	const JsonValue* views = document.Json.Find("bufferViews");
+	double viewIndex = accessor->NumberOr("bufferView", -1.0);
+	const JsonValue* view = views && viewIndex >= 0.0 ? views->At((size_t)viewIndex) : nullptr;
+	if (!view || view->NumberOr("buffer", 0.0) != 0.0 || !document.Binary)
+		return false;
+
+	const JsonValue* type = accessor->Find("type");
+	out.Components = !type ? 0 : type->String == "SCALAR" ? 1 : type->String == "VEC2" ? 2 : type->String == "VEC3" ? 3 : type->String == "VEC4" ? 4 : 0;
+	out.ComponentType = (int)accessor->NumberOr("componentType", 0.0);
+	out.ComponentSize = out.ComponentType == GL_FLOAT || out.ComponentType == GL_UNSIGNED_INT ? 4 :
+		out.ComponentType == GL_SHORT || out.ComponentType == GL_UNSIGNED_SHORT ? 2 :
+		out.ComponentType == GL_BYTE || out.ComponentType == GL_UNSIGNED_BYTE ? 1 : 0;
+	if (out.Components == 0 || out.ComponentSize == 0)
+		return false;
+	const JsonValue* normalized = accessor->Find("normalized");
+	out.Normalized = normalized && normalized->Number != 0.0;
+
+	out.Count = (size_t)accessor->NumberOr("count", 0.0);
+	size_t elementSize = out.ComponentSize * (size_t)out.Components;
+	out.Stride = (size_t)view->NumberOr("byteStride", 0.0);
+	if (out.Stride == 0)
+		out.Stride = elementSize;
+	size_t viewOffset = (size_t)view->NumberOr("byteOffset", 0.0);
+	size_t viewEnd = viewOffset + (size_t)view->NumberOr("byteLength", 0.0);
+	size_t offset = viewOffset + (size_t)accessor->NumberOr("byteOffset", 0.0);
+	if (viewEnd > document.BinaryLength || (out.Count > 0 && offset + (out.Count - 1) * out.Stride + elementSize > viewEnd))
+		return false;
+	out.Data = document.Binary + offset;
+	return true;
+}
+
+// Reads the first components of every element as floats, applying the accessor's normalization
+inline bool UReadGltfAccessor(const GltfDocument& document, int accessorIndex, int components, std::vector<float>& out, ThreadPool& pool)
+{
+	GltfAccessor accessor;
+	if (!UResolveGltfAccessor(document, accessorIndex, accessor) || accessor.Components < components)
+		return false;
+
+	out.resize(accessor.Count * (size_t)components);
+	const size_t block = 1 << 16;
+	pool.ParallelFor((accessor.Count + block - 1) / block, [&](size_t b)
+	{
+		for (size_t i = b * block; i < std::min(accessor.Count, (b + 1) * block); ++i)
+		{
+			const unsigned char* element = accessor.Data + i * accessor.Stride;
+			for (int k = 0; k < components; ++k)
+			{
+				const unsigned char* c = element + k * accessor.ComponentSize;
+				float v = 0.0f;
+				switch (accessor.ComponentType)
+				{
+				case GL_FLOAT: memcpy(&v, c, 4); break;
+				case GL_UNSIGNED_INT: { uint32_t x; memcpy(&x, c, 4); v = (float)x; break; }
+				case GL_UNSIGNED_SHORT: { uint16_t x; memcpy(&x, c, 2); v = accessor.Normalized ? x / 65535.0f : x; break; }
+				case GL_SHORT: { int16_t x; memcpy(&x, c, 2); v = accessor.Normalized ? std::max(x / 32767.0f, -1.0f) : x; break; }
+				case GL_UNSIGNED_BYTE: v = accessor.Normalized ? *c / 255.0f : *c; break;
+				case GL_BYTE: v = accessor.Normalized ? std::max((int8_t)*c / 127.0f, -1.0f) : (int8_t)*c; break;
+				}
+				out[i * components + k] = v;
+			}
+		}
+	});
+	return true;
+}
+
+inline bool UReadGltfIndices(const GltfDocument& document, int accessorIndex, std::vector<uint32_t>& out)
+{
+	GltfAccessor accessor;
+	if (!UResolveGltfAccessor(document, accessorIndex, accessor) || accessor.Components != 1)
+		return false;
+	out.resize(accessor.Count);
+	for (size_t i = 0; i < accessor.Count; ++i)
+	{
+		const unsigned char* c = accessor.Data + i * accessor.Stride;
+		switch (accessor.ComponentType)
+		{
+		case GL_UNSIGNED_INT: memcpy(&out[i], c, 4); break;
+		case GL_UNSIGNED_SHORT: { uint16_t x; memcpy(&x, c, 2); out[i] = x; break; }
+		case GL_UNSIGNED_BYTE: out[i] = *c; break;
+		default: return false;
+		}
+	}
+	return true;
+}
+
+// a node's local transform, from "matrix" or translation/rotation/scale
+inline glm::mat4 UGltfNodeTransform(const JsonValue& node)
+{
+	glm::mat4 transform(1.0f);
+	const JsonValue* matrix = node.Find("matrix");
+	if (matrix && matrix->Items.size() == 16)
+	{
+		for (int c = 0; c < 4; ++c)
+			for (int r = 0; r < 4; ++r)
+				transform[c][r] = (float)matrix->Items[c * 4 + r].Number;
+		return transform;
+	}
+	const JsonValue* t = node.Find("translation");
+	const JsonValue* r = node.Find("rotation");
+	const JsonValue* s = node.Find("scale");
+	if (r && r->Items.size() == 4)
+	{
+		float x = (float)r->Items[0].Number, y = (float)r->Items[1].Number, z = (float)r->Items[2].Number, w = (float)r->Items[3].Number;
+		transform[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w), 0.0f);
+		transform[1] = glm::vec4(2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w), 0.0f);
+		transform[2] = glm::vec4(2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y), 0.0f);
+	}
+	if (s && s->Items.size() == 3)
+		for (int c = 0; c < 3; ++c)
+			transform[c] = transform[c] * (float)s->Items[c].Number;
+	if (t && t->Items.size() == 3)
+		transform[3] = glm::vec4((float)t->Items[0].Number, (float)t->Items[1].Number, (float)t->Items[2].Number, 1.0f);
+	return transform;
+}
+
+// Appends one triangle-list primitive, transformed into scene space
+inline const char* UAppendGltfPrimitive(const GltfDocument& document, const JsonValue& primitive, const glm::mat4& transform, MeshData& mesh, ThreadPool& pool)
+{
+	if (primitive.NumberOr("mode", 4.0) != 4.0)
+		return nullptr; // points, lines and strips are skipped
+	const JsonValue* attributes = primitive.Find("attributes");
+	const JsonValue* position = attributes ? attributes->Find("POSITION") : nullptr;
+	if (!position)
+		return nullptr;
+
+	std::vector<float> positions, normals, texCoords, colors;
+	if (!UReadGltfAccessor(document, (int)position->Number, 3, positions, pool))
+		return "unsupported glTF position accessor";
+	size_t count = positions.size() / 3;
+	const JsonValue* normal = attributes->Find("NORMAL");
+	const JsonValue* texCoord = attributes->Find("TEXCOORD_0");
+	const JsonValue* color = attributes->Find("COLOR_0");
+	if (normal && (!UReadGltfAccessor(document, (int)normal->Number, 3, normals, pool) || normals.size() != count * 3))
+		return "unsupported glTF normal accessor";
+	if (texCoord && (!UReadGltfAccessor(document, (int)texCoord->Number, 2, texCoords, pool) || texCoords.size() != count * 2))
+		return "unsupported glTF texture coordinate accessor";
+	if (color)
+	{
+		GltfAccessor accessor;
+		int components = UResolveGltfAccessor(document, (int)color->Number, accessor) && accessor.Components == 4 ? 4 : 3;
+		std::vector<float> values;
+		if (!UReadGltfAccessor(document, (int)color->Number, components, values, pool) || values.size() != count * components)
+			return "unsupported glTF color accessor";
+		colors.resize(count * 4, 1.0f);
+		for (size_t i = 0; i < count; ++i)
+			for (int k = 0; k < components; ++k)
+				colors[i * 4 + k] = values[i * components + k];
+	}
+
+	std::vector<uint32_t> indices;
+	const JsonValue* indexAccessor = primitive.Find("indices");
+	if (indexAccessor && !UReadGltfIndices(document, (int)indexAccessor->Number, indices))
+		return "unsupported glTF index accessor";
+	if (!indexAccessor)
+		for (uint32_t i = 0; i < (uint32_t)count; ++i)
+			indices.push_back(i);
+	for (uint32_t index : indices)
+		if (index >= count)
+			return "glTF index out of range";
+
+	// keep every array parallel to Positions once any primitive has the attribute
+	size_t first = mesh.Positions.size();
+	bool hasNormals = !normals.empty() || !mesh.Normals.empty();
+	bool hasTexCoords = !texCoords.empty() || !mesh.TexCoords.empty();
+	bool hasColors = !colors.empty() || !mesh.Colors.empty();
+	mesh.Positions.resize(first + count);
+	if (hasNormals)
+		mesh.Normals.resize(first + count, glm::vec3(0.0f));
+	if (hasTexCoords)
+		mesh.TexCoords.resize(first + count, glm::vec2(0.0f));
+	if (hasColors)
+		mesh.Colors.resize(first + count, glm::vec4(1.0f));
+
+	// normals go through the cofactor matrix, which is the inverse transpose scaled by the determinant;
+	// a mirroring transform (negative determinant) also flips the winding
+	glm::vec3 c0(transform[0]), c1(transform[1]), c2(transform[2]);
+	glm::vec3 n0 = glm::cross(c1, c2), n1 = glm::cross(c2, c0), n2 = glm::cross(c0, c1);
+	bool mirrored = glm::dot(n2, c2) < 0.0f;
+	if (mirrored)
+	{
+		n0 = -n0;
+		n1 = -n1;
+		n2 = -n2;
+	}
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t v = first + i;
+		mesh.Positions[v] = glm::vec3(transform * glm::vec4(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2], 1.0f));
+		if (!normals.empty())
+		{
+			glm::vec3 n = n0 * normals[i * 3] + n1 * normals[i * 3 + 1] + n2 * normals[i * 3 + 2];
+			float length = glm::length(n);
+			mesh.Normals[v] = length > 0.0f ? n / length : n;
+		}
+		if (!texCoords.empty()) // glTF puts the texture origin top-left, OpenGL bottom-left
+			mesh.TexCoords[v] = glm::vec2(texCoords[i * 2], 1.0f - texCoords[i * 2 + 1]);
+		if (!colors.empty())
+			mesh.Colors[v] = glm::vec4(colors[i * 4], colors[i * 4 + 1], colors[i * 4 + 2], colors[i * 4 + 3]);
+	}
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		mesh.Indices.push_back((uint32_t)first + indices[i]);
+		mesh.Indices.push_back((uint32_t)first + indices[mirrored ? i + 2 : i + 1]);
+		mesh.Indices.push_back((uint32_t)first + indices[mirrored ? i + 1 : i + 2]);
+	}
+	return nullptr;
+}
+
+inline const char* UAppendGltfNode(const GltfDocument& document, size_t nodeIndex, const glm::mat4& parent, MeshData& mesh, ThreadPool& pool, int depth)
+{
+	const JsonValue* nodes = document.Json.Find("nodes");
+	const JsonValue* node = nodes ? nodes->At(nodeIndex) : nullptr;
+	if (!node || depth > 64)
+		return "bad glTF node hierarchy";
+	glm::mat4 transform = parent * UGltfNodeTransform(*node);
+
+	const JsonValue* meshes = document.Json.Find("meshes");
+	const JsonValue* meshIndex = node->Find("mesh");
+	const JsonValue* gltfMesh = meshes && meshIndex ? meshes->At((size_t)meshIndex->Number) : nullptr;
+	const JsonValue* primitives = gltfMesh ? gltfMesh->Find("primitives") : nullptr;
+	if (primitives)
+		for (const JsonValue& primitive : primitives->Items)
+			if (const char* failure = UAppendGltfPrimitive(document, primitive, transform, mesh, pool))
+				return failure;
+
+	const JsonValue* children = node->Find("children");
+	if (children)
+		for (const JsonValue& child : children->Items)
+			if (const char* failure = UAppendGltfNode(document, (size_t)child.Number, transform, mesh, pool, depth + 1))
+				return failure;
+	return nullptr;
+}
+
+inline ImportedMesh UImportGlb(const unsigned char* data, size_t length, const MeshImportOptions& options, ThreadPool& pool)
+{
+	ImportedMesh result;
+	auto read32 = [data](size_t offset) { uint32_t v; memcpy(&v, data + offset, 4); return v; };
+	if (length < 20 || read32(0) != 0x46546C67u || read32(4) != 2)
+	{
+		result.FailureReason = "not a glTF 2.0 binary";
+		return result;
+	}
+
+	GltfDocument document;
+	const char* json = nullptr;
+	size_t jsonLength = 0;
+	for (size_t offset = 12; offset + 8 <= length;)
+	{
+		size_t chunkLength = read32(offset);
+		uint32_t chunkType = read32(offset + 4);
+		if (chunkLength > length - offset - 8)
+			break;
+		if (chunkType == 0x4E4F534Au && !json)
+		{
+			json = (const char*)data + offset + 8;
+			jsonLength = chunkLength;
+		}
+		else if (chunkType == 0x004E4942u && !document.Binary)
+		{
+			document.Binary = data + offset + 8;
+			document.BinaryLength = chunkLength;
+		}
+		offset += 8 + ((chunkLength + 3) & ~(size_t)3);
+	}
+	if (!json || !UParseJson(json, json + jsonLength, document.Json) || document.Json.Type != JsonValue::JSON_OBJECT)
+	{
+		result.FailureReason = "bad glTF JSON chunk";
+		return result;
+	}
+
+	// the default scene's node trees, or every mesh untransformed when the file has no scenes
+	MeshData& mesh = result.Mesh;
+	const char* failure = nullptr;
+	const JsonValue* scenes = document.Json.Find("scenes");
+	const JsonValue* scene = scenes ? scenes->At((size_t)document.Json.NumberOr("scene", 0.0)) : nullptr;
+	const JsonValue* roots = scene ? scene->Find("nodes") : nullptr;
+	if (roots)
+	{
+		for (const JsonValue& root : roots->Items)
+			if (!failure)
+				failure = UAppendGltfNode(document, (size_t)root.Number, glm::mat4(1.0f), mesh, pool, 0);
+	}
+	else if (const JsonValue* meshes = document.Json.Find("meshes"))
+	{
+		for (const JsonValue& gltfMesh : meshes->Items)
+			if (const JsonValue* primitives = gltfMesh.Find("primitives"))
+				for (const JsonValue& primitive : primitives->Items)
+					if (!failure)
+						failure = UAppendGltfPrimitive(document, primitive, glm::mat4(1.0f), mesh, pool);
+	}
+	if (!failure && mesh.Indices.empty())
+		failure = "glTF has no triangles";
+	if (failure)
+	{
+		result.FailureReason = failure;
+		result.Mesh = MeshData();
+		return result;
+	}
+	result.SourceVertices = mesh.Positions.size();
+
+	if (options.Deduplicate)
+	{
+		// a vertex is the bytes of all its attributes
+		std::vector<uint32_t> remap;
+		auto equal = [&mesh](size_t a, size_t b)
+		{
+			return memcmp(&mesh.Positions[a], &mesh.Positions[b], sizeof(glm::vec3)) == 0 &&
+				(mesh.Normals.empty() || memcmp(&mesh.Normals[a], &mesh.Normals[b], sizeof(glm::vec3)) == 0) &&
+				(mesh.TexCoords.empty() || memcmp(&mesh.TexCoords[a], &mesh.TexCoords[b], sizeof(glm::vec2)) == 0) &&
+				(mesh.Colors.empty() || memcmp(&mesh.Colors[a], &mesh.Colors[b], sizeof(glm::vec4)) == 0);
+		};
+		auto hash = [&mesh](size_t i)
+		{
+			uint32_t bits[3];
+			memcpy(bits, &mesh.Positions[i], sizeof(bits));
+			uint64_t h = UHashMix(((uint64_t)bits[0] << 32 | bits[1]) ^ (uint64_t)bits[2] * 0x9E3779B97F4A7C15ull);
+			if (!mesh.TexCoords.empty())
+			{
+				uint64_t uv;
+				memcpy(&uv, &mesh.TexCoords[i], sizeof(uv));
+				h = UHashMix(h ^ uv);
+			}
+			return (size_t)h;
+		};
+		std::vector<uint32_t> unique = UDeduplicate(mesh.Positions.size(), hash, equal, remap);
+		if (unique.size() < mesh.Positions.size())
+		{
+			MeshData merged;
+			merged.Positions.resize(unique.size());
+			merged.Normals.resize(mesh.Normals.empty() ? 0 : unique.size());
+			merged.TexCoords.resize(mesh.TexCoords.empty() ? 0 : unique.size());
+			merged.Colors.resize(mesh.Colors.empty() ? 0 : unique.size());
+			for (size_t v = 0; v < unique.size(); ++v)
+			{
+				merged.Positions[v] = mesh.Positions[unique[v]];
+				if (!merged.Normals.empty())
+					merged.Normals[v] = mesh.Normals[unique[v]];
+				if (!merged.TexCoords.empty())
+					merged.TexCoords[v] = mesh.TexCoords[unique[v]];
+				if (!merged.Colors.empty())
+					merged.Colors[v] = mesh.Colors[unique[v]];
+			}
+			merged.Indices.resize(mesh.Indices.size());
+			for (size_t i = 0; i < mesh.Indices.size(); ++i)
+				merged.Indices[i] = remap[mesh.Indices[i]];
+			mesh = std::move(merged);
+		}
+	}
+	return result;
+}
+
+// Imports an .obj or .glb file, picking the parser from the contents (glb starts with "glTF")
+inline ImportedMesh UImportMesh(const std::string& filename, const MeshImportOptions& options = MeshImportOptions(), ThreadPool& pool = GetSharedThreadPool())
+{
+	MappedFile file;
+	if (!file.Open(filename.c_str()))
+	{
+		ImportedMesh result;
+		result.FailureReason = "can't map mesh file";
+		return result;
+	}
+	if (file.Size() >= 4 && memcmp(file.Data(), "glTF", 4) == 0)
+		return UImportGlb(file.Data(), file.Size(), options, pool);
+	return UImportObj((const char*)file.Data(), file.Size(), options, pool);
+}
+
+#endif
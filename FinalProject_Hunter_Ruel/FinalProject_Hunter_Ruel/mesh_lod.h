@@ -0,0 +1,323 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "mesh_optimizer.h"
+#include "vertex_format.h"
+
+// Level-of-detail chains. UGenerateLods simplifies a mesh with quadric error metrics (Garland and Heckbert)
+// into successively coarser index buffers that share the original vertices, appends them to the mesh's
+// index list and records each level's range and geometric error in MeshData::Lods. USelectLod picks the
+// coarsest level whose error projects to less than a pixel.
+
+#define MESH_LOD_MAX_LEVELS 8              // must not exceed MESH_CACHE_MAX_LODS
+#define MESH_LOD_MIN_TRIANGLES 64          // stop simplifying below this
+#define MESH_LOD_PIXEL_ERROR 1.0f          // allowed screen-space error
+#define MESH_LOD_HYSTERESIS 0.25f          // fraction the error has to move past the threshold before switching
+
+// a symmetric 4x4 error quadric, weighted by triangle area
+struct Quadric
+{
+	double A00 = 0, A01 = 0, A02 = 0, A11 = 0, A12 = 0, A22 = 0;
+	double B0 = 0, B1 = 0, B2 = 0;
+	double C = 0;
+	double Weight = 0;
+
+	// squared distance to the plane dot(n, p) + d = 0, times weight
+	void AddPlane(const glm::vec3& n, float d, double weight)
+	{
+		A00 += weight * n.x * n.x; A01 += weight * n.x * n.y; A02 += weight * n.x * n.z;
+		A11 += weight * n.y * n.y; A12 += weight * n.y * n.z; A22 += weight * n.z * n.z;
+		B0 += weight * n.x * d; B1 += weight * n.y * d; B2 += weight * n.z * d;
+		C += weight * d * d;
+		Weight += weight;
+	}
+
+	void Add(const Quadric& q)
+	{
+		A00 += q.A00; A01 += q.A01; A02 += q.A02; A11 += q.A11; A12 += q.A12; A22 += q.A22;
+		B0 += q.B0; B1 += q.B1; B2 += q.B2;
+		C += q.C;
+		Weight += q.Weight;
+	}
+
+	// weighted mean squared distance from p to the accumulated planes
+	double Error(const glm::vec3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = A00 * x * x + A11 * y * y + A22 * z * z + 2 * (A01 * x * y + A02 * x * z + A12 * y * z)
+			+ 2 * (B0 * x + B1 * y + B2 * z) + C;
+		return Weight > 0 ? std::fabs(e) / Weight : 0.0;
+	}
+};
+
+// How a vertex may move. Seams (several vertices at one position) and non-manifold vertices stay put;
+// border vertices only slide along their border.
+enum Lod_VertexKind {
+	LOD_MANIFOLD,
+	LOD_BORDER,
+	LOD_LOCKED
+};
+
+// Simplifies the triangles in indices toward targetIndexCount by collapsing vertices onto neighbors.
+// Returns the new index list; error receives the largest distance a collapse moved the surface.
+inline std::vector<uint32_t> USimplifyMesh(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, size_t targetIndexCount, float& error)
+{
+	const size_t vertexCount = positions.size();
+	std::vector<uint32_t> triangles(indices);
+	error = 0.0f;
+
+	// vertices at the same position form a group; a group with several members is a seam
+	std::vector<uint32_t> order(vertexCount), group(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		order[v] = (uint32_t)v;
+	auto positionLess = [&](uint32_t a, uint32_t b) { return memcmp(&positions[a], &positions[b], sizeof(glm::vec3)) < 0; };
+	std::sort(order.begin(), order.end(), positionLess);
+	std::vector<uint32_t> groupSize;
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		if (i == 0 || positionLess(order[i - 1], order[i]))
+			groupSize.push_back(0);
+		group[order[i]] = (uint32_t)groupSize.size() - 1;
+		++groupSize.back();
+	}
+
+	std::vector<unsigned char> kind(groupSize.size(), LOD_MANIFOLD);
+	for (size_t g = 0; g < groupSize.size(); ++g)
+		if (groupSize[g] > 1)
+			kind[g] = LOD_LOCKED;
+
+	// directed edges between groups: an edge without its reverse is a border, a repeated one is non-manifold
+	std::vector<uint64_t> edges;
+	edges.reserve(triangles.size());
+	for (size_t t = 0; t < triangles.size(); t += 3)
+		for (int k = 0; k < 3; ++k)
+			edges.push_back((uint64_t)group[triangles[t + k]] << 32 | group[triangles[t + (k + 1) % 3]]);
+	std::sort(edges.begin(), edges.end());
+	auto hasEdge = [&](uint32_t a, uint32_t b) { return std::binary_search(edges.begin(), edges.end(), (uint64_t)a << 32 | b); };
+	auto isBorder = [&](uint32_t a, uint32_t b) { return hasEdge(a, b) != hasEdge(b, a); };
+
+	std::vector<Quadric> quadrics(groupSize.size());
+	for (size_t i = 0; i < edges.size(); ++i)
+	{
+		uint32_t a = (uint32_t)(edges[i] >> 32), b = (uint32_t)edges[i];
+		if (i > 0 && edges[i] == edges[i - 1])
+			kind[a] = kind[b] = LOD_LOCKED;
+		else if (!hasEdge(b, a))
+		{
+			if (kind[a] != LOD_LOCKED)
+				kind[a] = LOD_BORDER;
+			if (kind[b] != LOD_LOCKED)
+				kind[b] = LOD_BORDER;
+		}
+	}
+
+	// face planes, plus planes perpendicular to border edges so borders keep their shape
+	for (size_t t = 0; t < triangles.size(); t += 3)
+	{
+		const glm::vec3& p0 = positions[triangles[t]];
+		const glm::vec3& p1 = positions[triangles[t + 1]];
+		const glm::vec3& p2 = positions[triangles[t + 2]];
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(normal);
+		if (area <= 0.0f)
+			continue;
+		normal /= area;
+		for (int k = 0; k < 3; ++k)
+			quadrics[group[triangles[t + k]]].AddPlane(normal, -glm::dot(normal, p0), area);
+
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t a = triangles[t + k], b = triangles[t + (k + 1) % 3];
+			if (!isBorder(group[a], group[b]))
+				continue;
+			glm::vec3 edge = positions[b] - positions[a];
+			float length = glm::length(edge);
+			if (length <= 0.0f)
+				continue;
+			glm::vec3 side = glm::normalize(glm::cross(edge, normal));
+			float d = -glm::dot(side, positions[a]);
+			quadrics[group[a]].AddPlane(side, d, 10.0 * length * length);
+			quadrics[group[b]].AddPlane(side, d, 10.0 * length * length);
+		}
+	}
+
+	struct Collapse
+	{
+		uint32_t Source;
+		uint32_t Target;
+		double Cost;
+	};
+	std::vector<Collapse> candidates;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<unsigned char> touched(groupSize.size());
+	std::vector<uint32_t> adjacencyOffsets, adjacency;
+	double maxCost = 0.0;
+
+	while (triangles.size() > targetIndexCount)
+	{
+		// the cheapest allowed collapse for every vertex
+		candidates.clear();
+		std::vector<Collapse> best(vertexCount, Collapse{ 0, UINT32_MAX, DBL_MAX });
+		for (size_t t = 0; t < triangles.size(); t += 3)
+			for (int k = 0; k < 6; ++k)
+			{
+				uint32_t v = triangles[t + k % 3], target = triangles[t + (k + (k < 3 ? 1 : 2)) % 3];
+				uint32_t gv = group[v], gt = group[target];
+				if (kind[gv] == LOD_LOCKED || gv == gt)
+					continue;
+				if (kind[gv] == LOD_BORDER && (kind[gt] == LOD_MANIFOLD || !isBorder(gv, gt)))
+					continue;
+				double cost = quadrics[gv].Error(positions[target]);
+				if (cost < best[v].Cost)
+					best[v] = Collapse{ v, target, cost };
+			}
+		for (const Collapse& collapse : best)
+			if (collapse.Target != UINT32_MAX)
+				candidates.push_back(collapse);
+		if (candidates.empty())
+			break;
+		std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) { return a.Cost < b.Cost; });
+
+		// triangles around each vertex, for the flip test
+		adjacencyOffsets.assign(vertexCount + 1, 0);
+		for (uint32_t v : triangles)
+			++adjacencyOffsets[v + 1];
+		for (size_t v = 0; v < vertexCount; ++v)
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		adjacency.resize(triangles.size());
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t t = 0; t < triangles.size(); t += 3)
+			for (int k = 0; k < 3; ++k)
+				adjacency[fill[triangles[t + k]]++] = (uint32_t)(t / 3);
+
+		// Apply the cheapest collapses whose neighborhoods don't overlap. Each one removes about two
+		// triangles, so stop once the pass would reach the target. Overlaps skip many candidates, so the
+		// pass also stops at the cost of the last one it would have needed; cheaper collapses may open up
+		// around the skipped ones in the next pass.
+		for (size_t v = 0; v < vertexCount; ++v)
+			remap[v] = (uint32_t)v;
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t collapseLimit = (triangles.size() - targetIndexCount) / 6 + 1;
+		double costLimit = candidates[std::min(collapseLimit, candidates.size()) - 1].Cost;
+		size_t collapses = 0;
+		for (const Collapse& collapse : candidates)
+		{
+			if (collapses >= collapseLimit || collapse.Cost > costLimit)
+				break;
+			uint32_t v = collapse.Source, target = collapse.Target;
+			if (touched[group[v]] || touched[group[target]])
+				continue;
+
+			// reject collapses that would turn a remaining triangle over
+			bool flips = false;
+			for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1] && !flips; ++a)
+			{
+				const uint32_t* corner = &triangles[adjacency[a] * 3];
+				if (corner[0] == target || corner[1] == target || corner[2] == target)
+					continue;
+				glm::vec3 p[3], q[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					p[k] = positions[corner[k]];
+					q[k] = corner[k] == v ? positions[target] : p[k];
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+			}
+			if (flips)
+				continue;
+
+			remap[v] = target;
+			quadrics[group[target]].Add(quadrics[group[v]]);
+			maxCost = std::max(maxCost, collapse.Cost);
+			++collapses;
+
+			// the one-ring changed, so its collapse costs and flip tests are stale until the next pass
+			for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; ++a)
+				for (int k = 0; k < 3; ++k)
+					touched[group[triangles[adjacency[a] * 3 + k]]] = 1;
+		}
+		if (collapses == 0)
+			break;
+
+		// drop the triangles that became degenerate
+		size_t kept = 0;
+		for (size_t t = 0; t < triangles.size(); t += 3)
+		{
+			uint32_t a = remap[triangles[t]], b = remap[triangles[t + 1]], c = remap[triangles[t + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+			triangles[kept++] = a;
+			triangles[kept++] = b;
+			triangles[kept++] = c;
+		}
+		triangles.resize(kept);
+	}
+
+	error = (float)std::sqrt(maxCost);
+	return triangles;
+}
+
+// Appends coarser levels to mesh.Indices until the mesh is small or stops simplifying. LOD 0 is the mesh as
+// given; run UOptimizeMesh before this so the shared vertex order follows LOD 0.
+inline void UGenerateLods(MeshData& mesh)
+{
+	mesh.Lods.clear();
+	mesh.Lods.push_back(MeshLod{ 0, (uint32_t)mesh.Indices.size(), 0.0f });
+
+	std::vector<uint32_t> current(mesh.Indices);
+	float error = 0.0f;
+	while (mesh.Lods.size() < MESH_LOD_MAX_LEVELS && current.size() / 3 > MESH_LOD_MIN_TRIANGLES)
+	{
+		size_t target = std::max<size_t>(current.size() / 6 * 3, MESH_LOD_MIN_TRIANGLES * 3);
+		float levelError;
+		std::vector<uint32_t> next = USimplifyMesh(mesh.Positions, current, target, levelError);
+		if (next.empty() || next.size() > current.size() * 9 / 10)
+			break; // locked by seams and borders
+
+		std::vector<uint32_t> ordered;
+		std::vector<size_t> hardBoundaries;
+		UOptimizeVertexCache(next, mesh.Positions.size(), ordered, hardBoundaries);
+
+		// each level is simplified from the previous one, so the errors add up
+		error += levelError;
+		mesh.Lods.push_back(MeshLod{ (uint32_t)mesh.Indices.size(), (uint32_t)ordered.size(), error });
+		mesh.Indices.insert(mesh.Indices.end(), ordered.begin(), ordered.end());
+		current.swap(ordered);
+	}
+}
+
+// Picks the level to draw. unitsToPixels converts a model-space distance at the object's depth to pixels;
+// current is the level drawn last frame. A level is only left once its error is clearly past the threshold,
+// so objects near a switching distance don't flicker between two levels.
+inline int USelectLod(const MeshLod* lods, int lodCount, float unitsToPixels, int current)
+{
+	if (lodCount <= 1)
+		return 0;
+	current = std::min(std::max(current, 0), lodCount - 1);
+
+	if (lods[current].Error * unitsToPixels > MESH_LOD_PIXEL_ERROR * (1.0f + MESH_LOD_HYSTERESIS))
+	{
+		// too coarse: the coarsest level that is fine right now
+		int level = current;
+		while (level > 0 && lods[level].Error * unitsToPixels > MESH_LOD_PIXEL_ERROR)
+			--level;
+		return level;
+	}
+
+	// coarser only when comfortably under the threshold
+	int level = current;
+	while (level + 1 < lodCount && lods[level + 1].Error * unitsToPixels < MESH_LOD_PIXEL_ERROR * (1.0f - MESH_LOD_HYSTERESIS))
+		++level;
+	return level;
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef MESH_MESHLETS_H
+#define MESH_MESHLETS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "frustum.h"
+#include "vertex_format.h"
+
+// Meshlets: LOD 0 is regrouped at import time into clusters of nearby, similarly facing triangles, each a
+// contiguous range of the index buffer with a bounding sphere and a normal cone. Every frame UCullMeshlets
+// drops the clusters that are off screen or face away from the camera and turns the rest into indirect draws.
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_CONE_MIN_DOT 0.1f   // clusters bent further than this (about 84 degrees) never cone-cull
+
+// glDrawElementsIndirect / glMultiDrawElementsIndirect command, laid out as the GL spec requires
+struct DrawElementsIndirectCommand
+{
+	GLuint Count;
+	GLuint InstanceCount;
+	GLuint FirstIndex;
+	GLint BaseVertex;
+	GLuint BaseInstance;
+};
+
+// Regroups the triangles of LOD 0 into meshlets and stores them in mesh.Meshlets. Each meshlet grows from the
+// first unused triangle in the current order (so the vertex cache order mostly survives) by adding the
+// neighbor that needs the fewest new vertices and best matches the meshlet's average facing.
+inline void UBuildMeshlets(MeshData& mesh)
+{
+	mesh.Meshlets.clear();
+	size_t first = mesh.Lods.empty() ? 0 : mesh.Lods[0].FirstIndex;
+	size_t count = mesh.Lods.empty() ? mesh.Indices.size() : mesh.Lods[0].IndexCount;
+	const uint32_t* indices = mesh.Indices.data() + first;
+	const size_t triangleCount = count / 3;
+	const size_t vertexCount = mesh.Positions.size();
+	if (triangleCount == 0)
+		return;
+
+	// triangles around each vertex, and the unit normal of each triangle
+	std::vector<uint32_t> offsets(vertexCount + 1, 0), adjacency(triangleCount * 3);
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+		++offsets[indices[i] + 1];
+	for (size_t v = 0; v < vertexCount; ++v)
+		offsets[v + 1] += offsets[v];
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	std::vector<glm::vec3> normals(triangleCount);
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		for (int k = 0; k < 3; ++k)
+			adjacency[fill[indices[t * 3 + k]]++] = (uint32_t)t;
+		const glm::vec3& a = mesh.Positions[indices[t * 3]];
+		glm::vec3 normal = glm::cross(mesh.Positions[indices[t * 3 + 1]] - a, mesh.Positions[indices[t * 3 + 2]] - a);
+		float length = glm::length(normal);
+		normals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+	}
+
+	std::vector<uint32_t> ordered;
+	ordered.reserve(count);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> owner(vertexCount, UINT32_MAX);  // meshlet that last used each vertex
+	std::vector<uint32_t> vertices, triangles, candidates;
+
+	for (size_t seed = 0; seed < triangleCount; ++seed)
+	{
+		if (emitted[seed])
+			continue;
+
+		uint32_t id = (uint32_t)mesh.Meshlets.size();
+		vertices.clear();
+		triangles.clear();
+		candidates.clear();
+		glm::vec3 facing(0.0f);
+		auto add = [&](uint32_t t)
+		{
+			emitted[t] = true;
+			triangles.push_back(t);
+			facing += normals[t];
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t v = indices[t * 3 + k];
+				if (owner[v] == id)
+					continue;
+				owner[v] = id;
+				vertices.push_back(v);
+				for (uint32_t a = offsets[v]; a < offsets[v + 1]; ++a)
+					if (!emitted[adjacency[a]])
+						candidates.push_back(adjacency[a]);
+			}
+		};
+		add((uint32_t)seed);
+
+		while (triangles.size() < MESHLET_MAX_TRIANGLES)
+		{
+			float facingLength = glm::length(facing);
+			glm::vec3 axis = facingLength > 0.0f ? facing / facingLength : glm::vec3(0.0f);
+			int64_t best = -1;
+			float bestScore = 0.0f;
+			size_t live = 0;
+			for (uint32_t t : candidates)
+			{
+				if (emitted[t])
+					continue;
+				candidates[live++] = t;
+				unsigned extra = 0;
+				for (int k = 0; k < 3; ++k)
+					extra += owner[indices[t * 3 + k]] != id;
+				if (vertices.size() + extra > MESHLET_MAX_VERTICES)
+					continue;
+				float score = (float)extra + (1.0f - glm::dot(normals[t], axis)) * 0.5f;
+				if (best < 0 || score < bestScore)
+				{
+					best = t;
+					bestScore = score;
+				}
+			}
+			candidates.resize(live);
+			if (best < 0)
+				break;
+			add((uint32_t)best);
+		}
+
+		Meshlet meshlet;
+		meshlet.FirstIndex = (uint32_t)(first + ordered.size());
+		meshlet.IndexCount = (uint32_t)triangles.size() * 3;
+		for (uint32_t t : triangles)
+			ordered.insert(ordered.end(), indices + t * 3, indices + t * 3 + 3);
+
+		// bounding sphere around the center of the box
+		glm::vec3 lower = mesh.Positions[vertices[0]], upper = lower;
+		for (uint32_t v : vertices)
+		{
+			lower = glm::min(lower, mesh.Positions[v]);
+			upper = glm::max(upper, mesh.Positions[v]);
+		}
+		meshlet.Center = (lower + upper) * 0.5f;
+		meshlet.Radius = 0.0f;
+		for (uint32_t v : vertices)
+			meshlet.Radius = std::max(meshlet.Radius, glm::length(mesh.Positions[v] - meshlet.Center));
+
+		// the cone around the average normal that holds every triangle normal
+		float facingLength = glm::length(facing);
+		meshlet.ConeAxis = facingLength > 0.0f ? facing / facingLength : glm::vec3(0.0f, 0.0f, 1.0f);
+		float minDot = facingLength > 0.0f ? 1.0f : -1.0f;
+		for (uint32_t t : triangles)
+			if (glm::dot(normals[t], normals[t]) > 0.0f)
+				minDot = std::min(minDot, glm::dot(normals[t], meshlet.ConeAxis));
+		meshlet.ConeCutoff = minDot <= MESHLET_CONE_MIN_DOT ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+		mesh.Meshlets.push_back(meshlet);
+	}
+
+	std::copy(ordered.begin(), ordered.end(), mesh.Indices.begin() + first);
+}
+
+// True when the camera can't see the front of any triangle in the meshlet (so back-face culling would drop
+// them all). The test is on the bounding sphere, so it holds for every triangle, not just the cone apex.
+inline bool UMeshletFacesAway(const Meshlet& meshlet, const glm::vec3& camera)
+{
+	glm::vec3 toCenter = meshlet.Center - camera;
+	return glm::dot(toCenter, meshlet.ConeAxis) >= meshlet.ConeCutoff * glm::length(toCenter) + meshlet.Radius;
+}
+
+// Appends a draw command for each run of visible meshlets. frustum and camera are in the meshlets' model
+// space (so both tests stay exact under any model matrix). Returns how many indices the commands draw.
+inline size_t UCullMeshlets(const Meshlet* meshlets, size_t count, const Frustum& frustum, const glm::vec3& camera, GLuint baseInstance, std::vector<DrawElementsIndirectCommand>& commands)
+{
+	size_t drawn = 0;
+	bool extend = false; // the previous meshlet was visible, so a contiguous one joins its command
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Meshlet& meshlet = meshlets[i];
+		if (!frustum.IntersectsSphere(meshlet.Center, meshlet.Radius) || UMeshletFacesAway(meshlet, camera))
+		{
+			extend = false;
+			continue;
+		}
+		drawn += meshlet.IndexCount;
+		if (extend && commands.back().FirstIndex + commands.back().Count == meshlet.FirstIndex)
+			commands.back().Count += meshlet.IndexCount;
+		else
+			commands.push_back(DrawElementsIndirectCommand{ meshlet.IndexCount, 1, meshlet.FirstIndex, 0, baseInstance });
+		extend = true;
+	}
+	return drawn;
+}
+
+#endif
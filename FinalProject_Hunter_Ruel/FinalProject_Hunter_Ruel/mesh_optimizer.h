@@ -0,0 +1,308 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+#include "vertex_format.h"
+
+// Index buffer optimizations run once at import time, after deduplication and before packing:
+//   1. Tipsify (Sander, Nehab and Barczak 2007) reorders triangles for the post-transform vertex cache.
+//   2. The result is cut into clusters at cache-friendly points, and the clusters are sorted outside-in
+//      so front faces tend to be drawn before the faces they hide (less overdraw).
+//   3. Vertices are renumbered in the order the index buffer first uses them, so fetches walk memory forwards.
+
+#define MESH_OPTIMIZER_CACHE_SIZE 16        // FIFO entries assumed for both the optimizer and the statistics
+#define MESH_OPTIMIZER_OVERDRAW_THRESHOLD 1.05f // how much worse than the Tipsify order a cluster's ACMR may get
+
+// Post-transform cache behavior of an index buffer under a FIFO cache of MESH_OPTIMIZER_CACHE_SIZE
+struct VertexCacheStats
+{
+	float ACMR = 0.0f; // average cache misses per triangle: 0.5 is ideal for large regular meshes, 3 is no reuse
+	float ATVR = 0.0f; // misses per referenced vertex: 1 is ideal
+};
+
+// counts FIFO misses for the triangles in [first, last)
+class VertexCacheSimulator
+{
+public:
+	explicit VertexCacheSimulator(size_t vertexCount) : stamp(vertexCount, 0) {}
+
+	void Reset()
+	{
+		time += MESH_OPTIMIZER_CACHE_SIZE + 1; // everything currently cached falls out
+	}
+
+	// returns how many of the triangle's vertices missed
+	unsigned Triangle(const uint32_t* corners)
+	{
+		unsigned misses = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			// a vertex is in the FIFO when fewer than CACHE_SIZE misses happened since it was inserted
+			if (stamp[corners[k]] == 0 || time - stamp[corners[k]] >= MESH_OPTIMIZER_CACHE_SIZE)
+			{
+				stamp[corners[k]] = ++time;
+				++misses;
+			}
+		}
+		return misses;
+	}
+
+private:
+	std::vector<uint64_t> stamp;
+	uint64_t time = 0;
+};
+
+inline VertexCacheStats UAnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	VertexCacheStats stats;
+	size_t triangles = indices.size() / 3;
+	if (triangles == 0)
+		return stats;
+
+	VertexCacheSimulator cache(vertexCount);
+	std::vector<bool> used(vertexCount, false);
+	size_t misses = 0, referenced = 0;
+	for (size_t t = 0; t < triangles; ++t)
+	{
+		misses += cache.Triangle(&indices[t * 3]);
+		for (int k = 0; k < 3; ++k)
+			if (!used[indices[t * 3 + k]])
+			{
+				used[indices[t * 3 + k]] = true;
+				++referenced;
+			}
+	}
+	stats.ACMR = (float)misses / (float)triangles;
+	stats.ATVR = (float)misses / (float)referenced;
+	return stats;
+}
+
+// Tipsify. Writes the reordered triangles to output and the triangle offsets where the walk had to jump
+// to an unrelated part of the mesh (the natural cluster boundaries) to hardBoundaries.
+inline void UOptimizeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, std::vector<uint32_t>& output, std::vector<size_t>& hardBoundaries)
+{
+	const size_t triangleCount = indices.size() / 3;
+	const int cacheSize = MESH_OPTIMIZER_CACHE_SIZE;
+	output.clear();
+	output.reserve(triangleCount * 3);
+	hardBoundaries.clear();
+
+	// triangles around each vertex
+	std::vector<uint32_t> live(vertexCount, 0), offsets(vertexCount + 1, 0), adjacency(triangleCount * 3);
+	for (uint32_t index : indices)
+		++live[index];
+	for (size_t v = 0; v < vertexCount; ++v)
+		offsets[v + 1] = offsets[v] + live[v];
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; ++t)
+		for (int k = 0; k < 3; ++k)
+			adjacency[fill[indices[t * 3 + k]]++] = (uint32_t)t;
+
+	std::vector<int64_t> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd, candidates;
+	int64_t now = cacheSize + 1;
+	size_t cursor = 0;   // scan position for the next vertex with live triangles
+	int64_t fan = -1;
+
+	auto nextFan = [&]() -> int64_t
+	{
+		// prefer a candidate that is still cached and will stay cached while its triangles are emitted
+		int64_t best = -1, bestPriority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (live[v] == 0)
+				continue;
+			int64_t priority = 0;
+			if (now - cacheTime[v] + 2 * (int64_t)live[v] <= cacheSize)
+				priority = now - cacheTime[v];
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				best = v;
+			}
+		}
+		if (best >= 0)
+			return best;
+
+		// dead end: recently emitted vertices first, then the next untouched one
+		while (!deadEnd.empty())
+		{
+			uint32_t v = deadEnd.back();
+			deadEnd.pop_back();
+			if (live[v] > 0)
+				return v;
+		}
+		while (cursor < vertexCount)
+		{
+			if (live[cursor] > 0)
+			{
+				hardBoundaries.push_back(output.size() / 3);
+				return (int64_t)cursor++;
+			}
+			++cursor;
+		}
+		return -1;
+	};
+
+	while ((fan = nextFan()) >= 0)
+	{
+		candidates.clear();
+		for (uint32_t a = offsets[(size_t)fan]; a < offsets[(size_t)fan + 1]; ++a)
+		{
+			uint32_t t = adjacency[a];
+			if (emitted[t])
+				continue;
+			emitted[t] = true;
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t v = indices[t * 3 + k];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (now - cacheTime[v] > cacheSize)
+					cacheTime[v] = now++;
+			}
+		}
+	}
+	if (hardBoundaries.empty() || hardBoundaries[0] != 0)
+		hardBoundaries.insert(hardBoundaries.begin(), 0);
+}
+
+// Cuts the Tipsify order into clusters and sorts them so that the ones facing away from the mesh center
+// (which occlude the rest from most directions) are drawn first. A cluster ends wherever the order so far
+// is within MESH_OPTIMIZER_OVERDRAW_THRESHOLD of the cache efficiency of its whole hard cluster, so the
+// cache cost of reordering stays bounded.
+inline void UOptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions, const std::vector<size_t>& hardBoundaries)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	VertexCacheSimulator cache(positions.size());
+	std::vector<size_t> clusters;
+	for (size_t h = 0; h < hardBoundaries.size(); ++h)
+	{
+		size_t first = hardBoundaries[h];
+		size_t last = h + 1 < hardBoundaries.size() ? hardBoundaries[h + 1] : triangleCount;
+
+		cache.Reset();
+		size_t misses = 0;
+		for (size_t t = first; t < last; ++t)
+			misses += cache.Triangle(&indices[t * 3]);
+		float target = MESH_OPTIMIZER_OVERDRAW_THRESHOLD * (float)misses / (float)(last - first);
+
+		cache.Reset();
+		clusters.push_back(first);
+		size_t start = first;
+		misses = 0;
+		for (size_t t = first; t < last; ++t)
+		{
+			misses += cache.Triangle(&indices[t * 3]);
+			if (t + 1 < last && (float)misses <= target * (float)(t + 1 - start))
+			{
+				clusters.push_back(t + 1);
+				start = t + 1;
+				misses = 0;
+				cache.Reset();
+			}
+		}
+	}
+	clusters.push_back(triangleCount);
+
+	// area-weighted centroid and normal of each cluster
+	glm::vec3 meshCenter(0.0f);
+	float meshArea = 0.0f;
+	size_t clusterCount = clusters.size() - 1;
+	std::vector<glm::vec3> centers(clusterCount, glm::vec3(0.0f)), normals(clusterCount, glm::vec3(0.0f));
+	std::vector<float> areas(clusterCount, 0.0f);
+	for (size_t c = 0; c < clusterCount; ++c)
+	{
+		for (size_t t = clusters[c]; t < clusters[c + 1]; ++t)
+		{
+			const glm::vec3& a = positions[indices[t * 3]];
+			const glm::vec3& b = positions[indices[t * 3 + 1]];
+			const glm::vec3& d = positions[indices[t * 3 + 2]];
+			glm::vec3 normal = glm::cross(b - a, d - a);
+			float area = glm::length(normal);
+			centers[c] += (a + b + d) * (area / 3.0f);
+			normals[c] += normal;
+			areas[c] += area;
+		}
+		meshCenter += centers[c];
+		meshArea += areas[c];
+	}
+	if (meshArea > 0.0f)
+		meshCenter /= meshArea;
+
+	std::vector<float> sortKey(clusterCount, 0.0f);
+	for (size_t c = 0; c < clusterCount; ++c)
+	{
+		float normalLength = glm::length(normals[c]);
+		if (areas[c] > 0.0f && normalLength > 0.0f)
+			sortKey[c] = glm::dot(centers[c] / areas[c] - meshCenter, normals[c] / normalLength);
+	}
+	std::vector<size_t> order(clusterCount);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(indices.size());
+	for (size_t c : order)
+		sorted.insert(sorted.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+	indices.swap(sorted);
+}
+
+// Renumbers vertices in order of first use and drops unreferenced ones
+inline void UOptimizeVertexFetch(MeshData& mesh)
+{
+	const uint32_t unused = UINT32_MAX;
+	std::vector<uint32_t> remap(mesh.Positions.size(), unused);
+	uint32_t next = 0;
+	for (uint32_t& index : mesh.Indices)
+	{
+		if (remap[index] == unused)
+			remap[index] = next++;
+		index = remap[index];
+	}
+
+	auto reorder = [&](auto& attribute)
+	{
+		if (attribute.size() != remap.size())
+			return;
+		typename std::remove_reference<decltype(attribute)>::type moved(next);
+		for (size_t v = 0; v < remap.size(); ++v)
+			if (remap[v] != unused)
+				moved[remap[v]] = attribute[v];
+		attribute.swap(moved);
+	};
+	reorder(mesh.Colors);
+	reorder(mesh.TexCoords);
+	reorder(mesh.Normals);
+	reorder(mesh.Positions);
+}
+
+// Runs all three passes. before and after, when given, receive the cache statistics of the two orders.
+inline void UOptimizeMesh(MeshData& mesh, VertexCacheStats* before = nullptr, VertexCacheStats* after = nullptr)
+{
+	if (before)
+		*before = UAnalyzeVertexCache(mesh.Indices, mesh.Positions.size());
+
+	std::vector<uint32_t> optimized;
+	std::vector<size_t> hardBoundaries;
+	UOptimizeVertexCache(mesh.Indices, mesh.Positions.size(), optimized, hardBoundaries);
+	UOptimizeOverdraw(optimized, mesh.Positions, hardBoundaries);
+	mesh.Indices.swap(optimized);
+	UOptimizeVertexFetch(mesh);
+
+	if (after)
+		*after = UAnalyzeVertexCache(mesh.Indices, mesh.Positions.size());
+}
+
+#endif
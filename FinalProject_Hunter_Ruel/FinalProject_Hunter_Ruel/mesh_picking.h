@@ -0,0 +1,163 @@
+#ifndef MESH_PICKING_H
+#define MESH_PICKING_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "scene_bvh.h"
+#include "vertex_format.h"
+
+// Picking by ray casting on the CPU: no ID buffer, no GPU readback. Each mesh keeps its LOD 0 triangles in a
+// BVH of their own, in the packed (quantized) position space, and a pick walks the scene BVH to the objects
+// along the ray and then each object's triangle BVH, both nearest first, so most of the scene is never touched.
+
+// LOD 0 of a mesh as the CPU sees it
+struct PickMesh
+{
+	std::vector<glm::vec3> Positions; // packed positions; the mesh's dequantize matrix maps them to model space
+	std::vector<uint32_t> Indices;
+	uint32_t FirstTriangle = 0;       // triangle number of Indices[0] in the mesh's index buffer
+	SceneBvh Triangles;               // item i is the triangle at Indices[3 * i]
+};
+
+struct PickHit
+{
+	bool Hit = false;
+	uint32_t Object = 0;     // scene BVH item
+	uint32_t Triangle = 0;   // triangle number in the object's index buffer
+	float Distance = 0.0f;   // along the ray, in multiples of its direction
+	glm::vec3 Point = glm::vec3(0.0f);
+};
+
+// Fills a pick mesh from packed vertices and an index range (the same data the GPU buffers are made from, so
+// meshes loaded from the cache pick exactly like freshly imported ones). False when there are no positions or
+// an index is out of range.
+inline bool UBuildPickMesh(const unsigned char* vertices, size_t vertexCount, GLsizei stride, const VertexAttribute* attributes, size_t attributeCount,
+	const unsigned char* indices, GLenum indexType, uint32_t firstIndex, uint32_t indexCount, PickMesh& pick)
+{
+	const VertexAttribute* position = nullptr;
+	for (size_t i = 0; i < attributeCount; ++i)
+		if (attributes[i].Location == ATTRIBUTE_POSITION && attributes[i].Components == 3)
+			position = &attributes[i];
+	if (!position || (position->Type != GL_FLOAT && position->Type != GL_SHORT))
+		return false;
+
+	pick.Positions.resize(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		const unsigned char* source = vertices + v * stride + position->Offset;
+		if (position->Type == GL_FLOAT)
+			memcpy(&pick.Positions[v].x, source, 12);
+		else
+		{
+			int16_t q[3];
+			memcpy(q, source, sizeof(q));
+			for (int k = 0; k < 3; ++k)
+				pick.Positions[v][k] = std::max(q[k] / 32767.0f, -1.0f);
+		}
+	}
+
+	pick.Indices.resize(indexCount);
+	for (uint32_t i = 0; i < indexCount; ++i)
+	{
+		if (indexType == GL_UNSIGNED_INT)
+			memcpy(&pick.Indices[i], indices + (size_t)(firstIndex + i) * 4, 4);
+		else
+		{
+			uint16_t index;
+			memcpy(&index, indices + (size_t)(firstIndex + i) * 2, 2);
+			pick.Indices[i] = index;
+		}
+		if (pick.Indices[i] >= vertexCount)
+			return false;
+	}
+	pick.FirstTriangle = firstIndex / 3;
+
+	std::vector<BvhBounds> bounds(indexCount / 3);
+	for (size_t t = 0; t < bounds.size(); ++t)
+		for (int k = 0; k < 3; ++k)
+		{
+			const glm::vec3& p = pick.Positions[pick.Indices[t * 3 + k]];
+			bounds[t].Lower = glm::min(bounds[t].Lower, p);
+			bounds[t].Upper = glm::max(bounds[t].Upper, p);
+		}
+	pick.Triangles.Build(bounds);
+	return true;
+}
+
+// The ray under a cursor position (pixels from the top left of a width x height window), from the near plane
+// toward the far plane; direction spans the whole depth range. Works for perspective and ortho projections.
+inline void UCursorRay(double x, double y, int width, int height, const glm::mat4& viewProjection, glm::vec3& origin, glm::vec3& direction)
+{
+	glm::mat4 worldFromClip = glm::inverse(viewProjection);
+	float ndcX = (float)(2.0 * x / width - 1.0), ndcY = (float)(1.0 - 2.0 * y / height);
+	glm::vec4 nearPoint = worldFromClip * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+	glm::vec4 farPoint = worldFromClip * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+	origin = glm::vec3(nearPoint) / nearPoint.w;
+	direction = glm::vec3(farPoint) / farPoint.w - origin;
+}
+
+// Moller-Trumbore, two-sided. distance is in multiples of direction.
+inline bool URayHitsTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& distance)
+{
+	glm::vec3 ab = b - a, ac = c - a;
+	glm::vec3 p = glm::cross(direction, ac);
+	float determinant = glm::dot(ab, p);
+	if (std::fabs(determinant) < 1e-12f)
+		return false;
+	float inverse = 1.0f / determinant;
+	glm::vec3 toOrigin = origin - a;
+	float u = glm::dot(toOrigin, p) * inverse;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	glm::vec3 q = glm::cross(toOrigin, ab);
+	float v = glm::dot(direction, q) * inverse;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	distance = glm::dot(ac, q) * inverse;
+	return distance >= 0.0f;
+}
+
+// Nearest triangle along the ray among the scene's objects. objectAt(item, worldFromMesh) returns the pick
+// mesh of a scene BVH item and sets the matrix from its packed positions to world space (nullptr skips it).
+// The ray goes into each mesh's space unnormalized, so distances stay comparable across objects.
+template <typename ObjectAt>
+inline PickHit UPickScene(const SceneBvh& scene, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, ObjectAt&& objectAt)
+{
+	PickHit hit;
+	scene.Raycast(origin, direction, maxDistance, [&](uint32_t item, float& closest)
+	{
+		glm::mat4 worldFromMesh;
+		const PickMesh* mesh = objectAt(item, worldFromMesh);
+		if (!mesh)
+			return;
+		glm::mat4 meshFromWorld = glm::inverse(worldFromMesh);
+		glm::vec3 meshOrigin = glm::vec3(meshFromWorld * glm::vec4(origin, 1.0f));
+		glm::vec3 meshDirection = glm::vec3(meshFromWorld * glm::vec4(direction, 0.0f));
+		mesh->Triangles.Raycast(meshOrigin, meshDirection, closest, [&](uint32_t triangle, float& meshClosest)
+		{
+			const uint32_t* corners = mesh->Indices.data() + triangle * 3;
+			float distance;
+			if (URayHitsTriangle(meshOrigin, meshDirection, mesh->Positions[corners[0]], mesh->Positions[corners[1]], mesh->Positions[corners[2]], distance) && distance < meshClosest)
+			{
+				meshClosest = closest = distance;
+				hit.Hit = true;
+				hit.Object = item;
+				hit.Triangle = mesh->FirstTriangle + triangle;
+				hit.Distance = distance;
+			}
+		});
+	});
+	if (hit.Hit)
+		hit.Point = origin + direction * hit.Distance;
+	return hit;
+}
+
+#endif
@@ -0,0 +1,327 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "thread_pool.h"
+
+// Software occlusion culling. A few large occluders are rasterized on the CPU into a small masked depth
+// buffer (after Andersson et al., "Masked Software Occlusion Culling"): the screen is split into 8x4 pixel
+// tiles and each tile keeps one coverage bit per pixel plus two depths instead of a depth per pixel. ZMax0 is
+// the farthest depth of everything that fully covers the tile, ZMax1 the farthest depth of the partly
+// covering triangles whose pixels are in Mask; once Mask fills, ZMax1 becomes the tile's new ZMax0. The
+// tiles are therefore themselves the coarse level of a depth hierarchy, and a bounding box is occluded when
+// its nearest depth is behind ZMax0 in every tile it touches.
+//
+// Rasterization is split into horizontal bands of tiles that worker threads fill independently, and inside a
+// tile the coverage of a row of 8 pixels is one AVX2 instruction per edge (scalar when AVX2 isn't enabled).
+// Depths are NDC z mapped to [0, 1], which is linear in screen space under both perspective and ortho.
+
+#define OCCLUSION_TILE_WIDTH 8
+#define OCCLUSION_TILE_HEIGHT 4
+#define OCCLUSION_BAND_TILE_ROWS 4   // tile rows per rasterization job
+
+struct OcclusionStats
+{
+	uint64_t OccluderTriangles = 0;  // after clipping, this frame
+	uint64_t Tested = 0;             // boxes tested this frame
+	uint64_t Occluded = 0;           // of those, the ones found hidden
+	double RasterMilliseconds = 0.0; // last Rasterize()
+};
+
+class OcclusionBuffer
+{
+public:
+	// width is rounded up to whole tiles
+	void Create(int width, int height)
+	{
+		tilesX = (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+		tilesY = (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT;
+		this->width = (float)(tilesX * OCCLUSION_TILE_WIDTH);
+		this->height = (float)(tilesY * OCCLUSION_TILE_HEIGHT);
+		masks.assign((size_t)tilesX * tilesY, 0);
+		zMax0.assign(masks.size(), 1.0f);
+		zMax1.assign(masks.size(), 0.0f);
+		bins.assign((tilesY + OCCLUSION_BAND_TILE_ROWS - 1) / OCCLUSION_BAND_TILE_ROWS, std::vector<uint32_t>());
+	}
+
+	// empties the buffer and drops last frame's occluders
+	void Begin()
+	{
+		triangles.clear();
+		for (std::vector<uint32_t>& bin : bins)
+			bin.clear();
+		std::fill(masks.begin(), masks.end(), 0u);
+		std::fill(zMax0.begin(), zMax0.end(), 1.0f);
+		std::fill(zMax1.begin(), zMax1.end(), 0.0f);
+		stats.OccluderTriangles = 0;
+		stats.Tested = 0;
+		stats.Occluded = 0;
+	}
+
+	// Clips an occluder's triangles to the view volume and bins them by band. Occluders must be opaque (every
+	// pixel they cover hides what is behind it) and are rasterized two-sided.
+	void AddOccluder(const glm::vec3* positions, const uint32_t* indices, size_t indexCount, const glm::mat4& clipFromModel)
+	{
+		glm::vec4 polygon[9], scratch[9];
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+				polygon[k] = clipFromModel * glm::vec4(positions[indices[i + k]], 1.0f);
+			int count = clip(polygon, scratch);
+			for (int k = 2; k < count; ++k)
+				setupTriangle(polygon[0], polygon[k - 1], polygon[k]);
+		}
+	}
+
+	// Rasterizes every occluder added since Begin(), one band of tiles per job on the shared thread pool
+	void Rasterize()
+	{
+		auto start = std::chrono::steady_clock::now();
+		GetSharedThreadPool().ParallelFor(bins.size(), [this](size_t band) { rasterizeBand((int)band); });
+		stats.RasterMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// True when the box [-1, 1]^3 under clipFromBox is hidden behind the occluders. Boxes that cross the near
+	// plane or leave the screen entirely are reported visible; the frustum test deals with the latter.
+	bool IsBoxOccluded(const glm::mat4& clipFromBox)
+	{
+		++stats.Tested;
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = 1.0f;
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			glm::vec4 clip = clipFromBox * glm::vec4(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f, 1.0f);
+			if (clip.w <= 0.0f || clip.z < -clip.w)
+				return false;
+			glm::vec3 screen = toScreen(clip);
+			minX = std::min(minX, screen.x);
+			maxX = std::max(maxX, screen.x);
+			minY = std::min(minY, screen.y);
+			maxY = std::max(maxY, screen.y);
+			nearest = std::min(nearest, screen.z);
+		}
+		if (maxX < 0.0f || maxY < 0.0f || minX > width || minY > height)
+			return false;
+
+		int x0 = std::max(0, (int)std::floor(minX) / OCCLUSION_TILE_WIDTH), x1 = std::min(tilesX - 1, (int)std::floor(maxX) / OCCLUSION_TILE_WIDTH);
+		int y0 = std::max(0, (int)std::floor(minY) / OCCLUSION_TILE_HEIGHT), y1 = std::min(tilesY - 1, (int)std::floor(maxY) / OCCLUSION_TILE_HEIGHT);
+		for (int ty = y0; ty <= y1; ++ty)
+		{
+			const float* row = zMax0.data() + (size_t)ty * tilesX;
+			int tx = x0;
+#if defined(__AVX2__)
+			__m256 depth = _mm256_set1_ps(nearest);
+			for (; tx + 8 <= x1 + 1; tx += 8)
+				if (_mm256_movemask_ps(_mm256_cmp_ps(depth, _mm256_loadu_ps(row + tx), _CMP_LE_OQ)) != 0)
+					return false;
+#endif
+			for (; tx <= x1; ++tx)
+				if (nearest <= row[tx])
+					return false;
+		}
+		++stats.Occluded;
+		return true;
+	}
+
+	int TilesX() const
+	{
+		return tilesX;
+	}
+
+	int TilesY() const
+	{
+		return tilesY;
+	}
+
+	// the committed (fully covered) depth of a tile, 1 where nothing covers it yet
+	float TileDepth(int tx, int ty) const
+	{
+		return zMax0[(size_t)ty * tilesX + tx];
+	}
+
+	const OcclusionStats& Stats() const
+	{
+		return stats;
+	}
+
+private:
+	// screen-space edge functions (inside where all three are positive at a pixel center) and depth plane
+	struct Triangle
+	{
+		float EdgeA[3], EdgeB[3], EdgeC[3];
+		float DepthA, DepthB, DepthC, DepthMax;
+		int TileX0, TileX1, TileY0, TileY1;
+	};
+
+	int tilesX = 0, tilesY = 0;
+	float width = 0.0f, height = 0.0f;
+	std::vector<uint32_t> masks;
+	std::vector<float> zMax0, zMax1;
+	std::vector<Triangle> triangles;
+	std::vector<std::vector<uint32_t>> bins; // triangles touching each band
+	OcclusionStats stats;
+
+	glm::vec3 toScreen(const glm::vec4& clip) const
+	{
+		float inverseW = 1.0f / clip.w;
+		return glm::vec3((clip.x * inverseW * 0.5f + 0.5f) * width, (clip.y * inverseW * 0.5f + 0.5f) * height, clip.z * inverseW * 0.5f + 0.5f);
+	}
+
+	// Sutherland-Hodgman against the six clip planes; the triangle in polygon[0..2] becomes a convex polygon
+	// of up to 9 vertices. Returns the vertex count (below 3 when nothing is left).
+	static int clip(glm::vec4* polygon, glm::vec4* scratch)
+	{
+		static const glm::vec4 planes[6] = { glm::vec4(1, 0, 0, 1), glm::vec4(-1, 0, 0, 1), glm::vec4(0, 1, 0, 1),
+			glm::vec4(0, -1, 0, 1), glm::vec4(0, 0, 1, 1), glm::vec4(0, 0, -1, 1) };
+		int count = 3;
+		for (const glm::vec4& plane : planes)
+		{
+			int kept = 0;
+			for (int i = 0; i < count; ++i)
+			{
+				const glm::vec4& a = polygon[i];
+				const glm::vec4& b = polygon[(i + 1) % count];
+				float da = glm::dot(plane, a), db = glm::dot(plane, b);
+				if (da >= 0.0f)
+					scratch[kept++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+					scratch[kept++] = a + (b - a) * (da / (da - db));
+			}
+			count = kept;
+			std::copy(scratch, scratch + count, polygon);
+			if (count < 3)
+				return count;
+		}
+		return count;
+	}
+
+	void setupTriangle(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2)
+	{
+		glm::vec3 v[3] = { toScreen(c0), toScreen(c1), toScreen(c2) };
+		float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+		if (std::fabs(area) < 1e-6f)
+			return;
+		if (area < 0.0f)
+		{
+			std::swap(v[1], v[2]);
+			area = -area;
+		}
+
+		Triangle triangle;
+		for (int e = 0; e < 3; ++e)
+		{
+			const glm::vec3& a = v[e];
+			const glm::vec3& b = v[(e + 1) % 3];
+			triangle.EdgeA[e] = a.y - b.y;
+			triangle.EdgeB[e] = b.x - a.x;
+			triangle.EdgeC[e] = -triangle.EdgeA[e] * a.x - triangle.EdgeB[e] * a.y;
+		}
+		float d1 = v[1].z - v[0].z, d2 = v[2].z - v[0].z;
+		triangle.DepthA = (d1 * (v[2].y - v[0].y) - d2 * (v[1].y - v[0].y)) / area;
+		triangle.DepthB = (d2 * (v[1].x - v[0].x) - d1 * (v[2].x - v[0].x)) / area;
+		triangle.DepthC = v[0].z - triangle.DepthA * v[0].x - triangle.DepthB * v[0].y;
+		triangle.DepthMax = std::max(v[0].z, std::max(v[1].z, v[2].z));
+
+		float minX = std::min(v[0].x, std::min(v[1].x, v[2].x)), maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+		float minY = std::min(v[0].y, std::min(v[1].y, v[2].y)), maxY = std::max(v[0].y, std::max(v[1].y, v[2].y));
+		triangle.TileX0 = std::max(0, (int)minX / OCCLUSION_TILE_WIDTH);
+		triangle.TileX1 = std::min(tilesX - 1, (int)maxX / OCCLUSION_TILE_WIDTH);
+		triangle.TileY0 = std::max(0, (int)minY / OCCLUSION_TILE_HEIGHT);
+		triangle.TileY1 = std::min(tilesY - 1, (int)maxY / OCCLUSION_TILE_HEIGHT);
+
+		uint32_t id = (uint32_t)triangles.size();
+		triangles.push_back(triangle);
+		++stats.OccluderTriangles;
+		for (int band = triangle.TileY0 / OCCLUSION_BAND_TILE_ROWS; band <= triangle.TileY1 / OCCLUSION_BAND_TILE_ROWS; ++band)
+			bins[band].push_back(id);
+	}
+
+	// one bit per pixel of the tile, row by row from the bottom, for the pixel centers inside the triangle
+	static uint32_t coverage(const Triangle& triangle, float x, float y)
+	{
+		uint32_t mask = 0;
+#if defined(__AVX2__)
+		const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+		__m256 edge[3], step[3];
+		for (int e = 0; e < 3; ++e)
+		{
+			float start = triangle.EdgeA[e] * (x + 0.5f) + triangle.EdgeB[e] * (y + 0.5f) + triangle.EdgeC[e];
+			edge[e] = _mm256_add_ps(_mm256_set1_ps(start), _mm256_mul_ps(_mm256_set1_ps(triangle.EdgeA[e]), lanes));
+			step[e] = _mm256_set1_ps(triangle.EdgeB[e]);
+		}
+		const __m256 zero = _mm256_setzero_ps();
+		for (int row = 0; row < OCCLUSION_TILE_HEIGHT; ++row)
+		{
+			__m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(edge[0], zero, _CMP_GT_OQ), _mm256_cmp_ps(edge[1], zero, _CMP_GT_OQ)), _mm256_cmp_ps(edge[2], zero, _CMP_GT_OQ));
+			mask |= (uint32_t)_mm256_movemask_ps(inside) << (row * OCCLUSION_TILE_WIDTH);
+			for (int e = 0; e < 3; ++e)
+				edge[e] = _mm256_add_ps(edge[e], step[e]);
+		}
+#else
+		for (int row = 0; row < OCCLUSION_TILE_HEIGHT; ++row)
+			for (int column = 0; column < OCCLUSION_TILE_WIDTH; ++column)
+			{
+				float px = x + column + 0.5f, py = y + row + 0.5f;
+				bool inside = true;
+				for (int e = 0; e < 3; ++e)
+					inside = inside && triangle.EdgeA[e] * px + triangle.EdgeB[e] * py + triangle.EdgeC[e] > 0.0f;
+				mask |= (uint32_t)inside << (row * OCCLUSION_TILE_WIDTH + column);
+			}
+#endif
+		return mask;
+	}
+
+	void rasterizeBand(int band)
+	{
+		int bandY0 = band * OCCLUSION_BAND_TILE_ROWS, bandY1 = std::min(tilesY - 1, bandY0 + OCCLUSION_BAND_TILE_ROWS - 1);
+		for (uint32_t id : bins[band])
+		{
+			const Triangle& triangle = triangles[id];
+			for (int ty = std::max(bandY0, triangle.TileY0); ty <= std::min(bandY1, triangle.TileY1); ++ty)
+				for (int tx = triangle.TileX0; tx <= triangle.TileX1; ++tx)
+				{
+					float x = (float)(tx * OCCLUSION_TILE_WIDTH), y = (float)(ty * OCCLUSION_TILE_HEIGHT);
+					uint32_t mask = coverage(triangle, x, y);
+					if (mask == 0)
+						continue;
+					// the plane's farthest point over the tile, never past the triangle's own farthest vertex
+					float depth = triangle.DepthC + triangle.DepthA * (triangle.DepthA > 0.0f ? x + OCCLUSION_TILE_WIDTH : x) + triangle.DepthB * (triangle.DepthB > 0.0f ? y + OCCLUSION_TILE_HEIGHT : y);
+					updateTile((size_t)ty * tilesX + tx, mask, std::min(depth, triangle.DepthMax));
+				}
+		}
+	}
+
+	void updateTile(size_t tile, uint32_t mask, float depth)
+	{
+		// everything the triangle covers is already known to be nearer than its depth
+		if (depth >= zMax0[tile])
+			return;
+		// a triangle far in front of the working layer starts a new one rather than dragging its depth back
+		if (masks[tile] != 0 && zMax1[tile] - depth > zMax0[tile] - zMax1[tile])
+		{
+			masks[tile] = 0;
+			zMax1[tile] = 0.0f;
+		}
+		masks[tile] |= mask;
+		zMax1[tile] = std::max(zMax1[tile], depth);
+		if (masks[tile] == UINT32_MAX)
+		{
+			zMax0[tile] = zMax1[tile];
+			masks[tile] = 0;
+			zMax1[tile] = 0.0f;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include "gl_state.h"
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Streaming buffer for per-frame data (draw commands, instance transforms, dynamic vertices). One buffer is
+// mapped once, persistently and coherently, and split into RING_BUFFER_FRAMES regions. A frame bump-allocates
+// out of its own region while the GPU still reads the regions of the frames before it, and a fence per region
+// makes sure the CPU only reuses a region once the GPU is done with it. Nothing is orphaned or re-mapped, so
+// the driver never has to shadow-copy the buffer or synchronize behind the application's back.
+
+#define RING_BUFFER_FRAMES 3
+
+// Where an allocation landed. Pointer is write-only memory; it stays valid until the frame comes around again.
+struct RingAllocation
+{
+	void* Pointer = nullptr;   // nullptr when the frame's region is full
+	GLintptr Offset = 0;       // byte offset in the buffer, for glBindBufferRange and indirect/attribute offsets
+};
+
+struct RingBufferStats
+{
+	uint64_t Frames = 0;
+	uint64_t Stalls = 0;             // frames that had to wait for the GPU to release their region
+	double StallMilliseconds = 0.0;  // total time spent in those waits
+	double LastStallMilliseconds = 0.0;
+	uint64_t Overflows = 0;          // allocations that didn't fit their frame's region
+	size_t PeakBytes = 0;            // most bytes any frame used
+};
+
+// Owns a GL buffer: call Destroy() while the context is still current, as with the other GL objects. Its
+// binds and deletes go through the state cache, so a regrown buffer that gets the old name back isn't mistaken
+// for the one that is still recorded as bound.
+class RingBuffer
+{
+public:
+	// frameBytes is the size of one frame's region; the buffer is RING_BUFFER_FRAMES times that
+	bool Create(size_t frameBytes, GLStateCache& state)
+	{
+		Destroy(state);
+		regionBytes = frameBytes;
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &buffer);
+		state.BindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, regionBytes * RING_BUFFER_FRAMES, NULL, flags);
+		mapping = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionBytes * RING_BUFFER_FRAMES, flags);
+		state.BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		if (!mapping)
+		{
+			Destroy(state);
+			return false;
+		}
+		return true;
+	}
+
+	void Destroy(GLStateCache& state)
+	{
+		if (!buffer)
+			return;
+		for (GLsync& fence : fences)
+		{
+			if (fence)
+				glDeleteSync(fence);
+			fence = 0;
+		}
+		state.BindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		state.BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		state.DeleteBuffers(1, &buffer);
+		buffer = 0;
+		mapping = nullptr;
+	}
+
+	// Moves to the next region, waiting for the GPU if it is still reading it. If the last frame overflowed,
+	// the whole ring is first recreated at twice the size (after the GPU drains it).
+	void BeginFrame(GLStateCache& state)
+	{
+		if (overflowed && buffer)
+		{
+			overflowed = false;
+			for (int i = 0; i < RING_BUFFER_FRAMES; ++i)
+				wait(fences[i]);
+			size_t frameBytes = regionBytes * 2;
+			Create(frameBytes, state);
+			frame = 0;
+		}
+		else
+			frame = (frame + 1) % RING_BUFFER_FRAMES;
+
+		wait(fences[frame]);
+		head = 0;
+		++stats.Frames;
+	}
+
+	// fences the region once every command reading it has been issued; call before swapping buffers
+	void EndFrame()
+	{
+		if (!buffer)
+			return;
+		fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// bump-allocates bytes at a multiple of alignment (a power of two) within this frame's region
+	RingAllocation Allocate(size_t bytes, size_t alignment = 16)
+	{
+		RingAllocation allocation;
+		size_t offset = (head + alignment - 1) & ~(alignment - 1);
+		if (!mapping || offset + bytes > regionBytes)
+		{
+			++stats.Overflows;
+			overflowed = true;
+			return allocation;
+		}
+		head = offset + bytes;
+		if (head > stats.PeakBytes)
+			stats.PeakBytes = head;
+		allocation.Offset = (GLintptr)(frame * regionBytes + offset);
+		allocation.Pointer = mapping + allocation.Offset;
+		return allocation;
+	}
+
+	GLuint Buffer() const
+	{
+		return buffer;
+	}
+
+	size_t FrameBytes() const
+	{
+		return regionBytes;
+	}
+
+	const RingBufferStats& Stats() const
+	{
+		return stats;
+	}
+
+private:
+	GLuint buffer = 0;
+	unsigned char* mapping = nullptr;
+	size_t regionBytes = 0;
+	size_t head = 0;
+	int frame = 0;
+	bool overflowed = false;
+	GLsync fences[RING_BUFFER_FRAMES] = {};
+	RingBufferStats stats;
+
+	// waits for and releases a region's fence, counting it as a stall when the GPU wasn't done yet
+	void wait(GLsync& fence)
+	{
+		if (!fence)
+			return;
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+		{
+			auto start = std::chrono::steady_clock::now();
+			do
+				result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); // 1 s per try
+			while (result == GL_TIMEOUT_EXPIRED);
+			stats.LastStallMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			stats.StallMilliseconds += stats.LastStallMilliseconds;
+			++stats.Stalls;
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+};
+
+#endif
@@ -0,0 +1,564 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SCENE_BVH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+#include "thread_pool.h"
+
+// Bounding volume hierarchy over boxes: the world-space bounds of the scene's objects, or the triangles of a
+// mesh for picking. It is built top-down with the
+// binned surface area heuristic (large subtrees on the shared thread pool), then collapsed into nodes of four
+// children stored structure-of-arrays, so one SSE instruction tests a ray, plane or box against all four child
+// boxes at once. Objects that move keep their place in the tree: SetItemBounds() then Refit() only re-grows
+// the boxes, which is enough until the tree has drifted far enough from the scene to be worth rebuilding.
+
+#define SCENE_BVH_BINS 16            // candidate split planes per axis
+#define SCENE_BVH_LEAF_ITEMS 2       // ranges this small always become leaves
+#define SCENE_BVH_MAX_LEAF_ITEMS 8   // larger ranges are always split
+#define SCENE_BVH_PARALLEL_ITEMS 1024 // subtrees at least this big build their halves in parallel
+#define SCENE_BVH_MAX_DEPTH 48       // past this the build splits at the median, which bounds the query stack
+#define SCENE_BVH_STACK_SIZE (3 * (SCENE_BVH_MAX_DEPTH + 32) + 1) // median splits add at most 32 levels
+
+struct BvhBounds
+{
+	glm::vec3 Lower = glm::vec3(FLT_MAX);
+	glm::vec3 Upper = glm::vec3(-FLT_MAX);
+
+	void Grow(const BvhBounds& other)
+	{
+		Lower = glm::min(Lower, other.Lower);
+		Upper = glm::max(Upper, other.Upper);
+	}
+
+	float HalfArea() const
+	{
+		glm::vec3 size = glm::max(Upper - Lower, glm::vec3(0.0f));
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+};
+
+// The world box around the box [lower, upper] under a model matrix (Arvo's method, exact for any affine matrix)
+inline BvhBounds UTransformBounds(const glm::mat4& model, const glm::vec3& lower, const glm::vec3& upper)
+{
+	BvhBounds bounds;
+	bounds.Lower = bounds.Upper = glm::vec3(model[3]);
+	for (int column = 0; column < 3; ++column)
+		for (int row = 0; row < 3; ++row)
+		{
+			float a = model[column][row] * lower[column], b = model[column][row] * upper[column];
+			bounds.Lower[row] += std::min(a, b);
+			bounds.Upper[row] += std::max(a, b);
+		}
+	return bounds;
+}
+
+// Four child boxes. A lane with Count 0 is an inner node at nodes[Child]; otherwise it is a leaf holding the
+// items at items[Child, Child + Count). Lanes past LaneCount are empty.
+struct BvhNode4
+{
+	float LowerX[4], LowerY[4], LowerZ[4];
+	float UpperX[4], UpperY[4], UpperZ[4];
+	uint32_t Child[4];
+	uint32_t Count[4];
+	uint32_t LaneCount;
+};
+
+class SceneBvh
+{
+public:
+	// Builds the tree over one box per item; items are identified by their index in bounds
+	void Build(const std::vector<BvhBounds>& bounds)
+	{
+		itemBounds = bounds;
+		nodes.clear();
+		items.resize(bounds.size());
+		for (size_t i = 0; i < items.size(); ++i)
+			items[i] = (uint32_t)i;
+		if (items.empty())
+			return;
+
+		centroids.resize(bounds.size());
+		for (size_t i = 0; i < bounds.size(); ++i)
+			centroids[i] = (bounds[i].Lower + bounds[i].Upper) * 0.5f;
+		buildNodes.assign(items.size() * 2 - 1, BuildNode());
+		std::atomic<uint32_t> nextBuildNode{ 1 };
+		buildRange(0, 0, (uint32_t)items.size(), 0, nextBuildNode);
+
+		collapse(0);
+		buildNodes = std::vector<BuildNode>();
+		centroids = std::vector<glm::vec3>();
+	}
+
+	// Moves an item; the tree is stale until the next Refit()
+	void SetItemBounds(uint32_t item, const BvhBounds& bounds)
+	{
+		itemBounds[item] = bounds;
+	}
+
+	// Re-grows every node box around its children, bottom up. Children always come after their parent.
+	void Refit()
+	{
+		for (size_t n = nodes.size(); n-- > 0;)
+		{
+			BvhNode4& node = nodes[n];
+			for (uint32_t lane = 0; lane < node.LaneCount; ++lane)
+			{
+				BvhBounds bounds;
+				if (node.Count[lane] == 0)
+					bounds = nodeBounds(nodes[node.Child[lane]]);
+				else
+					for (uint32_t i = node.Child[lane]; i < node.Child[lane] + node.Count[lane]; ++i)
+						bounds.Grow(itemBounds[items[i]]);
+				setLane(node, lane, bounds);
+			}
+		}
+	}
+
+	// visit(item) for every item whose box is at least partly inside the frustum
+	template <typename Visit>
+	void QueryFrustum(const Frustum& frustum, Visit&& visit) const
+	{
+		traverse([&](const BvhNode4& node) { return frustumMask(node, frustum); },
+			[&](const BvhBounds& bounds) { return frustum.IntersectsBox(bounds.Lower, bounds.Upper); }, visit);
+	}
+
+	// visit(item) for every item whose box overlaps [lower, upper]
+	template <typename Visit>
+	void QueryBox(const glm::vec3& lower, const glm::vec3& upper, Visit&& visit) const
+	{
+		traverse([&](const BvhNode4& node) { return boxMask(node, lower, upper); },
+			[&](const BvhBounds& bounds)
+			{
+				return bounds.Lower.x <= upper.x && lower.x <= bounds.Upper.x && bounds.Lower.y <= upper.y && lower.y <= bounds.Upper.y
+					&& bounds.Lower.z <= upper.z && lower.z <= bounds.Upper.z;
+			}, visit);
+	}
+
+	// visit(item) for every item whose box is within radius of center
+	template <typename Visit>
+	void QuerySphere(const glm::vec3& center, float radius, Visit&& visit) const
+	{
+		traverse([&](const BvhNode4& node) { return sphereMask(node, center, radius); },
+			[&](const BvhBounds& bounds)
+			{
+				glm::vec3 outside = glm::max(glm::max(bounds.Lower - center, center - bounds.Upper), glm::vec3(0.0f));
+				return glm::dot(outside, outside) <= radius * radius;
+			}, visit);
+	}
+
+	// Walks the boxes the ray enters before maxDistance, nearest first, calling hit(item, maxDistance) for each
+	// item whose box it enters. hit can shorten maxDistance (to its closest intersection so far) to prune the
+	// rest of the walk. direction needn't be unit length; distances are in multiples of it.
+	template <typename Hit>
+	void Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Hit&& hit) const
+	{
+		if (nodes.empty())
+			return;
+		glm::vec3 inverse;
+		for (int axis = 0; axis < 3; ++axis)
+			inverse[axis] = 1.0f / (direction[axis] != 0.0f ? direction[axis] : 1e-30f);
+
+		struct Entry
+		{
+			uint32_t Node;
+			float Distance;
+		};
+		Entry stack[SCENE_BVH_STACK_SIZE];
+		int size = 0;
+		stack[size++] = Entry{ 0, 0.0f };
+		while (size > 0)
+		{
+			Entry entry = stack[--size];
+			if (entry.Distance > maxDistance)
+				continue;
+			const BvhNode4& node = nodes[entry.Node];
+			float enter[4];
+			int mask = rayMask(node, origin, inverse, maxDistance, enter);
+
+			// leaves now, in order; inner nodes pushed farthest first so the nearest comes off the stack next
+			int order[4], count = 0;
+			for (int lane = 0; lane < 4; ++lane)
+				if (mask & (1 << lane))
+				{
+					int i = count++;
+					for (; i > 0 && enter[order[i - 1]] > enter[lane]; --i)
+						order[i] = order[i - 1];
+					order[i] = lane;
+				}
+			for (int i = 0; i < count; ++i)
+			{
+				int lane = order[i];
+				if (node.Count[lane] == 0 || enter[lane] > maxDistance)
+					continue;
+				for (uint32_t k = node.Child[lane]; k < node.Child[lane] + node.Count[lane]; ++k)
+				{
+					const BvhBounds& bounds = itemBounds[items[k]];
+					float distance;
+					if (rayHitsBox(bounds, origin, inverse, maxDistance, distance))
+						hit(items[k], maxDistance);
+				}
+			}
+			for (int i = count; i-- > 0;)
+				if (node.Count[order[i]] == 0)
+					stack[size++] = Entry{ node.Child[order[i]], enter[order[i]] };
+		}
+	}
+
+	const BvhBounds& ItemBounds(uint32_t item) const
+	{
+		return itemBounds[item];
+	}
+
+	size_t ItemCount() const
+	{
+		return itemBounds.size();
+	}
+
+	size_t NodeCount() const
+	{
+		return nodes.size();
+	}
+
+private:
+	struct BuildNode
+	{
+		BvhBounds Bounds;
+		uint32_t Left = 0;   // the right child is Left + 1
+		uint32_t First = 0;
+		uint32_t Count = 0;  // 0 for inner nodes
+	};
+
+	std::vector<BvhNode4> nodes;
+	std::vector<uint32_t> items;
+	std::vector<BvhBounds> itemBounds;
+	// build-time only
+	std::vector<BuildNode> buildNodes;
+	std::vector<glm::vec3> centroids;
+
+	void buildRange(uint32_t index, uint32_t begin, uint32_t end, int depth, std::atomic<uint32_t>& nextBuildNode)
+	{
+		BuildNode& node = buildNodes[index];
+		BvhBounds centroidBounds;
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			node.Bounds.Grow(itemBounds[items[i]]);
+			centroidBounds.Lower = glm::min(centroidBounds.Lower, centroids[items[i]]);
+			centroidBounds.Upper = glm::max(centroidBounds.Upper, centroids[items[i]]);
+		}
+		uint32_t count = end - begin;
+		if (count <= SCENE_BVH_LEAF_ITEMS)
+		{
+			node.First = begin;
+			node.Count = count;
+			return;
+		}
+
+		// sweep the bins of each axis for the cheapest split
+		int bestAxis = -1, bestSplit = 0;
+		float bestCost = FLT_MAX;
+		glm::vec3 extent = centroidBounds.Upper - centroidBounds.Lower;
+		for (int axis = 0; axis < 3 && depth < SCENE_BVH_MAX_DEPTH; ++axis)
+		{
+			if (extent[axis] <= 0.0f)
+				continue;
+			BvhBounds bins[SCENE_BVH_BINS];
+			uint32_t binCounts[SCENE_BVH_BINS] = {};
+			float scale = SCENE_BVH_BINS / extent[axis];
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				int bin = binIndex(centroids[items[i]][axis], centroidBounds.Lower[axis], scale);
+				bins[bin].Grow(itemBounds[items[i]]);
+				++binCounts[bin];
+			}
+			float rightArea[SCENE_BVH_BINS];
+			uint32_t rightCount[SCENE_BVH_BINS];
+			BvhBounds right;
+			uint32_t rightItems = 0;
+			for (int b = SCENE_BVH_BINS - 1; b > 0; --b)
+			{
+				right.Grow(bins[b]);
+				rightItems += binCounts[b];
+				rightArea[b] = right.HalfArea();
+				rightCount[b] = rightItems;
+			}
+			BvhBounds left;
+			uint32_t leftItems = 0;
+			for (int split = 1; split < SCENE_BVH_BINS; ++split)
+			{
+				left.Grow(bins[split - 1]);
+				leftItems += binCounts[split - 1];
+				if (leftItems == 0 || rightCount[split] == 0)
+					continue;
+				float cost = left.HalfArea() * leftItems + rightArea[split] * rightCount[split];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		// a leaf when splitting wouldn't pay for the extra traversal step
+		if (count <= SCENE_BVH_MAX_LEAF_ITEMS && (bestAxis < 0 || bestCost >= node.Bounds.HalfArea() * count))
+		{
+			node.First = begin;
+			node.Count = count;
+			return;
+		}
+
+		uint32_t middle;
+		if (bestAxis >= 0)
+		{
+			float lowest = centroidBounds.Lower[bestAxis], scale = SCENE_BVH_BINS / extent[bestAxis];
+			middle = (uint32_t)(std::partition(items.begin() + begin, items.begin() + end,
+				[&](uint32_t item) { return binIndex(centroids[item][bestAxis], lowest, scale) < bestSplit; }) - items.begin());
+		}
+		else
+		{
+			// every centroid in one spot, or too deep: halve along the longest axis
+			int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+			middle = begin + count / 2;
+			std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end,
+				[&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+		}
+
+		uint32_t left = nextBuildNode.fetch_add(2);
+		node.Left = left;
+		if (count >= SCENE_BVH_PARALLEL_ITEMS)
+			GetSharedThreadPool().ParallelFor(2, [&](size_t side)
+			{
+				if (side == 0)
+					buildRange(left, begin, middle, depth + 1, nextBuildNode);
+				else
+					buildRange(left + 1, middle, end, depth + 1, nextBuildNode);
+			});
+		else
+		{
+			buildRange(left, begin, middle, depth + 1, nextBuildNode);
+			buildRange(left + 1, middle, end, depth + 1, nextBuildNode);
+		}
+	}
+
+	static int binIndex(float centroid, float lowest, float scale)
+	{
+		return std::min(SCENE_BVH_BINS - 1, std::max(0, (int)((centroid - lowest) * scale)));
+	}
+
+	// Turns the binary subtree at buildNodes[index] into four-wide nodes: the children's largest inner nodes are
+	// opened until there are four lanes or only leaves left. Returns the new node's index.
+	uint32_t collapse(uint32_t index)
+	{
+		uint32_t lanes[4];
+		uint32_t laneCount = 0;
+		if (buildNodes[index].Count > 0)
+			lanes[laneCount++] = index;
+		else
+		{
+			lanes[laneCount++] = buildNodes[index].Left;
+			lanes[laneCount++] = buildNodes[index].Left + 1;
+		}
+		while (laneCount < 4)
+		{
+			int open = -1;
+			for (uint32_t lane = 0; lane < laneCount; ++lane)
+				if (buildNodes[lanes[lane]].Count == 0 && (open < 0 || buildNodes[lanes[lane]].Bounds.HalfArea() > buildNodes[lanes[open]].Bounds.HalfArea()))
+					open = (int)lane;
+			if (open < 0)
+				break;
+			uint32_t left = buildNodes[lanes[open]].Left;
+			lanes[open] = left;
+			lanes[laneCount++] = left + 1;
+		}
+
+		uint32_t self = (uint32_t)nodes.size();
+		nodes.push_back(BvhNode4());
+		nodes[self].LaneCount = laneCount;
+		for (uint32_t lane = 0; lane < 4; ++lane)
+			setLane(nodes[self], lane, BvhBounds());
+		for (uint32_t lane = 0; lane < laneCount; ++lane)
+		{
+			const BuildNode& child = buildNodes[lanes[lane]];
+			uint32_t target = child.Count > 0 ? child.First : collapse(lanes[lane]);
+			BvhNode4& node = nodes[self];
+			node.Child[lane] = target;
+			node.Count[lane] = child.Count;
+			setLane(node, lane, child.Bounds);
+		}
+		return self;
+	}
+
+	static void setLane(BvhNode4& node, uint32_t lane, const BvhBounds& bounds)
+	{
+		node.LowerX[lane] = bounds.Lower.x;
+		node.LowerY[lane] = bounds.Lower.y;
+		node.LowerZ[lane] = bounds.Lower.z;
+		node.UpperX[lane] = bounds.Upper.x;
+		node.UpperY[lane] = bounds.Upper.y;
+		node.UpperZ[lane] = bounds.Upper.z;
+		if (lane >= node.LaneCount)
+			node.Child[lane] = node.Count[lane] = 0;
+	}
+
+	static BvhBounds nodeBounds(const BvhNode4& node)
+	{
+		BvhBounds bounds;
+		for (uint32_t lane = 0; lane < node.LaneCount; ++lane)
+		{
+			bounds.Lower = glm::min(bounds.Lower, glm::vec3(node.LowerX[lane], node.LowerY[lane], node.LowerZ[lane]));
+			bounds.Upper = glm::max(bounds.Upper, glm::vec3(node.UpperX[lane], node.UpperY[lane], node.UpperZ[lane]));
+		}
+		return bounds;
+	}
+
+	// depth-first walk: laneMask(node) picks the lanes to enter, itemTest(bounds) filters the items in leaves
+	template <typename LaneMask, typename ItemTest, typename Visit>
+	void traverse(LaneMask&& laneMask, ItemTest&& itemTest, Visit& visit) const
+	{
+		if (nodes.empty())
+			return;
+		uint32_t stack[SCENE_BVH_STACK_SIZE];
+		int size = 0;
+		stack[size++] = 0;
+		while (size > 0)
+		{
+			const BvhNode4& node = nodes[stack[--size]];
+			int mask = laneMask(node) & ((1 << node.LaneCount) - 1);
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				if (!(mask & (1 << lane)))
+					continue;
+				if (node.Count[lane] == 0)
+				{
+					stack[size++] = node.Child[lane];
+					continue;
+				}
+				for (uint32_t k = node.Child[lane]; k < node.Child[lane] + node.Count[lane]; ++k)
+					if (itemTest(itemBounds[items[k]]))
+						visit(items[k]);
+			}
+		}
+	}
+
+	static bool rayHitsBox(const BvhBounds& bounds, const glm::vec3& origin, const glm::vec3& inverse, float maxDistance, float& distance)
+	{
+		float enter = 0.0f, exit = maxDistance;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float a = (bounds.Lower[axis] - origin[axis]) * inverse[axis], b = (bounds.Upper[axis] - origin[axis]) * inverse[axis];
+			enter = std::max(enter, std::min(a, b));
+			exit = std::min(exit, std::max(a, b));
+		}
+		distance = enter;
+		return enter <= exit;
+	}
+
+#if defined(SCENE_BVH_SSE)
+	// lanes whose box is on the inner side of all six planes; per plane the box corner furthest along the
+	// normal is max(n * lower, n * upper) on each axis
+	static int frustumMask(const BvhNode4& node, const Frustum& frustum)
+	{
+		__m128 lx = _mm_loadu_ps(node.LowerX), ly = _mm_loadu_ps(node.LowerY), lz = _mm_loadu_ps(node.LowerZ);
+		__m128 ux = _mm_loadu_ps(node.UpperX), uy = _mm_loadu_ps(node.UpperY), uz = _mm_loadu_ps(node.UpperZ);
+		int mask = 15;
+		for (const glm::vec4& plane : frustum.Planes)
+		{
+			__m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_max_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(nx, ux)), _mm_max_ps(_mm_mul_ps(ny, ly), _mm_mul_ps(ny, uy))),
+				_mm_add_ps(_mm_max_ps(_mm_mul_ps(nz, lz), _mm_mul_ps(nz, uz)), _mm_set1_ps(plane.w)));
+			mask &= _mm_movemask_ps(_mm_cmpge_ps(distance, _mm_setzero_ps()));
+		}
+		return mask;
+	}
+
+	static int boxMask(const BvhNode4& node, const glm::vec3& lower, const glm::vec3& upper)
+	{
+		__m128 overlap = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.LowerX), _mm_set1_ps(upper.x)), _mm_cmple_ps(_mm_set1_ps(lower.x), _mm_loadu_ps(node.UpperX))),
+			_mm_and_ps(_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.LowerY), _mm_set1_ps(upper.y)), _mm_cmple_ps(_mm_set1_ps(lower.y), _mm_loadu_ps(node.UpperY))),
+				_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.LowerZ), _mm_set1_ps(upper.z)), _mm_cmple_ps(_mm_set1_ps(lower.z), _mm_loadu_ps(node.UpperZ)))));
+		return _mm_movemask_ps(overlap);
+	}
+
+	static int sphereMask(const BvhNode4& node, const glm::vec3& center, float radius)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		__m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.LowerX), cx), _mm_sub_ps(cx, _mm_loadu_ps(node.UpperX))), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.LowerY), cy), _mm_sub_ps(cy, _mm_loadu_ps(node.UpperY))), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.LowerZ), cz), _mm_sub_ps(cz, _mm_loadu_ps(node.UpperZ))), zero);
+		__m128 squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		return _mm_movemask_ps(_mm_cmple_ps(squared, _mm_set1_ps(radius * radius)));
+	}
+
+	// slab test of all four boxes; enter receives where the ray enters each
+	static int rayMask(const BvhNode4& node, const glm::vec3& origin, const glm::vec3& inverse, float maxDistance, float* enter)
+	{
+		__m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+		__m128 ix = _mm_set1_ps(inverse.x), iy = _mm_set1_ps(inverse.y), iz = _mm_set1_ps(inverse.z);
+		__m128 ax = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.LowerX), ox), ix), bx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.UpperX), ox), ix);
+		__m128 ay = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.LowerY), oy), iy), by = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.UpperY), oy), iy);
+		__m128 az = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.LowerZ), oz), iz), bz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.UpperZ), oz), iz);
+		__m128 entering = _mm_max_ps(_mm_max_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_max_ps(_mm_min_ps(az, bz), _mm_setzero_ps()));
+		__m128 leaving = _mm_min_ps(_mm_min_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_min_ps(_mm_max_ps(az, bz), _mm_set1_ps(maxDistance)));
+		_mm_storeu_ps(enter, entering);
+		return _mm_movemask_ps(_mm_cmple_ps(entering, leaving)) & ((1 << node.LaneCount) - 1);
+	}
+#else
+	static int frustumMask(const BvhNode4& node, const Frustum& frustum)
+	{
+		int mask = 0;
+		for (int lane = 0; lane < 4; ++lane)
+			mask |= (int)frustum.IntersectsBox(glm::vec3(node.LowerX[lane], node.LowerY[lane], node.LowerZ[lane]), glm::vec3(node.UpperX[lane], node.UpperY[lane], node.UpperZ[lane])) << lane;
+		return mask;
+	}
+
+	static int boxMask(const BvhNode4& node, const glm::vec3& lower, const glm::vec3& upper)
+	{
+		int mask = 0;
+		for (int lane = 0; lane < 4; ++lane)
+			mask |= (int)(node.LowerX[lane] <= upper.x && lower.x <= node.UpperX[lane] && node.LowerY[lane] <= upper.y && lower.y <= node.UpperY[lane]
+				&& node.LowerZ[lane] <= upper.z && lower.z <= node.UpperZ[lane]) << lane;
+		return mask;
+	}
+
+	static int sphereMask(const BvhNode4& node, const glm::vec3& center, float radius)
+	{
+		int mask = 0;
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			glm::vec3 lower(node.LowerX[lane], node.LowerY[lane], node.LowerZ[lane]), upper(node.UpperX[lane], node.UpperY[lane], node.UpperZ[lane]);
+			glm::vec3 outside = glm::max(glm::max(lower - center, center - upper), glm::vec3(0.0f));
+			mask |= (int)(glm::dot(outside, outside) <= radius * radius) << lane;
+		}
+		return mask;
+	}
+
+	static int rayMask(const BvhNode4& node, const glm::vec3& origin, const glm::vec3& inverse, float maxDistance, float* enter)
+	{
+		int mask = 0;
+		for (uint32_t lane = 0; lane < node.LaneCount; ++lane)
+		{
+			BvhBounds bounds;
+			bounds.Lower = glm::vec3(node.LowerX[lane], node.LowerY[lane], node.LowerZ[lane]);
+			bounds.Upper = glm::vec3(node.UpperX[lane], node.UpperY[lane], node.UpperZ[lane]);
+			mask |= (int)rayHitsBox(bounds, origin, inverse, maxDistance, enter[lane]) << lane;
+		}
+		return mask;
+	}
+#endif
+};
+
+#endif
@@ -0,0 +1,403 @@
+#ifndef SHADER_BATCH_H
+#define SHADER_BATCH_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "mapped_file.h"
+#include "shader_cache.h"
+
+// Shader builds that don't stall the caller. A batch issues every compile and every link up front and only then
+// asks for results, so the driver can work on all of them at once; with KHR_parallel_shader_compile (or the ARB
+// version) it does so on its own threads, and Poll() reads GL_COMPLETION_STATUS instead of blocking on
+// GL_COMPILE_STATUS. Compile errors are only looked at once a link has failed, since a failed compile always
+// fails the link. Without the extension Poll() blocks like Wait(), but the compiles are still issued together.
+//
+// ShaderHotReload builds on that: it watches a program's source files and rebuilds the program in a batch of
+// its own, swapping it in only once the new link has succeeded, so editing a shader never costs a frame.
+
+#define SHADER_RELOAD_INTERVAL_MS 250   // how often ShaderHotReload looks at the files
+
+enum ShaderBatch_State
+{
+	SHADER_PENDING,
+	SHADER_LINKED,
+	SHADER_FAILED
+};
+
+struct ShaderBatchProgram
+{
+	GLuint Program = 0;             // the caller's once linked; deleted by the batch if the build fails
+	ShaderBatch_State State = SHADER_PENDING;
+	bool FromCache = false;
+	std::string Log;                // compile and link errors when the build failed
+
+	std::vector<GLenum> Types;
+	std::vector<std::string> Sources;
+	std::vector<GLuint> Shaders;
+	uint64_t CacheKey = 0;
+};
+
+class ShaderBatch
+{
+public:
+	// Lets the driver compile on as many threads as it likes; call once after the context is created
+	static bool EnableParallelCompile()
+	{
+		if (GLEW_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+		else if (GLEW_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFFu);
+		else
+			return false;
+		return true;
+	}
+
+	// Adds a program made of these stages; returns its index. Sources are copied.
+	size_t Add(const GLenum* types, const char* const* sources, size_t count)
+	{
+		ShaderBatchProgram program;
+		program.Types.assign(types, types + count);
+		program.Sources.assign(sources, sources + count);
+		programs.push_back(program);
+		return programs.size() - 1;
+	}
+
+	size_t Add(const char* vertexSource, const char* fragmentSource)
+	{
+		const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		const char* sources[] = { vertexSource, fragmentSource };
+		return Add(types, sources, 2);
+	}
+
+	// Issues everything added so far. Programs in the cache are done at once; the rest are compiled and
+	// linked without waiting for any of them.
+	void Start(ShaderCache* cache = nullptr)
+	{
+		shaderCache = cache;
+		parallel = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+		for (ShaderBatchProgram& program : programs)
+		{
+			if (program.State != SHADER_PENDING || program.Program)
+				continue;
+			if (shaderCache)
+			{
+				std::vector<const char*> sources;
+				for (const std::string& source : program.Sources)
+					sources.push_back(source.c_str());
+				program.CacheKey = shaderCache->Key(sources.data(), sources.size());
+				if (shaderCache->Load(program.CacheKey, program.Program))
+				{
+					program.State = SHADER_LINKED;
+					program.FromCache = true;
+					continue;
+				}
+			}
+			for (size_t i = 0; i < program.Types.size(); ++i)
+			{
+				GLuint shader = glCreateShader(program.Types[i]);
+				const char* source = program.Sources[i].c_str();
+				glShaderSource(shader, 1, &source, NULL);
+				glCompileShader(shader);
+				program.Shaders.push_back(shader);
+			}
+		}
+		for (ShaderBatchProgram& program : programs)
+		{
+			if (program.State != SHADER_PENDING || program.Program)
+				continue;
+			program.Program = glCreateProgram();
+			for (GLuint shader : program.Shaders)
+				glAttachShader(program.Program, shader);
+			if (shaderCache)
+				shaderCache->PrepareToLink(program.Program);
+			glLinkProgram(program.Program);
+		}
+	}
+
+	// Collects the builds that have finished; true once none is pending. Never blocks with the extension.
+	bool Poll()
+	{
+		bool done = true;
+		for (ShaderBatchProgram& program : programs)
+			if (program.State == SHADER_PENDING && !finish(program, false))
+				done = false;
+		return done;
+	}
+
+	void Wait()
+	{
+		for (ShaderBatchProgram& program : programs)
+			if (program.State == SHADER_PENDING)
+				finish(program, true);
+	}
+
+	size_t Size() const
+	{
+		return programs.size();
+	}
+
+	const ShaderBatchProgram& operator[](size_t index) const
+	{
+		return programs[index];
+	}
+
+	void Clear()
+	{
+		Wait();
+		programs.clear();
+	}
+
+private:
+	std::vector<ShaderBatchProgram> programs;
+	ShaderCache* shaderCache = nullptr;
+	bool parallel = false;
+
+	bool finish(ShaderBatchProgram& program, bool block)
+	{
+		if (!program.Program)
+			return false; // added after Start()
+		GLint status = GL_FALSE;
+		if (parallel && !block)
+		{
+			glGetProgramiv(program.Program, GL_COMPLETION_STATUS_KHR, &status);
+			if (!status)
+				return false;
+		}
+		glGetProgramiv(program.Program, GL_LINK_STATUS, &status);
+		if (status)
+		{
+			program.State = SHADER_LINKED;
+			if (shaderCache)
+				shaderCache->Store(program.CacheKey, program.Program);
+		}
+		else
+		{
+			program.State = SHADER_FAILED;
+			for (size_t i = 0; i < program.Shaders.size(); ++i)
+			{
+				glGetShaderiv(program.Shaders[i], GL_COMPILE_STATUS, &status);
+				if (!status)
+					program.Log += stageName(program.Types[i]) + std::string(" shader failed to compile:\n") + infoLog(program.Shaders[i], false);
+			}
+			program.Log += "link failed:\n" + infoLog(program.Program, true);
+		}
+		for (GLuint shader : program.Shaders)
+		{
+			glDetachShader(program.Program, shader);
+			glDeleteShader(shader);
+		}
+		program.Shaders.clear();
+		if (program.State == SHADER_FAILED)
+		{
+			glDeleteProgram(program.Program);
+			program.Program = 0;
+		}
+		return true;
+	}
+
+	static const char* stageName(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_VERTEX_SHADER: return "vertex";
+		case GL_FRAGMENT_SHADER: return "fragment";
+		case GL_GEOMETRY_SHADER: return "geometry";
+		case GL_COMPUTE_SHADER: return "compute";
+		default: return "tessellation";
+		}
+	}
+
+	static std::string infoLog(GLuint object, bool isProgram)
+	{
+		GLint length = 0;
+		if (isProgram)
+			glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+		else
+			glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+		std::string log((size_t)std::max(length, 1), '\0');
+		if (isProgram)
+			glGetProgramInfoLog(object, (GLsizei)log.size(), NULL, &log[0]);
+		else
+			glGetShaderInfoLog(object, (GLsizei)log.size(), NULL, &log[0]);
+		log.resize(strlen(log.c_str()));
+		return log;
+	}
+};
+
+enum ShaderReload_Result
+{
+	SHADER_RELOAD_NONE,
+	SHADER_RELOAD_SWAPPED,   // the program was replaced; per-program state such as sampler units needs setting again
+	SHADER_RELOAD_FAILED     // the edit didn't build; the old program stays and Error() has the log
+};
+
+class ShaderHotReload
+{
+public:
+	// Watches the files of one program's stages. A missing file stands for the built-in source; when the
+	// file's directory exists, the built-in source is written there as a starting point for editing.
+	void Watch(const GLenum* types, const char* const* filenames, const char* const* builtInSources, size_t count)
+	{
+		stages.clear();
+		for (size_t i = 0; i < count; ++i)
+		{
+			Stage stage;
+			stage.Type = types[i];
+			stage.Filename = filenames[i];
+			stage.Source = builtInSources[i];
+			UFileStamp(stage.Filename, stage.Size, stage.Time);
+			if (stage.Size == 0 && directoryExists(stage.Filename))
+			{
+				std::ofstream file(stage.Filename, std::ios::binary);
+				file << stage.Source;
+				file.close();
+				UFileStamp(stage.Filename, stage.Size, stage.Time);
+			}
+			else if (stage.Size != 0)
+				readFile(stage.Filename, stage.Source);
+			stages.push_back(stage);
+		}
+		lastCheck = std::chrono::steady_clock::now();
+	}
+
+	// Adds the program as it currently reads to a batch, e.g. the one built at startup
+	size_t AddTo(ShaderBatch& batch) const
+	{
+		std::vector<GLenum> types;
+		std::vector<const char*> sources;
+		for (const Stage& stage : stages)
+		{
+			types.push_back(stage.Type);
+			sources.push_back(stage.Source.c_str());
+		}
+		return batch.Add(types.data(), sources.data(), types.size());
+	}
+
+	// Call once a frame. Looks for edited files every SHADER_RELOAD_INTERVAL_MS, starts a rebuild when it finds
+	// one and collects it on a later call; program is only replaced (and the old one deleted) once it linked.
+	ShaderReload_Result Update(GLuint& program, ShaderCache* cache)
+	{
+		if (building)
+		{
+			if (!rebuild.Poll())
+				return SHADER_RELOAD_NONE;
+			building = false;
+			const ShaderBatchProgram& built = rebuild[0];
+			if (built.State != SHADER_LINKED)
+			{
+				error = built.Log;
+				rebuild.Clear();
+				return SHADER_RELOAD_FAILED;
+			}
+			glDeleteProgram(program);
+			program = built.Program;
+			rebuild.Clear();
+			return SHADER_RELOAD_SWAPPED;
+		}
+
+		if (CheckForEdits())
+		{
+			AddTo(rebuild);
+			rebuild.Start(cache);
+			building = true;
+		}
+		return SHADER_RELOAD_NONE;
+	}
+
+	// Rereads the files that changed, looking at most every SHADER_RELOAD_INTERVAL_MS; true when a source did.
+	// Update() calls this itself; it is for callers that build something else from the sources.
+	bool CheckForEdits()
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (now - lastCheck < std::chrono::milliseconds(SHADER_RELOAD_INTERVAL_MS))
+			return false;
+		lastCheck = now;
+		bool changed = false;
+		for (Stage& stage : stages)
+		{
+			uint64_t size;
+			int64_t time;
+			UFileStamp(stage.Filename, size, time);
+			if (size == 0 || (size == stage.Size && time == stage.Time))
+				continue;
+			stage.Size = size;
+			stage.Time = time;
+			changed = readFile(stage.Filename, stage.Source) || changed;
+		}
+		return changed;
+	}
+
+	size_t StageCount() const
+	{
+		return stages.size();
+	}
+
+	GLenum StageType(size_t stage) const
+	{
+		return stages[stage].Type;
+	}
+
+	// the stage's current source: the file's contents, or the built-in source while there is no file
+	const std::string& StageSource(size_t stage) const
+	{
+		return stages[stage].Source;
+	}
+
+	const std::string& Error() const
+	{
+		return error;
+	}
+
+private:
+	struct Stage
+	{
+		GLenum Type;
+		std::string Filename;
+		std::string Source;
+		uint64_t Size = 0;
+		int64_t Time = 0;
+	};
+
+	std::vector<Stage> stages;
+	ShaderBatch rebuild;
+	bool building = false;
+	std::chrono::steady_clock::time_point lastCheck;
+	std::string error;
+
+	// false when the file can't be read or hasn't actually changed (editors often rewrite files unchanged)
+	static bool readFile(const std::string& filename, std::string& contents)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file)
+			return false;
+		std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (text.empty() || text == contents)
+			return false;
+		contents.swap(text);
+		return true;
+	}
+
+	static bool directoryExists(const std::string& filename)
+	{
+		size_t slash = filename.find_last_of("/\\");
+		if (slash == std::string::npos)
+			return false;
+		struct stat info;
+		return stat(filename.substr(0, slash).c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+	}
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "mapped_file.h"
+
+// Linked program binary cache. A program's key hashes its shader sources together with the driver's vendor,
+// renderer and version strings, and a cache file holds what glGetProgramBinary returned for that key. A warm
+// start hands the file to glProgramBinary and never compiles a shader. Drivers may still refuse a binary (an
+// update that kept the version string, for one); the caller then compiles as usual and the file is replaced.
+// Files are written next to each other under one prefix, named by key: <prefix><16 hex digits>.programbin.
+
+#define SHADER_CACHE_MAGIC 0x47525050u   // "PPRG"
+#define SHADER_CACHE_VERSION 1u
+
+struct ShaderCacheHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint64_t Key;
+	uint32_t Format;   // binaryFormat from glGetProgramBinary
+	uint32_t Length;   // bytes of binary after the header
+};
+
+struct ShaderCacheStats
+{
+	uint32_t Hits = 0;         // programs created from a cached binary
+	uint32_t Misses = 0;       // no usable file: compiled from source
+	uint32_t Rejected = 0;     // of the misses, binaries the driver refused
+	uint32_t Stored = 0;
+	double LoadMilliseconds = 0.0; // time spent in glProgramBinary for the hits
+};
+
+class ShaderCache
+{
+public:
+	// Reads the driver strings; needs the context current. The cache stays off where the driver offers no
+	// binary formats.
+	void Create(const std::string& filePrefix)
+	{
+		prefix = filePrefix;
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		enabled = formats > 0;
+		uint32_t version = SHADER_CACHE_VERSION;
+		driverHash = hashBytes(14695981039346656037ull, &version, sizeof(version));
+		const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (GLenum name : names)
+		{
+			const char* value = (const char*)glGetString(name);
+			driverHash = hashString(driverHash, value ? value : "");
+		}
+	}
+
+	bool Enabled() const
+	{
+		return enabled;
+	}
+
+	// The key of a program linked from these sources (in stage order) on this driver
+	uint64_t Key(const char* const* sources, size_t count) const
+	{
+		uint64_t hash = driverHash;
+		for (size_t i = 0; i < count; ++i)
+			hash = hashString(hash, sources[i]);
+		return hash;
+	}
+
+	// Creates programId from the cached binary. False (and programId untouched) when there is no file or the
+	// driver rejects it; a rejected file is deleted.
+	bool Load(uint64_t key, GLuint& programId)
+	{
+		if (!enabled)
+			return miss();
+		std::string filename = fileFor(key);
+		MappedFile file;
+		if (!file.Open(filename.c_str()) || file.Size() < sizeof(ShaderCacheHeader))
+			return miss();
+		ShaderCacheHeader header;
+		memcpy(&header, file.Data(), sizeof(header));
+		if (header.Magic != SHADER_CACHE_MAGIC || header.Version != SHADER_CACHE_VERSION || header.Key != key ||
+			header.Length == 0 || header.Length != file.Size() - sizeof(header))
+			return reject(file, filename);
+
+		auto start = std::chrono::steady_clock::now();
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, header.Format, file.Data() + sizeof(header), (GLsizei)header.Length);
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!linked)
+		{
+			glDeleteProgram(program);
+			return reject(file, filename);
+		}
+		stats.LoadMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		++stats.Hits;
+		programId = program;
+		return true;
+	}
+
+	// Call between attaching the shaders and glLinkProgram, so the driver keeps a binary it can return
+	void PrepareToLink(GLuint programId) const
+	{
+		if (enabled)
+			glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	// Writes a successfully linked program's binary under key, through a temporary file renamed into place
+	bool Store(uint64_t key, GLuint programId)
+	{
+		if (!enabled)
+			return false;
+		GLint length = 0;
+		glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return false;
+		std::string binary((size_t)length, '\0');
+		GLenum format = 0;
+		glGetProgramBinary(programId, length, &length, &format, &binary[0]);
+		if (length <= 0)
+			return false;
+
+		ShaderCacheHeader header = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, key, (uint32_t)format, (uint32_t)length };
+		std::string filename = fileFor(key), temporary = filename + ".tmp";
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (!file)
+			return false;
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary.data(), 1, (size_t)length, file) == (size_t)length;
+		ok = fclose(file) == 0 && ok;
+		if (ok)
+		{
+			remove(filename.c_str()); // rename() won't replace an existing file on Windows
+			ok = rename(temporary.c_str(), filename.c_str()) == 0;
+		}
+		if (!ok)
+			remove(temporary.c_str());
+		stats.Stored += ok ? 1 : 0;
+		return ok;
+	}
+
+	const ShaderCacheStats& Stats() const
+	{
+		return stats;
+	}
+
+private:
+	std::string prefix;
+	uint64_t driverHash = 0;
+	bool enabled = false;
+	ShaderCacheStats stats;
+
+	// FNV-1a
+	static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i)
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		return hash;
+	}
+
+	// the length goes in first so that moving text between two strings changes the key
+	static uint64_t hashString(uint64_t hash, const char* text)
+	{
+		uint64_t length = strlen(text);
+		return hashBytes(hashBytes(hash, &length, sizeof(length)), text, (size_t)length);
+	}
+
+	std::string fileFor(uint64_t key) const
+	{
+		char name[17];
+		snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+		return prefix + name + ".programbin";
+	}
+
+	bool miss()
+	{
+		++stats.Misses;
+		return false;
+	}
+
+	bool reject(MappedFile& file, const std::string& filename)
+	{
+		file.Close();
+		remove(filename.c_str());
+		++stats.Rejected;
+		return miss();
+	}
+};
+
+#endif
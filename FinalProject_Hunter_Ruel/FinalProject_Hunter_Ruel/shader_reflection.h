@@ -0,0 +1,309 @@
+#ifndef SHADER_REFLECTION_H
+#define SHADER_REFLECTION_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gl_state.h"
+#include "ring_buffer.h"
+
+// Shader reflection and typed parameter blocks. ShaderReflection asks a linked program for everything it uses
+// (uniforms with their locations or block offsets, uniform and storage blocks, samplers with their units and
+// vertex inputs) through the program interface queries, once, when the program is built. Draw code then uses
+// fixed slots instead of looking names up.
+//
+// ParameterBlock<Block> mirrors a std140 uniform block in a C++ struct. Parameters are written to its staging
+// copy and Upload() puts the whole block in the ring buffer with one copy and binds it, so a batch of draws
+// costs one buffer update however many parameters it sets. Matches() compares the struct's field table with
+// what the program reflects, so a shader edit that moves or retypes a member fails when it loads instead of
+// drawing with garbage.
+
+struct ReflectedUniform
+{
+	std::string Name;    // arrays end in "[0]"
+	GLenum Type;
+	GLint Location;      // -1 for block members
+	GLint ArraySize;
+	GLint Block;         // index into Blocks(), -1 for plain uniforms
+	GLint Offset;        // byte offset within the block, -1 for plain uniforms
+	GLint Unit;          // texture unit of a sampler, -1 for anything else
+};
+
+struct ReflectedBlock
+{
+	std::string Name;
+	GLenum Interface;    // GL_UNIFORM_BLOCK or GL_SHADER_STORAGE_BLOCK
+	GLint Binding;
+	GLint DataSize;      // bytes the program reads, padding included
+};
+
+struct ReflectedAttribute
+{
+	std::string Name;
+	GLenum Type;
+	GLint Location;      // -1 for built-ins such as gl_VertexID
+};
+
+class ShaderReflection
+{
+public:
+	// Enumerates a linked program's active resources; needs the context current
+	void Reflect(GLuint programId)
+	{
+		uniforms.clear();
+		blocks.clear();
+		attributes.clear();
+		program = programId;
+		if (!programId)
+			return;
+
+		// uniform blocks first, so that members can refer to them by index
+		reflectBlocks(GL_UNIFORM_BLOCK);
+		size_t uniformBlockCount = blocks.size();
+		reflectBlocks(GL_SHADER_STORAGE_BLOCK);
+
+		const GLenum uniformProperties[] = { GL_NAME_LENGTH, GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE, GL_BLOCK_INDEX, GL_OFFSET };
+		GLint count = 0;
+		glGetProgramInterfaceiv(programId, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+		for (GLint i = 0; i < count; ++i)
+		{
+			GLint values[6];
+			glGetProgramResourceiv(programId, GL_UNIFORM, (GLuint)i, 6, uniformProperties, 6, NULL, values);
+			ReflectedUniform uniform;
+			uniform.Name = resourceName(GL_UNIFORM, (GLuint)i, values[0]);
+			uniform.Type = (GLenum)values[1];
+			uniform.Location = values[2];
+			uniform.ArraySize = values[3];
+			uniform.Block = values[4] >= 0 && (size_t)values[4] < uniformBlockCount ? values[4] : -1;
+			uniform.Offset = uniform.Block >= 0 ? values[5] : -1;
+			uniform.Unit = -1;
+			if (IsSampler(uniform.Type) && uniform.Location >= 0)
+				glGetUniformiv(programId, uniform.Location, &uniform.Unit);
+			uniforms.push_back(uniform);
+		}
+
+		const GLenum inputProperties[] = { GL_NAME_LENGTH, GL_TYPE, GL_LOCATION };
+		glGetProgramInterfaceiv(programId, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &count);
+		for (GLint i = 0; i < count; ++i)
+		{
+			GLint values[3];
+			glGetProgramResourceiv(programId, GL_PROGRAM_INPUT, (GLuint)i, 3, inputProperties, 3, NULL, values);
+			attributes.push_back(ReflectedAttribute{ resourceName(GL_PROGRAM_INPUT, (GLuint)i, values[0]), (GLenum)values[1], values[2] });
+		}
+	}
+
+	GLuint Program() const
+	{
+		return program;
+	}
+
+	const std::vector<ReflectedUniform>& Uniforms() const
+	{
+		return uniforms;
+	}
+
+	const std::vector<ReflectedBlock>& Blocks() const
+	{
+		return blocks;
+	}
+
+	const std::vector<ReflectedAttribute>& Attributes() const
+	{
+		return attributes;
+	}
+
+	// nullptr when the program doesn't use it
+	const ReflectedUniform* FindUniform(const char* name) const
+	{
+		for (const ReflectedUniform& uniform : uniforms)
+			if (uniform.Name == name)
+				return &uniform;
+		return nullptr;
+	}
+
+	const ReflectedBlock* FindBlock(const char* name, GLenum blockInterface = GL_UNIFORM_BLOCK) const
+	{
+		for (const ReflectedBlock& block : blocks)
+			if (block.Interface == blockInterface && block.Name == name)
+				return &block;
+		return nullptr;
+	}
+
+	// the vertex inputs as a mask of 1 << location
+	unsigned AttributeMask() const
+	{
+		unsigned mask = 0;
+		for (const ReflectedAttribute& attribute : attributes)
+			if (attribute.Location >= 0 && attribute.Location < 32)
+				mask |= 1u << attribute.Location;
+		return mask;
+	}
+
+	static bool IsSampler(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+		case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_ARRAY_SHADOW:
+		case GL_SAMPLER_CUBE_SHADOW: case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_MULTISAMPLE:
+		case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_2D_ARRAY: case GL_INT_SAMPLER_BUFFER:
+		case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+private:
+	GLuint program = 0;
+	std::vector<ReflectedUniform> uniforms;
+	std::vector<ReflectedBlock> blocks;
+	std::vector<ReflectedAttribute> attributes;
+
+	void reflectBlocks(GLenum blockInterface)
+	{
+		const GLenum properties[] = { GL_NAME_LENGTH, GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+		GLint count = 0;
+		glGetProgramInterfaceiv(program, blockInterface, GL_ACTIVE_RESOURCES, &count);
+		for (GLint i = 0; i < count; ++i)
+		{
+			GLint values[3];
+			glGetProgramResourceiv(program, blockInterface, (GLuint)i, 3, properties, 3, NULL, values);
+			blocks.push_back(ReflectedBlock{ resourceName(blockInterface, (GLuint)i, values[0]), blockInterface, values[1], values[2] });
+		}
+	}
+
+	std::string resourceName(GLenum resourceInterface, GLuint index, GLint length) const
+	{
+		std::string name((size_t)std::max(length, 1), '\0');
+		glGetProgramResourceName(program, resourceInterface, index, (GLsizei)name.size(), NULL, &name[0]);
+		name.resize(strlen(name.c_str()));
+		return name;
+	}
+};
+
+// One member of a parameter block as the C++ struct lays it out
+struct ParameterField
+{
+	const char* Name;    // as the shader declares it
+	GLenum Type;         // GL_FLOAT_VEC4, GL_FLOAT_MAT4, ...
+	GLint Offset;
+};
+
+#define PARAMETER_FIELD(Block, Member, Name, Type) ParameterField{ Name, Type, (GLint)offsetof(Block, Member) }
+
+// Owns a fallback GL buffer: call Destroy() while the context is still current, as with the other GL objects.
+template <class Block>
+class ParameterBlock
+{
+public:
+	// blockName and binding are the shader's "layout(std140, binding = N) uniform blockName"; fields lists
+	// every member, with offsets as std140 places them
+	void Create(const char* blockName, GLuint binding, const ParameterField* fields, size_t fieldCount, GLStateCache& state)
+	{
+		Destroy(state);
+		name = blockName;
+		bindingPoint = binding;
+		layout.assign(fields, fields + fieldCount);
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		offsetAlignment = (size_t)std::max(alignment, 16);
+		glGenBuffers(1, &buffer);
+		state.BindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL, GL_DYNAMIC_DRAW);
+	}
+
+	void Destroy(GLStateCache& state)
+	{
+		if (buffer)
+			state.DeleteBuffers(1, &buffer);
+		buffer = 0;
+		uploadedFrame = ~0ull;
+	}
+
+	// Parameters go here; nothing reaches the GPU before Upload()
+	Block& Staging()
+	{
+		return staging;
+	}
+
+	// Copies the staging block into this frame's region of the ring and binds it. A block that hasn't changed
+	// since it was uploaded this frame is left as it is. Returns false when nothing had to be done.
+	bool Upload(GLStateCache& state, RingBuffer& ring)
+	{
+		uint64_t frame = ring.Stats().Frames;
+		if (frame == uploadedFrame && memcmp(&staging, &uploaded, sizeof(Block)) == 0)
+			return false;
+		RingAllocation allocation = ring.Allocate(sizeof(Block), offsetAlignment);
+		if (allocation.Pointer)
+		{
+			memcpy(allocation.Pointer, &staging, sizeof(Block));
+			state.BindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, ring.Buffer(), allocation.Offset, sizeof(Block));
+		}
+		else
+		{
+			// The ring grows before the next frame; this one takes the slow path
+			state.BindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &staging);
+			state.BindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, buffer);
+		}
+		uploaded = staging;
+		uploadedFrame = frame;
+		return true;
+	}
+
+	// True when the program's block has the binding and the members (names, types and offsets) of the field
+	// table; mismatch says what differs otherwise. A program that doesn't use the block matches.
+	bool Matches(const ShaderReflection& program, std::string& mismatch) const
+	{
+		const ReflectedBlock* block = program.FindBlock(name.c_str());
+		if (!block)
+			return true;
+		GLint blockIndex = (GLint)(block - program.Blocks().data());
+		if (block->Binding != (GLint)bindingPoint)
+			return fail(mismatch, "is bound to " + std::to_string(block->Binding) + " instead of " + std::to_string(bindingPoint));
+		if (block->DataSize > (GLint)sizeof(Block))
+			return fail(mismatch, "takes " + std::to_string(block->DataSize) + " bytes, more than the " + std::to_string(sizeof(Block)) + " of its struct");
+		for (const ReflectedUniform& uniform : program.Uniforms())
+		{
+			if (uniform.Block != blockIndex)
+				continue;
+			const ParameterField* field = nullptr;
+			for (const ParameterField& candidate : layout)
+				if (uniform.Name == candidate.Name)
+					field = &candidate;
+			if (!field)
+				return fail(mismatch, "member " + uniform.Name + " has no field in its struct");
+			if (field->Type != uniform.Type)
+				return fail(mismatch, "member " + uniform.Name + " has another type than its field");
+			if (field->Offset != uniform.Offset)
+				return fail(mismatch, "member " + uniform.Name + " is at offset " + std::to_string(uniform.Offset) + ", its field at " + std::to_string(field->Offset));
+		}
+		return true;
+	}
+
+private:
+	std::string name;
+	GLuint bindingPoint = 0;
+	std::vector<ParameterField> layout;
+	size_t offsetAlignment = 256;
+	GLuint buffer = 0;
+	Block staging = Block();
+	Block uploaded = Block();
+	uint64_t uploadedFrame = ~0ull;
+
+	bool fail(std::string& mismatch, const std::string& what) const
+	{
+		mismatch = "uniform block " + name + " " + what;
+		return false;
+	}
+};
+
+#endif
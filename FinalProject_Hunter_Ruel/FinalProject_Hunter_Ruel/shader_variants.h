@@ -0,0 +1,223 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shader_batch.h"
+#include "shader_cache.h"
+
+// Shader permutations. One set of stage sources carries every feature behind #ifdef blocks, and a variant key (a
+// mask of Shader_Feature bits, worked out from what is being drawn) picks the features a program is built with:
+// each bit becomes a #define after the #version line. Every variant is a program of its own, so the GPU runs
+// straight-line code for exactly its features instead of branching on uniforms. Variants build in batches,
+// up front through Precompile() or on first use through Get(), and their binaries go to the shader cache.
+// The sources are watched like ShaderHotReload's; an edit rebuilds every variant built so far.
+
+enum Shader_Feature
+{
+	SHADER_TEXTURED = 1 << 0,      // color from uTexture rather than uBaseColor
+	SHADER_PLANAR_YCBCR = 1 << 1,  // uTexture, uTextureCb and uTextureCr are the planes of a JPEG; with TEXTURED
+	SHADER_LIT = 1 << 2,           // one directional light over flat normals
+	SHADER_INSTANCED = 1 << 3,     // model matrices from the GPU culling pass's object array
+	SHADER_ALPHA_TEST = 1 << 4     // discards fragments with alpha below uAlphaCutoff
+};
+
+#define SHADER_FEATURE_COUNT 5
+
+// the #define of each Shader_Feature bit, in bit order
+inline const char* UShaderFeatureName(int bit)
+{
+	static const char* const names[SHADER_FEATURE_COUNT] = { "TEXTURED", "PLANAR_YCBCR", "LIT", "INSTANCED", "ALPHA_TEST" };
+	return names[bit];
+}
+
+// A stage source with the key's features defined right after its #version line
+inline std::string USpecializeShader(const std::string& source, uint32_t key)
+{
+	std::string defines;
+	for (int bit = 0; bit < SHADER_FEATURE_COUNT; ++bit)
+		if (key & (1u << bit))
+			defines += std::string("#define ") + UShaderFeatureName(bit) + " 1\n";
+	size_t version = source.find("#version");
+	size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+	if (lineEnd == std::string::npos)
+		return defines + source;
+	return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+}
+
+class ShaderVariants
+{
+public:
+	// The stages' files and built-in sources, as for ShaderHotReload::Watch; cache may be null
+	void Create(const GLenum* types, const char* const* filenames, const char* const* builtInSources, size_t count, ShaderCache* cache)
+	{
+		Destroy();
+		sources.Watch(types, filenames, builtInSources, count);
+		shaderCache = cache;
+	}
+
+	// Deletes every variant; call while the context is still current
+	void Destroy()
+	{
+		collect(true);
+		reloading.Wait();
+		for (size_t i = 0; i < reloading.Size(); ++i)
+			if (reloading[i].Program)
+				glDeleteProgram(reloading[i].Program);
+		reloading.Clear();
+		reloadingKeys.clear();
+		reload = false;
+		for (const auto& variant : programs)
+			if (variant.second)
+				glDeleteProgram(variant.second);
+		programs.clear();
+	}
+
+	// Starts building these variants, skipping the ones built or building already, without waiting for them
+	void Precompile(const uint32_t* keys, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			if (programs.find(keys[i]) == programs.end() && !isBuilding(keys[i]))
+				add(building, buildingKeys, keys[i]);
+		building.Start(shaderCache);
+	}
+
+	// The program of a variant, waiting for it when it is still building and building it when nobody asked
+	// for it before. 0 when it doesn't build; Error() then has the log. The variants own their programs.
+	GLuint Get(uint32_t key)
+	{
+		auto found = programs.find(key);
+		if (found != programs.end())
+			return found->second;
+		if (!isBuilding(key))
+		{
+			add(building, buildingKeys, key);
+			building.Start(shaderCache);
+		}
+		collect(true);
+		return programs[key];
+	}
+
+	// Call once a frame. Collects finished precompiles and looks for edited sources; an edit rebuilds every
+	// variant in one batch, and the new programs replace the old ones together once all of them have linked
+	// and accept, if given, has passed each of them (it sets its error otherwise, and the old ones stay).
+	// After SHADER_RELOAD_SWAPPED, program ids from Get() are stale.
+	ShaderReload_Result Update(const std::function<bool(uint32_t key, GLuint program, std::string& error)>& accept = nullptr)
+	{
+		if (reload)
+		{
+			if (!reloading.Poll())
+				return SHADER_RELOAD_NONE;
+			reload = false;
+			bool linked = true;
+			for (size_t i = 0; i < reloadingKeys.size() && linked; ++i)
+				if (reloading[i].State != SHADER_LINKED)
+				{
+					error = reloading[i].Log;
+					linked = false;
+				}
+				else if (accept && !accept(reloadingKeys[i], reloading[i].Program, error))
+					linked = false;
+			for (size_t i = 0; i < reloadingKeys.size(); ++i)
+			{
+				GLuint& program = programs[reloadingKeys[i]];
+				if (!linked)
+				{
+					if (reloading[i].Program)
+						glDeleteProgram(reloading[i].Program);
+					continue;
+				}
+				if (program)
+					glDeleteProgram(program);
+				program = reloading[i].Program;
+			}
+			reloading.Clear();
+			reloadingKeys.clear();
+			return linked ? SHADER_RELOAD_SWAPPED : SHADER_RELOAD_FAILED;
+		}
+
+		collect(false);
+		if (sources.CheckForEdits() && !programs.empty())
+		{
+			collect(true);
+			for (const auto& variant : programs)
+				add(reloading, reloadingKeys, variant.first);
+			reloading.Start(shaderCache);
+			reload = true;
+		}
+		return SHADER_RELOAD_NONE;
+	}
+
+	// the build log of the last variant or edit that failed
+	const std::string& Error() const
+	{
+		return error;
+	}
+
+	size_t Count() const
+	{
+		return programs.size();
+	}
+
+private:
+	ShaderHotReload sources;
+	ShaderCache* shaderCache = nullptr;
+	std::unordered_map<uint32_t, GLuint> programs;   // 0 for variants that failed to build
+	ShaderBatch building;                            // variants not built yet; buildingKeys[i] is building[i]'s key
+	std::vector<uint32_t> buildingKeys;
+	ShaderBatch reloading;                           // the rebuild after an edit, likewise
+	std::vector<uint32_t> reloadingKeys;
+	bool reload = false;
+	std::string error;
+
+	bool isBuilding(uint32_t key) const
+	{
+		for (uint32_t pending : buildingKeys)
+			if (pending == key)
+				return true;
+		return false;
+	}
+
+	void add(ShaderBatch& batch, std::vector<uint32_t>& keys, uint32_t key)
+	{
+		std::vector<std::string> specialized;
+		std::vector<GLenum> types;
+		for (size_t i = 0; i < sources.StageCount(); ++i)
+		{
+			specialized.push_back(USpecializeShader(sources.StageSource(i), key));
+			types.push_back(sources.StageType(i));
+		}
+		std::vector<const char*> text;
+		for (const std::string& source : specialized)
+			text.push_back(source.c_str());
+		batch.Add(types.data(), text.data(), text.size());
+		keys.push_back(key);
+	}
+
+	// moves the precompiled variants into programs once the whole batch is done, or right away when block
+	void collect(bool block)
+	{
+		if (buildingKeys.empty())
+			return;
+		if (block)
+			building.Wait();
+		else if (!building.Poll())
+			return;
+		for (size_t i = 0; i < buildingKeys.size(); ++i)
+		{
+			programs[buildingKeys[i]] = building[i].Program;
+			if (building[i].State != SHADER_LINKED)
+				error = building[i].Log;
+		}
+		building.Clear();
+		buildingKeys.clear();
+	}
+};
+
+#endif
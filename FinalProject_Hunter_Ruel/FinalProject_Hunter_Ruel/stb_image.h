@@ -365,6 +365,16 @@ extern "C" {
 	STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
 
+#ifndef STBI_NO_JPEG
+	// JPEG only: returns the Y, Cb and Cr planes at their coded resolutions, skipping chroma upsampling
+	// and color conversion. The planes are stored one after another, each tightly packed, in a single
+	// allocation freed with stbi_image_free. plane_w/plane_h receive the size of each plane and
+	// plane_hs/plane_vs how many image pixels one sample covers (2,2 for the chroma of a 4:2:0 file).
+	// Fails for anything that isn't three-component YCbCr (grayscale, RGB, CMYK), so callers can fall
+	// back to stbi_load_from_memory. Honors the vertical flip setting.
+	STBIDEF stbi_uc *stbi_load_jpeg_ycbcr_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int plane_w[3], int plane_h[3], int plane_hs[3], int plane_vs[3]);
+#endif
+
 #ifdef STBI_WINDOWS_UTF8
 	STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -406,6 +416,19 @@ extern "C" {
 	STBIDEF void   stbi_ldr_to_hdr_scale(float scale);
 #endif // STBI_NO_LINEAR
 
+	// as above, but only applies to images loaded on the thread that calls the function;
+	// like stbi_set_flip_vertically_on_load_thread, these fail to link if your compiler
+	// doesn't support thread-local variables
+#ifndef STBI_NO_HDR
+	STBIDEF void   stbi_hdr_to_ldr_gamma_thread(float gamma);
+	STBIDEF void   stbi_hdr_to_ldr_scale_thread(float scale);
+#endif // STBI_NO_HDR
+
+#ifndef STBI_NO_LINEAR
+	STBIDEF void   stbi_ldr_to_hdr_gamma_thread(float gamma);
+	STBIDEF void   stbi_ldr_to_hdr_scale_thread(float scale);
+#endif // STBI_NO_LINEAR
+
 	// stbi_is_hdr is always defined, but always returns false if STBI_NO_HDR
 	STBIDEF int    stbi_is_hdr_from_callbacks(stbi_io_callbacks const *clbk, void *user);
 	STBIDEF int    stbi_is_hdr_from_memory(stbi_uc const *buffer, int len);
@@ -567,12 +590,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -730,6 +755,7 @@ typedef struct
 	int read_from_callbacks;
 	int buflen;
 	stbi_uc buffer_start[128];
+	int callback_already_read;
 
 	stbi_uc *img_buffer, *img_buffer_end;
 	stbi_uc *img_buffer_original, *img_buffer_original_end;
@@ -743,6 +769,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
 	s->io.read = NULL;
 	s->read_from_callbacks = 0;
+	s->callback_already_read = 0;
 	s->img_buffer = s->img_buffer_original = (stbi_uc *)buffer;
 	s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *)buffer + len;
 }
@@ -754,7 +781,8 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
 	s->io_user_data = user;
 	s->buflen = sizeof(s->buffer_start);
 	s->read_from_callbacks = 1;
-	s->img_buffer_original = s->buffer_start;
+	s->callback_already_read = 0;
+	s->img_buffer = s->img_buffer_original = s->buffer_start;
 	stbi__refill_buffer(s);
 	s->img_buffer_original_end = s->img_buffer_end;
 }
@@ -1451,16 +1479,44 @@ STBIDEF int      stbi_is_hdr_from_callbacks(stbi_io_callbacks const *clbk, void
 }
 
 #ifndef STBI_NO_LINEAR
-static float stbi__l2h_gamma = 2.2f, stbi__l2h_scale = 1.0f;
+static float stbi__l2h_gamma_global = 2.2f, stbi__l2h_scale_global = 1.0f;
+
+STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma) { stbi__l2h_gamma_global = gamma; }
+STBIDEF void   stbi_ldr_to_hdr_scale(float scale) { stbi__l2h_scale_global = scale; }
 
-STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma) { stbi__l2h_gamma = gamma; }
-STBIDEF void   stbi_ldr_to_hdr_scale(float scale) { stbi__l2h_scale = scale; }
+#ifndef STBI_THREAD_LOCAL
+#define stbi__l2h_gamma  stbi__l2h_gamma_global
+#define stbi__l2h_scale  stbi__l2h_scale_global
+#else
+static STBI_THREAD_LOCAL float stbi__l2h_gamma_local, stbi__l2h_scale_local;
+static STBI_THREAD_LOCAL int stbi__l2h_gamma_set, stbi__l2h_scale_set;
+
+STBIDEF void   stbi_ldr_to_hdr_gamma_thread(float gamma) { stbi__l2h_gamma_local = gamma; stbi__l2h_gamma_set = 1; }
+STBIDEF void   stbi_ldr_to_hdr_scale_thread(float scale) { stbi__l2h_scale_local = scale; stbi__l2h_scale_set = 1; }
+
+#define stbi__l2h_gamma  (stbi__l2h_gamma_set ? stbi__l2h_gamma_local : stbi__l2h_gamma_global)
+#define stbi__l2h_scale  (stbi__l2h_scale_set ? stbi__l2h_scale_local : stbi__l2h_scale_global)
+#endif // STBI_THREAD_LOCAL
 #endif
 
-static float stbi__h2l_gamma_i = 1.0f / 2.2f, stbi__h2l_scale_i = 1.0f;
+static float stbi__h2l_gamma_i_global = 1.0f / 2.2f, stbi__h2l_scale_i_global = 1.0f;
 
-STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma) { stbi__h2l_gamma_i = 1 / gamma; }
-STBIDEF void   stbi_hdr_to_ldr_scale(float scale) { stbi__h2l_scale_i = 1 / scale; }
+STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma) { stbi__h2l_gamma_i_global = 1 / gamma; }
+STBIDEF void   stbi_hdr_to_ldr_scale(float scale) { stbi__h2l_scale_i_global = 1 / scale; }
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__h2l_gamma_i  stbi__h2l_gamma_i_global
+#define stbi__h2l_scale_i  stbi__h2l_scale_i_global
+#else
+static STBI_THREAD_LOCAL float stbi__h2l_gamma_i_local, stbi__h2l_scale_i_local;
+static STBI_THREAD_LOCAL int stbi__h2l_gamma_i_set, stbi__h2l_scale_i_set;
+
+STBIDEF void   stbi_hdr_to_ldr_gamma_thread(float gamma) { stbi__h2l_gamma_i_local = 1 / gamma; stbi__h2l_gamma_i_set = 1; }
+STBIDEF void   stbi_hdr_to_ldr_scale_thread(float scale) { stbi__h2l_scale_i_local = 1 / scale; stbi__h2l_scale_i_set = 1; }
+
+#define stbi__h2l_gamma_i  (stbi__h2l_gamma_i_set ? stbi__h2l_gamma_i_local : stbi__h2l_gamma_i_global)
+#define stbi__h2l_scale_i  (stbi__h2l_scale_i_set ? stbi__h2l_scale_i_local : stbi__h2l_scale_i_global)
+#endif // STBI_THREAD_LOCAL
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1478,6 +1534,7 @@ enum
 static void stbi__refill_buffer(stbi__context *s)
 {
 	int n = (s->io.read)(s->io_user_data, (char*)s->buffer_start, s->buflen);
+	s->callback_already_read += (int)(s->img_buffer - s->img_buffer_original);
 	if (n == 0) {
 		// at end of file, treat same as if from memory, but need to handle case
 		// where s->img_buffer isn't pointing to safe memory, e.g. 0-byte file
@@ -1813,7 +1870,10 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
 #ifndef STBI_NO_JPEG
 
 // huffman decoding acceleration
-#define FAST_BITS   9  // larger handles more cases; smaller stomps less cache
+#define FAST_BITS   11 // larger handles more cases; smaller stomps less cache
+
+// how far ahead of the read position stbi__grow_buffer_unsafe looks for the next 0xFF in one go
+#define STBI__JPEG_CLEAN_SCAN  512
 
 typedef struct
 {
@@ -1856,10 +1916,11 @@ typedef struct
 		int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
 	} img_comp[4];
 
-	stbi__uint32   code_buffer; // jpeg entropy-coded buffer
+	stbi__uint64   code_buffer; // jpeg entropy-coded buffer, valid bits are at the top
 	int            code_bits;   // number of valid bits
 	unsigned char  marker;      // marker seen while filling entropy buffer
 	int            nomore;      // flag if we saw a marker so must stop
+	stbi_uc       *clean_end;   // the entropy-coded bytes up to here hold no 0xFF (memory input only)
 
 	int            progressive;
 	int            spec_start;
@@ -1878,6 +1939,7 @@ typedef struct
 	void(*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
 	void(*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
 	stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+	stbi_uc *(*find_ff_kernel)(stbi_uc *p, stbi_uc *end);
 } stbi__jpeg;
 
 static int stbi__build_huffman(stbi__huffman *h, int *count)
@@ -1949,22 +2011,97 @@ static void stbi__build_fast_ac(stbi__int16 *fast_ac, stbi__huffman *h)
 	}
 }
 
+// returns the first 0xFF in [p, end), or end. Entropy-coded data only contains 0xFF as the
+// start of a stuffed 0xFF00 or of a marker, so everything before it can be taken as plain bits.
+static stbi_uc *stbi__find_ff(stbi_uc *p, stbi_uc *end)
+{
+	// eight bytes at a time: a byte is 0xFF iff its complement is zero
+	while (end - p >= 8) {
+		stbi__uint64 v;
+		memcpy(&v, p, 8);
+		v = ~v;
+		if ((v - 0x0101010101010101ull) & ~v & 0x8080808080808080ull)
+			break;
+		p += 8;
+	}
+	while (p < end && *p != 0xff)
+		++p;
+	return p;
+}
+
+#ifdef STBI_SSE2
+static stbi_uc *stbi__find_ff_simd(stbi_uc *p, stbi_uc *end)
+{
+	__m128i ff = _mm_set1_epi8(-1);
+	while (end - p >= 16) {
+		__m128i bytes = _mm_loadu_si128((__m128i *) p);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, ff)))
+			break;
+		p += 16;
+	}
+	while (p < end && *p != 0xff)
+		++p;
+	return p;
+}
+#endif
+
+// load 8 bytes as a big-endian integer, so the first byte lands in the top bits
+stbi_inline static stbi__uint64 stbi__jpeg_load64be(stbi_uc const *p)
+{
+	stbi__uint64 v;
+#if defined(_MSC_VER)
+	memcpy(&v, p, 8);
+	return _byteswap_uint64(v);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(&v, p, 8);
+	return __builtin_bswap64(v);
+#else
+	int i;
+	v = 0;
+	for (i = 0; i < 8; ++i)
+		v = (v << 8) | p[i];
+	return v;
+#endif
+}
+
+// top the bit reservoir up to at least 57 bits, or stop at a marker
 static void stbi__grow_buffer_unsafe(stbi__jpeg *j)
 {
+	stbi__context *s = j->s;
 	do {
-		unsigned int b = j->nomore ? 0 : stbi__get8(j->s);
+		unsigned int b;
+		// bulk path: bytes already known to hold no 0xFF go in as many at a time as fit.
+		// Only for memory input; the callback buffer gets reused under us.
+		if (!j->nomore && !s->read_from_callbacks) {
+			if (j->clean_end - s->img_buffer < 8) {
+				stbi_uc *end = s->img_buffer_end - s->img_buffer > STBI__JPEG_CLEAN_SCAN ? s->img_buffer + STBI__JPEG_CLEAN_SCAN : s->img_buffer_end;
+				j->clean_end = j->find_ff_kernel(s->img_buffer, end);
+			}
+			if (j->clean_end - s->img_buffer >= 8) {
+				int bytes = (64 - j->code_bits) >> 3;
+				stbi__uint64 v = stbi__jpeg_load64be(s->img_buffer);
+				if (bytes < 8) v &= ~(~(stbi__uint64)0 >> (bytes * 8));
+				j->code_buffer |= v >> j->code_bits;
+				j->code_bits += bytes * 8;
+				s->img_buffer += bytes;
+				return;
+			}
+		}
+
+		// one byte at a time through stuffing, markers and the end of the data
+		b = j->nomore ? 0 : stbi__get8(s);
 		if (b == 0xff) {
-			int c = stbi__get8(j->s);
-			while (c == 0xff) c = stbi__get8(j->s); // consume fill bytes
+			int c = stbi__get8(s);
+			while (c == 0xff) c = stbi__get8(s); // consume fill bytes
 			if (c != 0) {
 				j->marker = (unsigned char)c;
 				j->nomore = 1;
 				return;
 			}
 		}
-		j->code_buffer |= b << (24 - j->code_bits);
+		j->code_buffer |= (stbi__uint64)b << (56 - j->code_bits);
 		j->code_bits += 8;
-	} while (j->code_bits <= 24);
+	} while (j->code_bits <= 56);
 }
 
 // (1 << n) - 1
@@ -1980,7 +2117,7 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 
 	// look at the top FAST_BITS and determine what symbol ID it is,
 	// if the code is <= FAST_BITS
-	c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS) - 1);
+	c = (int)(j->code_buffer >> (64 - FAST_BITS));
 	k = h->fast[c];
 	if (k < 255) {
 		int s = h->size[k];
@@ -1997,7 +2134,7 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 	// end; in other words, regardless of the number of bits, it
 	// wants to be compared against something shifted to have 16;
 	// that way we don't need to shift inside the loop.
-	temp = j->code_buffer >> 16;
+	temp = (unsigned int)(j->code_buffer >> 48);
 	for (k = FAST_BITS + 1; ; ++k)
 		if (temp < h->maxcode[k])
 			break;
@@ -2011,8 +2148,8 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 		return -1;
 
 	// convert the huffman code to the symbol id
-	c = ((j->code_buffer >> (32 - k)) & stbi__bmask[k]) + h->delta[k];
-	STBI_ASSERT((((j->code_buffer) >> (32 - h->size[c])) & stbi__bmask[h->size[c]]) == h->code[c]);
+	c = (int)(j->code_buffer >> (64 - k)) + h->delta[k];
+	STBI_ASSERT((j->code_buffer >> (64 - h->size[c])) == h->code[c]);
 
 	// convert the id to a symbol
 	j->code_bits -= k;
@@ -2031,11 +2168,10 @@ stbi_inline static int stbi__extend_receive(stbi__jpeg *j, int n)
 	int sgn;
 	if (j->code_bits < n) stbi__grow_buffer_unsafe(j);
 
-	sgn = (stbi__int32)j->code_buffer >> 31; // sign bit is always in MSB
-	k = stbi_lrot(j->code_buffer, n);
+	sgn = (stbi__int32)(j->code_buffer >> 32) >> 31; // sign bit is always in MSB
 	STBI_ASSERT(n >= 0 && n < (int)(sizeof(stbi__bmask) / sizeof(*stbi__bmask)));
-	j->code_buffer = k & ~stbi__bmask[n];
-	k &= stbi__bmask[n];
+	k = (unsigned int)((j->code_buffer >> 32) >> (32 - n)); // two shifts so n == 0 stays defined
+	j->code_buffer <<= n;
 	j->code_bits -= n;
 	return k + (stbi__jbias[n] & ~sgn);
 }
@@ -2045,9 +2181,8 @@ stbi_inline static int stbi__jpeg_get_bits(stbi__jpeg *j, int n)
 {
 	unsigned int k;
 	if (j->code_bits < n) stbi__grow_buffer_unsafe(j);
-	k = stbi_lrot(j->code_buffer, n);
-	j->code_buffer = k & ~stbi__bmask[n];
-	k &= stbi__bmask[n];
+	k = (unsigned int)((j->code_buffer >> 32) >> (32 - n));
+	j->code_buffer <<= n;
 	j->code_bits -= n;
 	return k;
 }
@@ -2056,10 +2191,10 @@ stbi_inline static int stbi__jpeg_get_bit(stbi__jpeg *j)
 {
 	unsigned int k;
 	if (j->code_bits < 1) stbi__grow_buffer_unsafe(j);
-	k = j->code_buffer;
+	k = (unsigned int)(j->code_buffer >> 63);
 	j->code_buffer <<= 1;
 	--j->code_bits;
-	return k & 0x80000000;
+	return k;
 }
 
 // given a value that's at position X in the zigzag stream,
@@ -2103,7 +2238,7 @@ static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman
 		unsigned int zig;
 		int c, r, s;
 		if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
-		c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS) - 1);
+		c = (int)(j->code_buffer >> (64 - FAST_BITS));
 		r = fac[c];
 		if (r) { // fast-AC path
 			k += (r >> 4) & 15; // run
@@ -2180,7 +2315,7 @@ static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__
 			unsigned int zig;
 			int c, r, s;
 			if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
-			c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS) - 1);
+			c = (int)(j->code_buffer >> (64 - FAST_BITS));
 			r = fac[c];
 			if (r) { // fast-AC path
 				k += (r >> 4) & 15; // run
@@ -2815,6 +2950,7 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
 	j->code_bits = 0;
 	j->code_buffer = 0;
 	j->nomore = 0;
+	j->clean_end = j->s->img_buffer;
 	j->img_comp[0].dc_pred = j->img_comp[1].dc_pred = j->img_comp[2].dc_pred = j->img_comp[3].dc_pred = 0;
 	j->marker = STBI__MARKER_none;
 	j->todo = j->restart_interval ? j->restart_interval : 0x7fffffff;
@@ -3680,12 +3816,14 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
 	j->idct_block_kernel = stbi__idct_block;
 	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
 	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
+	j->find_ff_kernel = stbi__find_ff;
 
 #ifdef STBI_SSE2
 	if (stbi__sse2_available()) {
 		j->idct_block_kernel = stbi__idct_simd;
 		j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
 		j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+		j->find_ff_kernel = stbi__find_ff_simd;
 	}
 #endif
 
@@ -3932,6 +4070,70 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 	STBI_FREE(j);
 	return result;
 }
+
+// decode to YCbCr and copy the component planes out as they are, without resampling
+static stbi_uc *stbi__jpeg_load_ycbcr(stbi__jpeg *z, int *out_x, int *out_y, int *plane_w, int *plane_h, int *plane_hs, int *plane_vs)
+{
+	int k;
+	size_t total = 0;
+	stbi_uc *output, *out;
+	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+	if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+
+	// same test load_jpeg_image uses to skip color conversion
+	if (z->s->img_n != 3 || z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif)) {
+		stbi__cleanup_jpeg(z);
+		return stbi__errpuc("not YCbCr", "JPEG doesn't store 3-component YCbCr");
+	}
+
+	for (k = 0; k < 3; ++k) {
+		if (z->img_h_max % z->img_comp[k].h || z->img_v_max % z->img_comp[k].v) {
+			stbi__cleanup_jpeg(z);
+			return stbi__errpuc("bad sampling", "Unsupported JPEG chroma sampling");
+		}
+		plane_hs[k] = z->img_h_max / z->img_comp[k].h;
+		plane_vs[k] = z->img_v_max / z->img_comp[k].v;
+		plane_w[k] = (z->s->img_x + plane_hs[k] - 1) / plane_hs[k];
+		plane_h[k] = (z->s->img_y + plane_vs[k] - 1) / plane_vs[k];
+		total += (size_t)plane_w[k] * plane_h[k]; // each plane fits inside its already allocated w2*h2 buffer
+	}
+
+	output = (stbi_uc *)stbi__malloc(total);
+	if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
+	out = output;
+	for (k = 0; k < 3; ++k) {
+		int j;
+		for (j = 0; j < plane_h[k]; ++j) {
+			int row = stbi__vertically_flip_on_load ? plane_h[k] - 1 - j : j;
+			memcpy(out, z->img_comp[k].data + z->img_comp[k].w2 * row, plane_w[k]);
+			out += plane_w[k];
+		}
+	}
+
+	stbi__cleanup_jpeg(z);
+	*out_x = z->s->img_x;
+	*out_y = z->s->img_y;
+	return output;
+}
+
+STBIDEF stbi_uc *stbi_load_jpeg_ycbcr_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int plane_w[3], int plane_h[3], int plane_hs[3], int plane_vs[3])
+{
+	stbi_uc *result;
+	stbi__jpeg *j;
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	if (!stbi__jpeg_test(&s)) return stbi__errpuc("not JPEG", "Image is not a JPEG");
+
+	j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (!j) return stbi__errpuc("outofmem", "Out of memory");
+	j->s = &s;
+	stbi__setup_jpeg(j);
+	result = stbi__jpeg_load_ycbcr(j, x, y, plane_w, plane_h, plane_hs, plane_vs);
+	STBI_FREE(j);
+	return result;
+}
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
@@ -5366,7 +5568,8 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
 			psize = (info.offset - info.extra_read - info.hsz) >> 2;
 	}
 	if (psize == 0) {
-		STBI_ASSERT(info.offset == (s->img_buffer - s->buffer_start));
+		// offset from the start of the stream, whether it came from memory or from refilled callback buffers
+		STBI_ASSERT(info.offset == s->callback_already_read + (int)(s->img_buffer - s->img_buffer_original));
 	}
 
 	if (info.bpp == 24 && ma == 0xff000000)
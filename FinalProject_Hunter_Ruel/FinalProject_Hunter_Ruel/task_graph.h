@@ -0,0 +1,172 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+// A frame's CPU work as a dependency graph. Each task names the tasks it has to wait for; Run() starts the
+// ones with nothing left to wait for on the pool and, as each task finishes, those whose last prerequisite it
+// was. Tasks that touch OpenGL (or GLFW) are TASK_MAIN_THREAD and run on the thread that calls Run(), in
+// between its turns at the pool's other work, so independent CPU work overlaps with them. The graph is built
+// once and run every frame.
+
+enum Task_Affinity
+{
+	TASK_ANY_THREAD,
+	TASK_MAIN_THREAD
+};
+
+struct TaskGraphStats
+{
+	uint32_t Tasks = 0;
+	uint32_t MainThreadTasks = 0;
+	double Milliseconds = 0.0;      // wall time of the last Run()
+	double TaskMilliseconds = 0.0;  // time its tasks took added up; above Milliseconds when they overlapped
+};
+
+class TaskGraph
+{
+public:
+	// Returns the task's id, for After(). The work must not Run() the graph itself.
+	size_t Add(const char* name, std::function<void()> work, Task_Affinity affinity = TASK_ANY_THREAD)
+	{
+		Task task;
+		task.Name = name;
+		task.Work = std::move(work);
+		task.Affinity = affinity;
+		tasks.push_back(std::move(task));
+		checked = false;
+		return tasks.size() - 1;
+	}
+
+	// task starts only once prerequisite has finished
+	void After(size_t task, size_t prerequisite)
+	{
+		tasks[prerequisite].Dependents.push_back(task);
+		++tasks[task].Prerequisites;
+		checked = false;
+	}
+
+	void Clear()
+	{
+		tasks.clear();
+		checked = false;
+	}
+
+	// Runs every task once and returns when they have all finished. Call from the pool's main thread. Returns
+	// false, running nothing, when the dependencies have a cycle; Cycle() then names a task caught in it.
+	bool Run(ThreadPool& pool = GetSharedThreadPool())
+	{
+		if (!checked && !checkAcyclic())
+			return false;
+		checked = true;
+
+		auto start = std::chrono::steady_clock::now();
+		remaining.reset(new std::atomic<size_t>[tasks.size()]);
+		milliseconds.assign(tasks.size(), 0.0);
+		for (size_t i = 0; i < tasks.size(); ++i)
+			remaining[i] = tasks[i].Prerequisites;
+
+		JobCounter running;
+		for (size_t i = 0; i < tasks.size(); ++i)
+			if (tasks[i].Prerequisites == 0)
+				launch(i, pool, running);
+		pool.Wait(running);
+
+		stats = TaskGraphStats();
+		stats.Tasks = (uint32_t)tasks.size();
+		for (size_t i = 0; i < tasks.size(); ++i)
+		{
+			stats.MainThreadTasks += tasks[i].Affinity == TASK_MAIN_THREAD ? 1 : 0;
+			stats.TaskMilliseconds += milliseconds[i];
+		}
+		stats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return true;
+	}
+
+	const std::string& Cycle() const
+	{
+		return cycle;
+	}
+
+	const TaskGraphStats& Stats() const
+	{
+		return stats;
+	}
+
+private:
+	struct Task
+	{
+		std::string Name;
+		std::function<void()> Work;
+		Task_Affinity Affinity = TASK_ANY_THREAD;
+		std::vector<size_t> Dependents;
+		size_t Prerequisites = 0;
+	};
+
+	std::vector<Task> tasks;
+	std::unique_ptr<std::atomic<size_t>[]> remaining;  // prerequisites not yet finished, per task
+	std::vector<double> milliseconds;                   // each written by its own task only
+	bool checked = false;
+	std::string cycle;
+	TaskGraphStats stats;
+
+	// Queues a task whose prerequisites are done. The dependents it releases are counted before it finishes,
+	// so running only reaches zero with the last task.
+	void launch(size_t index, ThreadPool& pool, JobCounter& running)
+	{
+		auto job = [this, index, &pool, &running]
+		{
+			auto start = std::chrono::steady_clock::now();
+			tasks[index].Work();
+			milliseconds[index] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			for (size_t dependent : tasks[index].Dependents)
+				if (remaining[dependent].fetch_sub(1) == 1)
+					launch(dependent, pool, running);
+		};
+		if (tasks[index].Affinity == TASK_MAIN_THREAD)
+			pool.SubmitToMainThread(job, &running);
+		else
+			pool.Submit(job, &running);
+	}
+
+	// Kahn's algorithm: whatever can't be reached by removing tasks without prerequisites is on a cycle
+	bool checkAcyclic()
+	{
+		std::vector<size_t> waiting(tasks.size());
+		std::vector<size_t> ready;
+		for (size_t i = 0; i < tasks.size(); ++i)
+		{
+			waiting[i] = tasks[i].Prerequisites;
+			if (waiting[i] == 0)
+				ready.push_back(i);
+		}
+		size_t visited = 0;
+		while (!ready.empty())
+		{
+			size_t task = ready.back();
+			ready.pop_back();
+			++visited;
+			for (size_t dependent : tasks[task].Dependents)
+				if (--waiting[dependent] == 0)
+					ready.push_back(dependent);
+		}
+		cycle.clear();
+		for (size_t i = 0; i < tasks.size() && visited < tasks.size(); ++i)
+			if (waiting[i] > 0)
+			{
+				cycle = tasks[i].Name;
+				return false;
+			}
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,287 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run queued tasks. Only CPU work goes through the pool;
+// anything that touches OpenGL has to stay on the thread that owns the context.
+//
+// Every worker has a deque of its own. Tasks a worker submits go on its deque and it takes them back newest
+// first, while their data is still in its cache; a worker whose deque is empty steals the oldest task of
+// another, which tends to be the biggest piece of work left. Tasks submitted from outside the pool are dealt
+// out over the deques in turn. Threads that wait on a JobCounter run queued tasks until it reaches zero, and
+// the main thread (the one that created the pool, which has to be the GL thread) also runs the tasks
+// submitted with SubmitToMainThread(), so per-frame work can hand GL calls back to it.
+
+// Counts jobs that haven't finished; see ThreadPool::Submit() and ThreadPool::Wait()
+class JobCounter
+{
+public:
+	void Add(int jobs = 1)
+	{
+		pending.fetch_add(jobs);
+	}
+
+	// true when this was the last job
+	bool Finish()
+	{
+		return pending.fetch_sub(1) == 1;
+	}
+
+	bool IsDone() const
+	{
+		return pending.load() == 0;
+	}
+
+private:
+	std::atomic<int> pending{ 0 };
+};
+
+class ThreadPool
+{
+public:
+	// threadCount of 0 uses one worker per hardware thread but one, which is left to the thread that waits
+	explicit ThreadPool(unsigned threadCount = 0)
+		: mainThread(std::this_thread::get_id())
+	{
+		if (threadCount == 0)
+			threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+		queues = std::vector<WorkerQueue>(threadCount);
+		for (unsigned i = 0; i < threadCount; ++i)
+			workers.emplace_back([this, i] { workerLoop(i); });
+	}
+
+	// Finishes the queued tasks; main thread tasks that nobody waited for are dropped
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		sleepCondition.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned GetThreadCount() const
+	{
+		return (unsigned)workers.size();
+	}
+
+	// queues a task to run on one of the workers; counter, if any, counts it until it has run
+	void Submit(std::function<void()> task, JobCounter* counter = nullptr)
+	{
+		if (counter)
+			counter->Add();
+		size_t worker = currentWorker();
+		if (worker == NOT_A_WORKER)
+			worker = nextQueue.fetch_add(1) % queues.size();
+		{
+			std::lock_guard<std::mutex> lock(queues[worker].Mutex);
+			queues[worker].Tasks.push_back(Job{ std::move(task), counter });
+		}
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			++queued;
+		}
+		sleepCondition.notify_one();
+	}
+
+	// queues a task that only the main thread runs, the next time it waits on the pool
+	void SubmitToMainThread(std::function<void()> task, JobCounter* counter = nullptr)
+	{
+		if (counter)
+			counter->Add();
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			mainTasks.push_back(Job{ std::move(task), counter });
+		}
+		// notify_one could wake a worker, which can't take it
+		sleepCondition.notify_all();
+	}
+
+	// Returns once counter reaches zero, running queued tasks (and on the main thread, main thread tasks)
+	// meanwhile, so waiting from inside a task doesn't take a thread away from the pool. A main thread task
+	// that waits only runs pool tasks, so main thread tasks never interleave their GL calls.
+	void Wait(const JobCounter& counter)
+	{
+		size_t worker = currentWorker();
+		bool isMain = worker == NOT_A_WORKER && std::this_thread::get_id() == mainThread && !inMainTask;
+		while (!counter.IsDone())
+		{
+			if (runOne(worker, isMain))
+				continue;
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			sleepCondition.wait(lock, [&] { return counter.IsDone() || queued > 0 || (isMain && !mainTasks.empty()); });
+		}
+	}
+
+	// runs body(i) for every i in [0, count) and returns once all of them have finished.
+	// The calling thread takes part, so this is safe to call from inside a pool task.
+	void ParallelFor(size_t count, const std::function<void(size_t)>& body)
+	{
+		if (count == 0)
+			return;
+
+		// indices are handed out one at a time, so uneven items balance out; Wait() covers the helpers that
+		// only start once every index has been taken
+		std::atomic<size_t> next{ 0 };
+		auto drain = [&]
+		{
+			size_t i;
+			while ((i = next.fetch_add(1)) < count)
+				body(i);
+		};
+
+		JobCounter helpers;
+		size_t helperCount = std::min<size_t>(workers.size(), count - 1);
+		for (size_t i = 0; i < helperCount; ++i)
+			Submit(drain, &helpers);
+		drain();
+		Wait(helpers);
+	}
+
+private:
+	static const size_t NOT_A_WORKER = ~(size_t)0;
+
+	struct Job
+	{
+		std::function<void()> Task;
+		JobCounter* Counter = nullptr;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex Mutex;
+		std::deque<Job> Tasks;
+	};
+
+	std::thread::id mainThread;
+	std::vector<std::thread> workers;
+	std::vector<WorkerQueue> queues;
+	std::atomic<size_t> nextQueue{ 0 };
+	std::deque<Job> mainTasks;        // guarded by sleepMutex
+	bool inMainTask = false;          // main thread only
+	std::atomic<size_t> queued{ 0 };  // tasks in the worker deques; raised under sleepMutex
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+	bool stopping = false;
+
+	// which of this pool's workers the calling thread is
+	size_t currentWorker() const
+	{
+		return workerPool() == this ? workerIndex() : NOT_A_WORKER;
+	}
+
+	static const ThreadPool*& workerPool()
+	{
+		static thread_local const ThreadPool* pool = nullptr;
+		return pool;
+	}
+
+	static size_t& workerIndex()
+	{
+		static thread_local size_t index = NOT_A_WORKER;
+		return index;
+	}
+
+	// Takes a task (a main thread one first when allowed, then the worker's own newest, then the oldest of
+	// another deque) and runs it; false when there was none
+	bool runOne(size_t worker, bool isMain)
+	{
+		Job job;
+		bool mainTask = isMain && takeMainTask(job);
+		if (!mainTask && !takeTask(worker, job))
+			return false;
+		if (mainTask)
+			inMainTask = true;
+		job.Task();
+		if (mainTask)
+			inMainTask = false;
+		if (job.Counter && job.Counter->Finish())
+		{
+			// waiters check their counters under the lock, so this can't slip in between check and sleep
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			sleepCondition.notify_all();
+		}
+		return true;
+	}
+
+	bool takeMainTask(Job& job)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		if (mainTasks.empty())
+			return false;
+		job = std::move(mainTasks.front());
+		mainTasks.pop_front();
+		return true;
+	}
+
+	bool takeTask(size_t worker, Job& job)
+	{
+		if (queued == 0)
+			return false;
+		if (worker != NOT_A_WORKER)
+		{
+			WorkerQueue& own = queues[worker];
+			std::lock_guard<std::mutex> lock(own.Mutex);
+			if (!own.Tasks.empty())
+			{
+				job = std::move(own.Tasks.back());
+				own.Tasks.pop_back();
+				--queued;
+				return true;
+			}
+		}
+		size_t first = worker == NOT_A_WORKER ? 0 : worker + 1;
+		for (size_t i = 0; i < queues.size(); ++i)
+		{
+			WorkerQueue& victim = queues[(first + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.Mutex);
+			if (!victim.Tasks.empty())
+			{
+				job = std::move(victim.Tasks.front());
+				victim.Tasks.pop_front();
+				--queued;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void workerLoop(size_t index)
+	{
+		workerPool() = this;
+		workerIndex() = index;
+		for (;;)
+		{
+			if (runOne(index, false))
+				continue;
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			if (stopping && queued == 0)
+				return;
+			sleepCondition.wait(lock, [this] { return stopping || queued > 0; });
+		}
+	}
+};
+
+// the pool shared by the loaders and per-frame CPU work; first used from the GL thread, which makes it
+// the pool's main thread
+inline ThreadPool& GetSharedThreadPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Attribute locations every vertex shader uses ("layout(location = N) in ...")
+enum Vertex_Attribute {
+	ATTRIBUTE_POSITION = 0,
+	ATTRIBUTE_COLOR = 1,
+	ATTRIBUTE_TEXCOORD = 2,
+	ATTRIBUTE_NORMAL = 3,
+	ATTRIBUTE_COUNT
+};
+
+// One level of detail: a range of the index buffer drawn over the shared vertices
+struct MeshLod
+{
+	uint32_t FirstIndex;
+	uint32_t IndexCount;
+	float Error;    // how far, in model-space units, this level can be from LOD 0
+};
+
+// A cluster of LOD 0 triangles that is culled as a unit, from UBuildMeshlets
+struct Meshlet
+{
+	uint32_t FirstIndex;
+	uint32_t IndexCount;
+	glm::vec3 Center;   // bounding sphere in model space
+	float Radius;
+	glm::vec3 ConeAxis; // average facing
+	float ConeCutoff;   // sine of the angle between the axis and the widest triangle normal; 1 never culls
+};
+
+// A mesh as authored or imported, one entry per vertex in every non-empty array
+struct MeshData
+{
+	std::vector<glm::vec3> Positions;
+	std::vector<glm::vec4> Colors;
+	std::vector<glm::vec2> TexCoords;
+	std::vector<glm::vec3> Normals;
+	std::vector<uint32_t> Indices;
+	std::vector<MeshLod> Lods;     // from UGenerateLods; empty means all of Indices is LOD 0
+	std::vector<Meshlet> Meshlets; // from UBuildMeshlets, covering LOD 0
+};
+
+// One attribute of a packed vertex, in the terms glVertexAttribFormat wants
+struct VertexAttribute
+{
+	GLuint Location;
+	GLint Components;
+	GLenum Type;
+	GLboolean Normalized;
+	GLuint Offset;
+};
+
+// A mesh packed for the GPU, independent of any GL objects so it can be built off the render thread
+struct PackedMesh
+{
+	std::vector<unsigned char> Vertices;
+	std::vector<unsigned char> Indices;
+	std::vector<VertexAttribute> Attributes;
+	GLsizei Stride = 0;
+	GLuint VertexCount = 0;
+	GLuint IndexCount = 0;
+	GLenum IndexType = GL_UNSIGNED_SHORT;
+	std::vector<MeshLod> Lods;     // at least one
+	std::vector<Meshlet> Meshlets;
+	glm::vec3 DequantizeScale = glm::vec3(1.0f);  // quantized position * scale + offset = model-space position
+	glm::vec3 DequantizeOffset = glm::vec3(0.0f);
+
+	// put in front of the model matrix
+	glm::mat4 Dequantize() const
+	{
+		return glm::scale(glm::translate(glm::mat4(1.0f), DequantizeOffset), DequantizeScale);
+	}
+};
+
+inline int16_t UQuantizeSnorm16(float v)
+{
+	return (int16_t)std::lround(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f);
+}
+
+inline uint16_t UQuantizeUnorm16(float v)
+{
+	return (uint16_t)std::lround(std::min(std::max(v, 0.0f), 1.0f) * 65535.0f);
+}
+
+// snorm16 positions cover the bounding box, so the dequantize transform is its center and half size
+inline void UMeshBounds(const MeshData& mesh, PackedMesh& packed, glm::vec3& center, glm::vec3& inverseExtent)
+{
+	glm::vec3 lower = mesh.Positions[0], upper = mesh.Positions[0];
+	for (const glm::vec3& p : mesh.Positions)
+	{
+		lower = glm::min(lower, p);
+		upper = glm::max(upper, p);
+	}
+	center = (lower + upper) * 0.5f;
+	glm::vec3 extent = (upper - lower) * 0.5f;
+	for (int axis = 0; axis < 3; ++axis)
+		if (extent[axis] <= 0.0f)
+			extent[axis] = 1.0f; // flat along this axis
+	packed.DequantizeScale = extent;
+	packed.DequantizeOffset = center;
+	inverseExtent = glm::vec3(1.0f) / extent;
+}
+
+// 16-bit indices whenever every vertex fits
+inline void UPackIndices(const MeshData& mesh, PackedMesh& packed)
+{
+	packed.IndexCount = (GLuint)mesh.Indices.size();
+	packed.Lods = mesh.Lods;
+	if (packed.Lods.empty())
+		packed.Lods.push_back(MeshLod{ 0, packed.IndexCount, 0.0f });
+	packed.Meshlets = mesh.Meshlets;
+	if (packed.VertexCount <= 65536)
+	{
+		packed.IndexType = GL_UNSIGNED_SHORT;
+		packed.Indices.resize(mesh.Indices.size() * sizeof(uint16_t));
+		uint16_t* out = (uint16_t*)packed.Indices.data();
+		for (size_t i = 0; i < mesh.Indices.size(); ++i)
+			out[i] = (uint16_t)mesh.Indices[i];
+	}
+	else
+	{
+		packed.IndexType = GL_UNSIGNED_INT;
+		packed.Indices.resize(mesh.Indices.size() * sizeof(uint32_t));
+		memcpy(packed.Indices.data(), mesh.Indices.data(), packed.Indices.size());
+	}
+}
+
+#endif
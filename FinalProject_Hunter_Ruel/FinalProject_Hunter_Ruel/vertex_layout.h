@@ -0,0 +1,313 @@
+#ifndef VERTEX_LAYOUT_H
+#define VERTEX_LAYOUT_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include "vertex_format.h"
+
+// Compile-time vertex layouts. A layout lists its attributes in location order, e.g.
+//
+//     typedef VertexLayout<Position<snorm16x3>, TexCoord<unorm16x2>> SceneVertexLayout;
+//
+// and works out the packed offsets, the stride and the attribute table at compile time, so adding a format
+// can't get an offset wrong. UVertexLayoutMatches checks a layout against the "layout(location = N) in"
+// declarations of a constexpr shader source inside a static_assert.
+
+// Element formats: how one attribute is stored, and how to write it from its float value
+struct float2
+{
+	static constexpr GLint Components = 2;
+	static constexpr GLenum Type = GL_FLOAT;
+	static constexpr GLboolean Normalized = GL_FALSE;
+	static constexpr GLuint Size = 8;
+	static void Pack(unsigned char* out, const glm::vec2& v) { memcpy(out, &v.x, Size); }
+};
+
+struct float3
+{
+	static constexpr GLint Components = 3;
+	static constexpr GLenum Type = GL_FLOAT;
+	static constexpr GLboolean Normalized = GL_FALSE;
+	static constexpr GLuint Size = 12;
+	static void Pack(unsigned char* out, const glm::vec3& v) { memcpy(out, &v.x, Size); }
+};
+
+struct float4
+{
+	static constexpr GLint Components = 4;
+	static constexpr GLenum Type = GL_FLOAT;
+	static constexpr GLboolean Normalized = GL_FALSE;
+	static constexpr GLuint Size = 16;
+	static void Pack(unsigned char* out, const glm::vec4& v) { memcpy(out, &v.x, Size); }
+};
+
+// expects values in [-1,1]; positions are brought there by the mesh's dequantize transform
+struct snorm16x3
+{
+	static constexpr GLint Components = 3;
+	static constexpr GLenum Type = GL_SHORT;
+	static constexpr GLboolean Normalized = GL_TRUE;
+	static constexpr GLuint Size = 6;
+	static void Pack(unsigned char* out, const glm::vec3& v)
+	{
+		int16_t q[3] = { UQuantizeSnorm16(v.x), UQuantizeSnorm16(v.y), UQuantizeSnorm16(v.z) };
+		memcpy(out, q, sizeof(q));
+	}
+};
+
+// clamps to [0,1], so it only suits meshes whose UVs don't tile; see UTexCoordsInUnitRange
+struct unorm16x2
+{
+	static constexpr GLint Components = 2;
+	static constexpr GLenum Type = GL_UNSIGNED_SHORT;
+	static constexpr GLboolean Normalized = GL_TRUE;
+	static constexpr GLuint Size = 4;
+	static void Pack(unsigned char* out, const glm::vec2& v)
+	{
+		uint16_t q[2] = { UQuantizeUnorm16(v.x), UQuantizeUnorm16(v.y) };
+		memcpy(out, q, sizeof(q));
+	}
+};
+
+struct unorm8x4
+{
+	static constexpr GLint Components = 4;
+	static constexpr GLenum Type = GL_UNSIGNED_BYTE;
+	static constexpr GLboolean Normalized = GL_TRUE;
+	static constexpr GLuint Size = 4;
+	static void Pack(unsigned char* out, const glm::vec4& v)
+	{
+		for (int i = 0; i < 4; ++i)
+			out[i] = (unsigned char)std::lround(std::min(std::max(v[i], 0.0f), 1.0f) * 255.0f);
+	}
+};
+
+// Attribute semantics: the shader location an attribute feeds and the MeshData array it is packed from
+template <class Format>
+struct Position
+{
+	typedef Format Element;
+	static constexpr Vertex_Attribute Location = ATTRIBUTE_POSITION;
+	static constexpr bool Quantized = Format::Normalized == GL_TRUE; // stored relative to the mesh bounds
+	static bool Available(const MeshData& mesh) { return !mesh.Positions.empty(); }
+	static void Pack(unsigned char* out, const MeshData& mesh, size_t i, const glm::vec3& center, const glm::vec3& inverseExtent)
+	{
+		Format::Pack(out, Quantized ? (mesh.Positions[i] - center) * inverseExtent : mesh.Positions[i]);
+	}
+};
+
+template <class Format>
+struct Color
+{
+	typedef Format Element;
+	static constexpr Vertex_Attribute Location = ATTRIBUTE_COLOR;
+	static constexpr bool Quantized = false;
+	static bool Available(const MeshData& mesh) { return mesh.Colors.size() == mesh.Positions.size(); }
+	static void Pack(unsigned char* out, const MeshData& mesh, size_t i, const glm::vec3&, const glm::vec3&) { Format::Pack(out, mesh.Colors[i]); }
+};
+
+template <class Format>
+struct TexCoord
+{
+	typedef Format Element;
+	static constexpr Vertex_Attribute Location = ATTRIBUTE_TEXCOORD;
+	static constexpr bool Quantized = false;
+	static bool Available(const MeshData& mesh) { return mesh.TexCoords.size() == mesh.Positions.size(); }
+	static void Pack(unsigned char* out, const MeshData& mesh, size_t i, const glm::vec3&, const glm::vec3&) { Format::Pack(out, mesh.TexCoords[i]); }
+};
+
+// every attribute starts on a 4-byte boundary
+constexpr GLuint UVertexAlign(GLuint size)
+{
+	return (size + 3) & ~3u;
+}
+
+template <class... Semantics>
+struct VertexLayout
+{
+	static constexpr size_t Count = sizeof...(Semantics);
+	static_assert(Count > 0, "a vertex layout needs at least one attribute");
+
+	static constexpr GLuint Stride()
+	{
+		GLuint sizes[] = { UVertexAlign(Semantics::Element::Size)... };
+		GLuint stride = 0;
+		for (size_t i = 0; i < Count; ++i)
+			stride += sizes[i];
+		return stride;
+	}
+
+	static constexpr GLuint Offset(size_t index)
+	{
+		GLuint sizes[] = { UVertexAlign(Semantics::Element::Size)... };
+		GLuint offset = 0;
+		for (size_t i = 0; i < index; ++i)
+			offset += sizes[i];
+		return offset;
+	}
+
+	// 1 << location for every attribute
+	static constexpr unsigned Mask()
+	{
+		unsigned locations[] = { (unsigned)Semantics::Location... };
+		unsigned mask = 0;
+		for (size_t i = 0; i < Count; ++i)
+			mask |= 1u << locations[i];
+		return mask;
+	}
+
+	static constexpr bool InLocationOrder()
+	{
+		unsigned locations[] = { (unsigned)Semantics::Location... };
+		for (size_t i = 1; i < Count; ++i)
+			if (locations[i] <= locations[i - 1])
+				return false;
+		return true;
+	}
+	static_assert(InLocationOrder(), "list vertex attributes once each, in location order");
+
+	static constexpr std::array<VertexAttribute, Count> Table()
+	{
+		return table(std::make_index_sequence<Count>());
+	}
+
+private:
+	template <size_t... Index>
+	static constexpr std::array<VertexAttribute, Count> table(std::index_sequence<Index...>)
+	{
+		return { { VertexAttribute{ (GLuint)Semantics::Location, Semantics::Element::Components, Semantics::Element::Type, Semantics::Element::Normalized, Offset(Index) }... } };
+	}
+};
+
+constexpr bool UStartsWith(const char* text, const char* prefix)
+{
+	while (*prefix)
+		if (*text++ != *prefix++)
+			return false;
+	return true;
+}
+
+constexpr const char* USkipSpace(const char* text)
+{
+	while (*text == ' ' || *text == '\t' || *text == '\r' || *text == '\n')
+		++text;
+	return text;
+}
+
+// Components of the vertex shader input declared as "layout(location = N) in <type> name;": 1-4 for float
+// and vecN, -1 for any other type, 0 when nothing is declared at that location
+constexpr int UShaderInputComponents(const char* source, int location)
+{
+	for (const char* s = source; *s; ++s)
+	{
+		if (!UStartsWith(s, "location"))
+			continue;
+		const char* p = USkipSpace(s + 8);
+		if (*p != '=')
+			continue;
+		p = USkipSpace(p + 1);
+		if (*p < '0' || *p > '9')
+			continue;
+		int value = 0;
+		while (*p >= '0' && *p <= '9')
+			value = value * 10 + (*p++ - '0');
+		while (*p && *p != ')')
+			++p;
+		if (!*p)
+			break;
+		p = USkipSpace(p + 1);
+		if (value != location || !UStartsWith(p, "in") || USkipSpace(p + 2) == p + 2)
+			continue;
+		p = USkipSpace(p + 2);
+		if (UStartsWith(p, "float "))
+			return 1;
+		if (UStartsWith(p, "vec2 "))
+			return 2;
+		if (UStartsWith(p, "vec3 "))
+			return 3;
+		if (UStartsWith(p, "vec4 "))
+			return 4;
+		return -1;
+	}
+	return 0;
+}
+
+// true when the shader declares exactly the layout's attributes, with matching component counts
+template <class Layout>
+constexpr bool UVertexLayoutMatches(const char* vertexShaderSource)
+{
+	const std::array<VertexAttribute, Layout::Count> table = Layout::Table();
+	for (int location = 0; location < ATTRIBUTE_COUNT; ++location)
+	{
+		int components = 0;
+		for (size_t i = 0; i < Layout::Count; ++i)
+			if ((int)table[i].Location == location)
+				components = table[i].Components;
+		if (UShaderInputComponents(vertexShaderSource, location) != components)
+			return false;
+	}
+	return true;
+}
+
+// true when every texture coordinate fits unorm16x2; tiled or out-of-range UVs need float2
+inline bool UTexCoordsInUnitRange(const MeshData& mesh)
+{
+	for (const glm::vec2& uv : mesh.TexCoords)
+		if (uv.x < 0.0f || uv.x > 1.0f || uv.y < 0.0f || uv.y > 1.0f)
+			return false;
+	return true;
+}
+
+template <class Attribute>
+void UPackAttribute(const MeshData& mesh, PackedMesh& packed, GLuint offset, const glm::vec3& center, const glm::vec3& inverseExtent)
+{
+	if (!Attribute::Available(mesh))
+		return;
+	for (size_t i = 0; i < packed.VertexCount; ++i)
+		Attribute::Pack(packed.Vertices.data() + i * packed.Stride + offset, mesh, i, center, inverseExtent);
+}
+
+template <class Layout>
+struct UVertexLayoutPacker;
+
+template <class... Semantics>
+struct UVertexLayoutPacker<VertexLayout<Semantics...>>
+{
+	typedef VertexLayout<Semantics...> Layout;
+
+	template <size_t... Index>
+	static PackedMesh Pack(const MeshData& mesh, std::index_sequence<Index...>)
+	{
+		PackedMesh packed;
+		packed.VertexCount = (GLuint)mesh.Positions.size();
+		packed.Stride = (GLsizei)Layout::Stride();
+		std::array<VertexAttribute, Layout::Count> table = Layout::Table();
+		packed.Attributes.assign(table.begin(), table.end());
+		packed.Vertices.assign((size_t)packed.VertexCount * packed.Stride, 0);
+
+		glm::vec3 center(0.0f), inverseExtent(1.0f);
+		bool quantized[] = { Semantics::Quantized... };
+		if (std::find(std::begin(quantized), std::end(quantized), true) != std::end(quantized) && packed.VertexCount > 0)
+			UMeshBounds(mesh, packed, center, inverseExtent);
+
+		int expand[] = { (UPackAttribute<Semantics>(mesh, packed, Layout::Offset(Index), center, inverseExtent), 0)... };
+		(void)expand;
+
+		UPackIndices(mesh, packed);
+		return packed;
+	}
+};
+
+// Packs a mesh into Layout. Attributes the mesh has no data for are left zero.
+template <class Layout>
+PackedMesh UPackMesh(const MeshData& mesh)
+{
+	return UVertexLayoutPacker<Layout>::Pack(mesh, std::make_index_sequence<Layout::Count>());
+}
+
+#endif
@@ -0,0 +1,1228 @@
+// Image decoder benchmark for the stb_image build used by the scene.
+//
+// Decodes a fixed corpus (baseline and progressive JPEG, PNG at several bit depths and filters,
+// TGA, BMP, GIF and HDR) and reports megapixels per second, bytes allocated and peak RSS per format,
+// single threaded and across the batch decoder's thread pool. JPEGs are also decoded to planar YCbCr
+// (no chroma upsampling or color conversion), the form the scene uploads them in. Everything except the progressive
+// JPEG (Wood.jpg) is generated in-process from a fixed seed so runs are comparable between machines.
+//
+// Usage: ImageBench [--threads N] [--min-time SECONDS] [--corpus DIR] [--json FILE]
+// Without Visual Studio: g++ -std=c++17 -O2 -pthread -I../FinalProject_Hunter_Ruel ImageBench.cpp -o ImageBench
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Route every stb_image allocation through counters so each decode reports what it allocated
+namespace
+{
+    std::atomic<size_t> gAllocatedBytes{ 0 };
+    std::atomic<size_t> gLiveBytes{ 0 };
+    std::atomic<size_t> gPeakLiveBytes{ 0 };
+
+    const size_t ALLOC_HEADER = 16; // keeps the returned pointer 16-byte aligned for the SIMD paths
+
+    void trackAllocation(size_t size)
+    {
+        gAllocatedBytes += size;
+        size_t live = gLiveBytes += size;
+        size_t peak = gPeakLiveBytes.load();
+        while (live > peak && !gPeakLiveBytes.compare_exchange_weak(peak, live))
+            ;
+    }
+}
+
+void* BenchMalloc(size_t size)
+{
+    unsigned char* block = (unsigned char*)malloc(size + ALLOC_HEADER);
+    if (!block)
+        return nullptr;
+    memcpy(block, &size, sizeof(size));
+    trackAllocation(size);
+    return block + ALLOC_HEADER;
+}
+
+void BenchFree(void* p)
+{
+    if (!p)
+        return;
+    unsigned char* block = (unsigned char*)p - ALLOC_HEADER;
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+    gLiveBytes -= size;
+    free(block);
+}
+
+void* BenchRealloc(void* p, size_t size)
+{
+    if (!p)
+        return BenchMalloc(size);
+    unsigned char* block = (unsigned char*)p - ALLOC_HEADER;
+    size_t oldSize;
+    memcpy(&oldSize, block, sizeof(oldSize));
+    unsigned char* grown = (unsigned char*)realloc(block, size + ALLOC_HEADER);
+    if (!grown)
+        return nullptr;
+    memcpy(grown, &size, sizeof(size));
+    gLiveBytes -= oldSize;
+    trackAllocation(size);
+    return grown + ALLOC_HEADER;
+}
+
+#include "image_loader.h"
+#define STBI_MALLOC(sz)        BenchMalloc(sz)
+#define STBI_REALLOC(p, newsz) BenchRealloc(p, newsz)
+#define STBI_FREE(p)           BenchFree(p)
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace std;
+
+namespace
+{
+    typedef vector<unsigned char> Bytes;
+
+    // One encoded image of the corpus. Entries with a path are decoded from that file instead of
+    // from memory, through a mapping or stb_image's stdio reads, to measure the file input path.
+    struct CorpusEntry
+    {
+        string name;
+        string format;
+        Bytes data;
+        string path;
+        bool memoryMap = false;
+        bool planarYCbCr = false;
+    };
+
+    // Deterministic test picture: smooth gradients with some texture and noise, so the
+    // entropy coders see something closer to a photo than a flat fill.
+    struct SyntheticImage
+    {
+        int width, height, channels;
+        vector<float> pixels; // 0..1, interleaved
+    };
+
+    SyntheticImage makeImage(int width, int height, int channels)
+    {
+        SyntheticImage image{ width, height, channels };
+        image.pixels.resize((size_t)width * height * channels);
+        uint32_t seed = 0x9E3779B9u;
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                float noise = ((seed >> 8) & 0xFF) / 255.0f - 0.5f;
+                float u = (float)x / width, v = (float)y / height;
+                float grain = 0.5f + 0.5f * sinf(u * 40.0f + sinf(v * 9.0f) * 3.0f);
+                for (int c = 0; c < channels; ++c)
+                {
+                    float value = 0.45f * grain + 0.35f * (c == 0 ? u : c == 1 ? v : 1.0f - u) + 0.08f * noise + 0.1f;
+                    if (c == 3)
+                        value = 0.75f + 0.25f * u; // alpha
+                    image.pixels[((size_t)y * width + x) * channels + c] = fminf(fmaxf(value, 0.0f), 1.0f);
+                }
+            }
+        }
+        return image;
+    }
+
+    unsigned char toByte(float value)
+    {
+        return (unsigned char)lroundf(value * 255.0f);
+    }
+
+    void put16le(Bytes& out, unsigned v) { out.push_back(v & 0xFF); out.push_back((v >> 8) & 0xFF); }
+    void put32le(Bytes& out, unsigned v) { put16le(out, v & 0xFFFF); put16le(out, v >> 16); }
+    void put16be(Bytes& out, unsigned v) { out.push_back((v >> 8) & 0xFF); out.push_back(v & 0xFF); }
+    void put32be(Bytes& out, unsigned v) { put16be(out, v >> 16); put16be(out, v & 0xFFFF); }
+
+    // ---------------------------------------------------------------- BMP / TGA
+
+    Bytes encodeBmp(const SyntheticImage& image)
+    {
+        int rowBytes = (image.width * 3 + 3) & ~3;
+        Bytes out;
+        out.push_back('B'); out.push_back('M');
+        put32le(out, 54 + rowBytes * image.height);
+        put32le(out, 0);
+        put32le(out, 54);
+        put32le(out, 40);
+        put32le(out, image.width);
+        put32le(out, image.height); // bottom-up
+        put16le(out, 1);
+        put16le(out, 24);
+        put32le(out, 0);
+        put32le(out, rowBytes * image.height);
+        put32le(out, 2835); put32le(out, 2835);
+        put32le(out, 0); put32le(out, 0);
+        for (int y = image.height - 1; y >= 0; --y)
+        {
+            size_t start = out.size();
+            for (int x = 0; x < image.width; ++x)
+            {
+                const float* p = &image.pixels[((size_t)y * image.width + x) * image.channels];
+                out.push_back(toByte(p[2])); out.push_back(toByte(p[1])); out.push_back(toByte(p[0]));
+            }
+            out.resize(start + rowBytes, 0);
+        }
+        return out;
+    }
+
+    Bytes encodeTga(const SyntheticImage& image, bool rle)
+    {
+        Bytes out;
+        out.push_back(0);
+        out.push_back(0);
+        out.push_back(rle ? 10 : 2);
+        out.insert(out.end(), 5, 0);
+        put16le(out, 0); put16le(out, 0);
+        put16le(out, image.width); put16le(out, image.height);
+        out.push_back(24);
+        out.push_back(0x20); // top-left origin
+
+        for (int y = 0; y < image.height; ++y)
+        {
+            vector<uint32_t> row(image.width);
+            for (int x = 0; x < image.width; ++x)
+            {
+                const float* p = &image.pixels[((size_t)y * image.width + x) * image.channels];
+                // quantize a little so RLE finds runs
+                unsigned r = toByte(p[0]) & (rle ? 0xF0 : 0xFF), g = toByte(p[1]) & (rle ? 0xF0 : 0xFF), b = toByte(p[2]) & (rle ? 0xF0 : 0xFF);
+                row[x] = (b) | (g << 8) | (r << 16);
+            }
+            int x = 0;
+            while (x < image.width)
+            {
+                if (!rle)
+                {
+                    out.push_back(row[x] & 0xFF); out.push_back((row[x] >> 8) & 0xFF); out.push_back((row[x] >> 16) & 0xFF);
+                    ++x;
+                    continue;
+                }
+                int run = 1;
+                while (x + run < image.width && run < 128 && row[x + run] == row[x])
+                    ++run;
+                if (run > 1)
+                {
+                    out.push_back(0x80 | (run - 1));
+                    out.push_back(row[x] & 0xFF); out.push_back((row[x] >> 8) & 0xFF); out.push_back((row[x] >> 16) & 0xFF);
+                }
+                else
+                {
+                    int literal = 1;
+                    while (x + literal < image.width && literal < 128 && row[x + literal] != row[x + literal - 1])
+                        ++literal;
+                    out.push_back(literal - 1);
+                    for (int i = 0; i < literal; ++i)
+                    {
+                        out.push_back(row[x + i] & 0xFF); out.push_back((row[x + i] >> 8) & 0xFF); out.push_back((row[x + i] >> 16) & 0xFF);
+                    }
+                    run = literal;
+                }
+                x += run;
+            }
+        }
+        return out;
+    }
+
+    // ---------------------------------------------------------------- PNG (fixed-Huffman deflate)
+
+    uint32_t crc32(const unsigned char* data, size_t length, uint32_t crc = 0)
+    {
+        static uint32_t table[256];
+        if (!table[1])
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+        }
+        crc = ~crc;
+        for (size_t i = 0; i < length; ++i)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    struct BitWriterLsb
+    {
+        Bytes& out;
+        uint32_t buffer = 0;
+        int count = 0;
+
+        explicit BitWriterLsb(Bytes& o) : out(o) {}
+
+        void write(uint32_t bits, int n)
+        {
+            buffer |= bits << count;
+            count += n;
+            while (count >= 8)
+            {
+                out.push_back(buffer & 0xFF);
+                buffer >>= 8;
+                count -= 8;
+            }
+        }
+
+        // Huffman codes go out most significant bit first
+        void writeCode(uint32_t code, int n)
+        {
+            uint32_t reversed = 0;
+            for (int i = 0; i < n; ++i)
+                reversed |= ((code >> i) & 1) << (n - 1 - i);
+            write(reversed, n);
+        }
+
+        void flush()
+        {
+            if (count > 0)
+                out.push_back(buffer & 0xFF);
+            buffer = 0;
+            count = 0;
+        }
+    };
+
+    void writeFixedLiteral(BitWriterLsb& bits, int symbol)
+    {
+        if (symbol < 144)      bits.writeCode(0x30 + symbol, 8);
+        else if (symbol < 256) bits.writeCode(0x190 + symbol - 144, 9);
+        else if (symbol < 280) bits.writeCode(symbol - 256, 7);
+        else                   bits.writeCode(0xC0 + symbol - 280, 8);
+    }
+
+    Bytes zlibCompress(const Bytes& data)
+    {
+        static const int lengthBase[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+        static const int lengthExtra[] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+        static const int distBase[] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+        static const int distExtra[] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+        Bytes out = { 0x78, 0x01 };
+        BitWriterLsb bits(out);
+        bits.write(1, 1); // final block
+        bits.write(1, 2); // fixed Huffman
+
+        const int HASH_SIZE = 1 << 15;
+        vector<int> head(HASH_SIZE, -1);
+        size_t i = 0;
+        while (i < data.size())
+        {
+            int bestLength = 0, bestDistance = 0;
+            if (i + 3 <= data.size())
+            {
+                unsigned hash = ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & (HASH_SIZE - 1);
+                int candidate = head[hash];
+                head[hash] = (int)i;
+                if (candidate >= 0 && i - candidate <= 32768)
+                {
+                    int length = 0;
+                    while (length < 258 && i + length < data.size() && data[candidate + length] == data[i + length])
+                        ++length;
+                    if (length >= 3)
+                    {
+                        bestLength = length;
+                        bestDistance = (int)(i - candidate);
+                    }
+                }
+            }
+
+            if (bestLength)
+            {
+                int code = 0;
+                while (code < 28 && lengthBase[code + 1] <= bestLength)
+                    ++code;
+                writeFixedLiteral(bits, 257 + code);
+                bits.write(bestLength - lengthBase[code], lengthExtra[code]);
+                int dcode = 0;
+                while (dcode < 29 && distBase[dcode + 1] <= bestDistance)
+                    ++dcode;
+                bits.writeCode(dcode, 5);
+                bits.write(bestDistance - distBase[dcode], distExtra[dcode]);
+                i += bestLength;
+            }
+            else
+            {
+                writeFixedLiteral(bits, data[i]);
+                ++i;
+            }
+        }
+        writeFixedLiteral(bits, 256);
+        bits.flush();
+
+        uint32_t a = 1, b = 0;
+        for (unsigned char c : data)
+        {
+            a = (a + c) % 65521;
+            b = (b + a) % 65521;
+        }
+        put32be(out, (b << 16) | a);
+        return out;
+    }
+
+    void pngChunk(Bytes& out, const char* type, const Bytes& payload)
+    {
+        put32be(out, (unsigned)payload.size());
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), payload.begin(), payload.end());
+        put32be(out, crc32(&out[start], out.size() - start));
+    }
+
+    int paeth(int a, int b, int c)
+    {
+        int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+    }
+
+    // filter: 0-4 for one PNG filter type on every row, -1 cycles through all of them
+    Bytes encodePng(const SyntheticImage& image, int channels, int bitDepth, int filter)
+    {
+        int bytesPerSample = bitDepth / 8;
+        int bpp = channels * bytesPerSample;
+        size_t stride = (size_t)image.width * bpp;
+        vector<unsigned char> previous(stride, 0), row(stride);
+        Bytes raw;
+        for (int y = 0; y < image.height; ++y)
+        {
+            for (int x = 0; x < image.width; ++x)
+            {
+                for (int c = 0; c < channels; ++c)
+                {
+                    float value = image.pixels[((size_t)y * image.width + x) * image.channels + (channels == 1 ? 1 : c)];
+                    unsigned sample = bitDepth == 16 ? (unsigned)lroundf(value * 65535.0f) : toByte(value);
+                    unsigned char* dst = &row[(size_t)x * bpp + c * bytesPerSample];
+                    if (bitDepth == 16) { dst[0] = sample >> 8; dst[1] = sample & 0xFF; }
+                    else dst[0] = (unsigned char)sample;
+                }
+            }
+
+            int type = filter < 0 ? y % 5 : filter;
+            raw.push_back((unsigned char)type);
+            for (size_t i = 0; i < stride; ++i)
+            {
+                int a = i >= (size_t)bpp ? row[i - bpp] : 0, b = previous[i], c = i >= (size_t)bpp ? previous[i - bpp] : 0;
+                int predicted = type == 1 ? a : type == 2 ? b : type == 3 ? (a + b) / 2 : type == 4 ? paeth(a, b, c) : 0;
+                raw.push_back((unsigned char)(row[i] - predicted));
+            }
+            previous.swap(row);
+        }
+
+        static const unsigned char colorTypes[] = { 0, 0, 4, 2, 6 };
+        Bytes header;
+        put32be(header, image.width);
+        put32be(header, image.height);
+        header.push_back((unsigned char)bitDepth);
+        header.push_back(colorTypes[channels]);
+        header.push_back(0); header.push_back(0); header.push_back(0);
+
+        Bytes out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        pngChunk(out, "IHDR", header);
+        pngChunk(out, "IDAT", zlibCompress(raw));
+        pngChunk(out, "IEND", Bytes());
+        return out;
+    }
+
+    // ---------------------------------------------------------------- GIF (LZW, 6x6x6 palette)
+
+    Bytes encodeGif(const SyntheticImage& image)
+    {
+        Bytes out = { 'G', 'I', 'F', '8', '9', 'a' };
+        put16le(out, image.width);
+        put16le(out, image.height);
+        out.push_back(0xF7); // global color table, 8 bits
+        out.push_back(0);
+        out.push_back(0);
+        for (int i = 0; i < 256; ++i)
+        {
+            int index = i < 216 ? i : 215;
+            out.push_back((unsigned char)(index / 36 * 51));
+            out.push_back((unsigned char)(index / 6 % 6 * 51));
+            out.push_back((unsigned char)(index % 6 * 51));
+        }
+        out.push_back(','); // image descriptor
+        put16le(out, 0); put16le(out, 0);
+        put16le(out, image.width); put16le(out, image.height);
+        out.push_back(0);
+        out.push_back(8); // minimum code size
+
+        Bytes packed;
+        BitWriterLsb bits(packed);
+        const int CLEAR = 256, END = 257;
+        vector<int> dictionary(4096 * 256, -1);
+        int nextCode = END + 1, codeSize = 9;
+        bits.write(CLEAR, codeSize);
+
+        int prefix = -1;
+        for (int y = 0; y < image.height; ++y)
+        {
+            for (int x = 0; x < image.width; ++x)
+            {
+                const float* p = &image.pixels[((size_t)y * image.width + x) * image.channels];
+                int index = (int)lroundf(p[0] * 5) * 36 + (int)lroundf(p[1] * 5) * 6 + (int)lroundf(p[2] * 5);
+                if (prefix < 0)
+                {
+                    prefix = index;
+                    continue;
+                }
+                int& entry = dictionary[prefix * 256 + index];
+                if (entry >= 0)
+                {
+                    prefix = entry;
+                    continue;
+                }
+                bits.write(prefix, codeSize);
+                if (nextCode < 4096)
+                {
+                    entry = nextCode++;
+                    if (nextCode > (1 << codeSize) && codeSize < 12)
+                        ++codeSize;
+                }
+                else
+                {
+                    bits.write(CLEAR, codeSize);
+                    fill(dictionary.begin(), dictionary.end(), -1);
+                    nextCode = END + 1;
+                    codeSize = 9;
+                }
+                prefix = index;
+            }
+        }
+        bits.write(prefix, codeSize);
+        bits.write(END, codeSize);
+        bits.flush();
+
+        for (size_t i = 0; i < packed.size(); i += 255)
+        {
+            size_t block = min<size_t>(255, packed.size() - i);
+            out.push_back((unsigned char)block);
+            out.insert(out.end(), packed.begin() + i, packed.begin() + i + block);
+        }
+        out.push_back(0);
+        out.push_back(';');
+        return out;
+    }
+
+    // ---------------------------------------------------------------- HDR (RGBE, run-length scanlines)
+
+    Bytes encodeHdr(const SyntheticImage& image)
+    {
+        string header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + to_string(image.height) + " +X " + to_string(image.width) + "\n";
+        Bytes out(header.begin(), header.end());
+        vector<unsigned char> planes[4];
+        for (int y = 0; y < image.height; ++y)
+        {
+            for (int c = 0; c < 4; ++c)
+                planes[c].assign(image.width, 0);
+            for (int x = 0; x < image.width; ++x)
+            {
+                const float* p = &image.pixels[((size_t)y * image.width + x) * image.channels];
+                float rgb[3] = { p[0] * 4.0f, p[1] * 4.0f, p[2] * 4.0f }; // some values above 1.0
+                float largest = fmaxf(rgb[0], fmaxf(rgb[1], rgb[2]));
+                if (largest < 1e-32f)
+                    continue;
+                int exponent;
+                float scale = frexpf(largest, &exponent) * 256.0f / largest;
+                for (int c = 0; c < 3; ++c)
+                    planes[c][x] = (unsigned char)(rgb[c] * scale);
+                planes[3][x] = (unsigned char)(exponent + 128);
+            }
+
+            out.push_back(2); out.push_back(2);
+            out.push_back((unsigned char)(image.width >> 8)); out.push_back((unsigned char)(image.width & 0xFF));
+            for (int c = 0; c < 4; ++c)
+            {
+                int x = 0;
+                while (x < image.width)
+                {
+                    int run = 1;
+                    while (x + run < image.width && run < 127 && planes[c][x + run] == planes[c][x])
+                        ++run;
+                    if (run >= 4)
+                    {
+                        out.push_back((unsigned char)(128 + run));
+                        out.push_back(planes[c][x]);
+                        x += run;
+                        continue;
+                    }
+                    int literal = min(128, image.width - x);
+                    for (int i = 1; i + 3 < literal; ++i)
+                    {
+                        if (planes[c][x + i] == planes[c][x + i + 1] && planes[c][x + i] == planes[c][x + i + 2] && planes[c][x + i] == planes[c][x + i + 3])
+                        {
+                            literal = i;
+                            break;
+                        }
+                    }
+                    out.push_back((unsigned char)literal);
+                    out.insert(out.end(), planes[c].begin() + x, planes[c].begin() + x + literal);
+                    x += literal;
+                }
+            }
+        }
+        return out;
+    }
+
+    // ---------------------------------------------------------------- baseline JPEG
+
+    const unsigned char ZIGZAG[64] = {
+        0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+        35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+
+    // Standard tables from ITU T.81 Annex K
+    const unsigned char DC_LUMA_COUNTS[16] = { 0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
+    const unsigned char DC_CHROMA_COUNTS[16] = { 0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0 };
+    const unsigned char DC_VALUES[12] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
+    const unsigned char AC_LUMA_COUNTS[16] = { 0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d };
+    const unsigned char AC_LUMA_VALUES[162] = {
+        0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
+        0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+        0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
+        0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+        0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,
+        0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+        0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa };
+    const unsigned char AC_CHROMA_COUNTS[16] = { 0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77 };
+    const unsigned char AC_CHROMA_VALUES[162] = {
+        0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,
+        0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+        0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,
+        0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+        0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,
+        0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+        0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa };
+    const unsigned char QUANT_LUMA[64] = {
+        16,11,10,16,24,40,51,61,12,12,14,19,26,58,60,55,14,13,16,24,40,57,69,56,14,17,22,29,51,87,80,62,
+        18,22,37,56,68,109,103,77,24,35,55,64,81,104,113,92,49,64,78,87,103,121,120,101,72,92,95,98,112,100,103,99 };
+    const unsigned char QUANT_CHROMA[64] = {
+        17,18,24,47,99,99,99,99,18,21,26,66,99,99,99,99,24,26,56,99,99,99,99,99,47,66,99,99,99,99,99,99,
+        99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99 };
+
+    struct HuffmanTable
+    {
+        uint16_t code[256];
+        uint8_t size[256];
+
+        HuffmanTable(const unsigned char* counts, const unsigned char* values)
+        {
+            int k = 0;
+            uint16_t next = 0;
+            for (int length = 1; length <= 16; ++length)
+            {
+                for (int i = 0; i < counts[length - 1]; ++i, ++k)
+                {
+                    code[values[k]] = next++;
+                    size[values[k]] = (uint8_t)length;
+                }
+                next <<= 1;
+            }
+        }
+    };
+
+    struct BitWriterMsb
+    {
+        Bytes& out;
+        uint32_t buffer = 0;
+        int count = 0;
+
+        explicit BitWriterMsb(Bytes& o) : out(o) {}
+
+        void write(uint32_t bits, int n)
+        {
+            buffer = (buffer << n) | (bits & ((1u << n) - 1));
+            count += n;
+            while (count >= 8)
+            {
+                unsigned char byte = (unsigned char)(buffer >> (count - 8));
+                out.push_back(byte);
+                if (byte == 0xFF)
+                    out.push_back(0); // byte stuffing
+                count -= 8;
+            }
+        }
+
+        void flush()
+        {
+            if (count > 0)
+                write(0x7F, 8 - count); // pad with ones
+        }
+    };
+
+    void jpegMarker(Bytes& out, unsigned marker, const Bytes& payload)
+    {
+        put16be(out, marker);
+        put16be(out, (unsigned)payload.size() + 2);
+        out.insert(out.end(), payload.begin(), payload.end());
+    }
+
+    void jpegHuffmanSegment(Bytes& payload, int tableClass, int id, const unsigned char* counts, const unsigned char* values)
+    {
+        payload.push_back((unsigned char)(tableClass << 4 | id));
+        payload.insert(payload.end(), counts, counts + 16);
+        int total = 0;
+        for (int i = 0; i < 16; ++i)
+            total += counts[i];
+        payload.insert(payload.end(), values, values + total);
+    }
+
+    void encodeBlock(BitWriterMsb& bits, const float block[64], const float quant[64], int& dcPrevious, const HuffmanTable& dc, const HuffmanTable& ac)
+    {
+        static float cosines[8][8];
+        if (cosines[0][0] == 0.0f)
+            for (int x = 0; x < 8; ++x)
+                for (int u = 0; u < 8; ++u)
+                    cosines[x][u] = cosf((2 * x + 1) * u * 3.14159265f / 16.0f) * (u == 0 ? sqrtf(0.125f) : 0.5f);
+
+        float rows[64], coefficients[64];
+        for (int y = 0; y < 8; ++y)
+            for (int u = 0; u < 8; ++u)
+            {
+                float sum = 0;
+                for (int x = 0; x < 8; ++x)
+                    sum += block[y * 8 + x] * cosines[x][u];
+                rows[y * 8 + u] = sum;
+            }
+        for (int v = 0; v < 8; ++v)
+            for (int u = 0; u < 8; ++u)
+            {
+                float sum = 0;
+                for (int y = 0; y < 8; ++y)
+                    sum += rows[y * 8 + u] * cosines[y][v];
+                coefficients[v * 8 + u] = sum;
+            }
+
+        int quantized[64];
+        for (int i = 0; i < 64; ++i)
+            quantized[i] = (int)lroundf(coefficients[ZIGZAG[i]] / quant[i]);
+
+        auto category = [](int value) { int magnitude = abs(value), bitsNeeded = 0; while (magnitude) { ++bitsNeeded; magnitude >>= 1; } return bitsNeeded; };
+        auto valueBits = [](int value, int n) { return (uint32_t)(value < 0 ? value + (1 << n) - 1 : value); };
+
+        int diff = quantized[0] - dcPrevious;
+        dcPrevious = quantized[0];
+        int dcCategory = category(diff);
+        bits.write(dc.code[dcCategory], dc.size[dcCategory]);
+        if (dcCategory)
+            bits.write(valueBits(diff, dcCategory), dcCategory);
+
+        int run = 0;
+        for (int i = 1; i < 64; ++i)
+        {
+            if (quantized[i] == 0)
+            {
+                ++run;
+                continue;
+            }
+            while (run > 15)
+            {
+                bits.write(ac.code[0xF0], ac.size[0xF0]);
+                run -= 16;
+            }
+            int acCategory = category(quantized[i]);
+            int symbol = run << 4 | acCategory;
+            bits.write(ac.code[symbol], ac.size[symbol]);
+            bits.write(valueBits(quantized[i], acCategory), acCategory);
+            run = 0;
+        }
+        if (run)
+            bits.write(ac.code[0x00], ac.size[0x00]);
+    }
+
+    // chromaSubsampling 1 for 4:4:4, 2 for 4:2:0; restartInterval in MCUs, 0 for none
+    Bytes encodeJpeg(const SyntheticImage& image, int quality, int chromaSubsampling, int restartInterval = 0)
+    {
+        int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+        // DQT stores the tables in zigzag order; QUANT_* are in natural order
+        unsigned char lumaZigzag[64], chromaZigzag[64];
+        float lumaQuant[64], chromaQuant[64];
+        for (int i = 0; i < 64; ++i)
+        {
+            unsigned char lumaTable = (unsigned char)min(255, max(1, (QUANT_LUMA[ZIGZAG[i]] * scale + 50) / 100));
+            unsigned char chromaTable = (unsigned char)min(255, max(1, (QUANT_CHROMA[ZIGZAG[i]] * scale + 50) / 100));
+            lumaZigzag[i] = lumaTable;
+            chromaZigzag[i] = chromaTable;
+            lumaQuant[i] = lumaZigzag[i];
+            chromaQuant[i] = chromaZigzag[i];
+        }
+
+        Bytes out = { 0xFF, 0xD8 };
+        jpegMarker(out, 0xFFE0, Bytes{ 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 });
+
+        Bytes dqt;
+        dqt.push_back(0); dqt.insert(dqt.end(), lumaZigzag, lumaZigzag + 64);
+        dqt.push_back(1); dqt.insert(dqt.end(), chromaZigzag, chromaZigzag + 64);
+        jpegMarker(out, 0xFFDB, dqt);
+
+        Bytes sof = { 8 };
+        put16be(sof, image.height);
+        put16be(sof, image.width);
+        sof.push_back(3);
+        sof.push_back(1); sof.push_back((unsigned char)(chromaSubsampling << 4 | chromaSubsampling)); sof.push_back(0);
+        sof.push_back(2); sof.push_back(0x11); sof.push_back(1);
+        sof.push_back(3); sof.push_back(0x11); sof.push_back(1);
+        jpegMarker(out, 0xFFC0, sof);
+
+        Bytes dht;
+        jpegHuffmanSegment(dht, 0, 0, DC_LUMA_COUNTS, DC_VALUES);
+        jpegHuffmanSegment(dht, 1, 0, AC_LUMA_COUNTS, AC_LUMA_VALUES);
+        jpegHuffmanSegment(dht, 0, 1, DC_CHROMA_COUNTS, DC_VALUES);
+        jpegHuffmanSegment(dht, 1, 1, AC_CHROMA_COUNTS, AC_CHROMA_VALUES);
+        jpegMarker(out, 0xFFC4, dht);
+
+        if (restartInterval)
+        {
+            Bytes dri;
+            put16be(dri, restartInterval);
+            jpegMarker(out, 0xFFDD, dri);
+        }
+
+        jpegMarker(out, 0xFFDA, Bytes{ 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 });
+
+        HuffmanTable dcLuma(DC_LUMA_COUNTS, DC_VALUES), acLuma(AC_LUMA_COUNTS, AC_LUMA_VALUES);
+        HuffmanTable dcChroma(DC_CHROMA_COUNTS, DC_VALUES), acChroma(AC_CHROMA_COUNTS, AC_CHROMA_VALUES);
+
+        auto sample = [&](int x, int y, int component)
+        {
+            x = min(x, image.width - 1);
+            y = min(y, image.height - 1);
+            const float* p = &image.pixels[((size_t)y * image.width + x) * image.channels];
+            float r = p[0] * 255.0f, g = p[1] * 255.0f, b = p[2] * 255.0f;
+            if (component == 0) return 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+            if (component == 1) return -0.168736f * r - 0.331264f * g + 0.5f * b;
+            return 0.5f * r - 0.418688f * g - 0.081312f * b;
+        };
+
+        BitWriterMsb bits(out);
+        int mcuSize = 8 * chromaSubsampling;
+        int dcY = 0, dcCb = 0, dcCr = 0;
+        int mcuCount = 0;
+        float block[64];
+        for (int mcuY = 0; mcuY < image.height; mcuY += mcuSize)
+        {
+            for (int mcuX = 0; mcuX < image.width; mcuX += mcuSize)
+            {
+                if (restartInterval && mcuCount && mcuCount % restartInterval == 0)
+                {
+                    bits.flush();
+                    out.push_back(0xFF);
+                    out.push_back((unsigned char)(0xD0 + (mcuCount / restartInterval - 1) % 8));
+                    dcY = dcCb = dcCr = 0;
+                }
+                ++mcuCount;
+                for (int by = 0; by < chromaSubsampling; ++by)
+                    for (int bx = 0; bx < chromaSubsampling; ++bx)
+                    {
+                        for (int i = 0; i < 64; ++i)
+                            block[i] = sample(mcuX + bx * 8 + i % 8, mcuY + by * 8 + i / 8, 0);
+                        encodeBlock(bits, block, lumaQuant, dcY, dcLuma, acLuma);
+                    }
+                for (int component = 1; component <= 2; ++component)
+                {
+                    for (int i = 0; i < 64; ++i)
+                    {
+                        float sum = 0;
+                        for (int sy = 0; sy < chromaSubsampling; ++sy)
+                            for (int sx = 0; sx < chromaSubsampling; ++sx)
+                                sum += sample(mcuX + (i % 8) * chromaSubsampling + sx, mcuY + (i / 8) * chromaSubsampling + sy, component);
+                        block[i] = sum / (chromaSubsampling * chromaSubsampling);
+                    }
+                    encodeBlock(bits, block, chromaQuant, component == 1 ? dcCb : dcCr, dcChroma, acChroma);
+                }
+            }
+        }
+        bits.flush();
+        out.push_back(0xFF);
+        out.push_back(0xD9);
+        return out;
+    }
+
+    // ---------------------------------------------------------------- corpus and measurement
+
+    bool readFile(const string& path, Bytes& data)
+    {
+        ifstream file(path, ios::binary);
+        if (!file)
+            return false;
+        data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        return !data.empty();
+    }
+
+    string writeTempFile(const string& name, const Bytes& data)
+    {
+        string path = "ImageBench_" + name + ".tmp";
+        ofstream file(path, ios::binary);
+        file.write((const char*)data.data(), data.size());
+        return file ? path : string();
+    }
+
+    // the same image read from a file, once through stdio and once through a mapping
+    void addFileEntries(vector<CorpusEntry>& corpus, CorpusEntry source, const string& path)
+    {
+        if (path.empty())
+            return;
+        CorpusEntry stdio = source;
+        stdio.name += "_file_stdio";
+        stdio.path = path;
+        corpus.push_back(stdio);
+
+        CorpusEntry mapped = stdio;
+        mapped.name = source.name + "_file_mmap";
+        mapped.memoryMap = true;
+        corpus.push_back(mapped);
+    }
+
+    vector<CorpusEntry> buildCorpus(const string& corpusDir, vector<string>& tempFiles)
+    {
+        const int SIZE = 1024;
+        SyntheticImage rgb = makeImage(SIZE, SIZE, 3);
+        SyntheticImage rgba = makeImage(SIZE, SIZE, 4);
+
+        vector<CorpusEntry> corpus;
+        Bytes wood;
+        const string woodPaths[] = { corpusDir + "/Wood.jpg", "Wood.jpg", "../FinalProject_Hunter_Ruel/Wood.jpg", "FinalProject_Hunter_Ruel/Wood.jpg" };
+        for (const string& path : woodPaths)
+        {
+            if (readFile(path, wood))
+            {
+                corpus.push_back({ "jpeg_progressive_444_wood", "jpeg", wood });
+                addFileEntries(corpus, corpus.back(), path);
+                break;
+            }
+        }
+        if (wood.empty())
+            cerr << "warning: Wood.jpg not found, skipping the progressive JPEG (pass --corpus DIR)" << endl;
+
+        corpus.push_back({ "jpeg_baseline_444_q90", "jpeg", encodeJpeg(rgb, 90, 1) });
+        corpus.push_back({ "jpeg_baseline_420_q90", "jpeg", encodeJpeg(rgb, 90, 2) });
+        corpus.push_back({ "jpeg_baseline_420_q50", "jpeg", encodeJpeg(rgb, 50, 2) });
+        corpus.push_back({ "jpeg_baseline_420_q90_rst8", "jpeg", encodeJpeg(rgb, 90, 2, 8) });
+
+        // every JPEG so far again, decoded to Y, Cb and Cr planes
+        for (size_t i = 0, count = corpus.size(); i < count; ++i)
+        {
+            if (corpus[i].format != "jpeg" || !corpus[i].path.empty())
+                continue;
+            CorpusEntry planar = corpus[i];
+            planar.name += "_planar";
+            planar.planarYCbCr = true;
+            corpus.push_back(planar);
+        }
+
+        static const char* filterNames[] = { "none", "sub", "up", "avg", "paeth" };
+        for (int filter = 0; filter < 5; ++filter)
+            corpus.push_back({ string("png_rgb8_") + filterNames[filter], "png", encodePng(rgb, 3, 8, filter) });
+        corpus.push_back({ "png_rgb8_mixed", "png", encodePng(rgb, 3, 8, -1) });
+        corpus.push_back({ "png_gray8_paeth", "png", encodePng(rgb, 1, 8, 4) });
+        corpus.push_back({ "png_rgba8_paeth", "png", encodePng(rgba, 4, 8, 4) });
+        corpus.push_back({ "png_rgb16_paeth", "png", encodePng(rgb, 3, 16, 4) });
+
+        corpus.push_back({ "tga_rgb24", "tga", encodeTga(rgb, false) });
+        corpus.push_back({ "tga_rgb24_rle", "tga", encodeTga(rgb, true) });
+        corpus.push_back({ "bmp_rgb24", "bmp", encodeBmp(rgb) });
+        corpus.push_back({ "gif_8bit", "gif", encodeGif(rgb) });
+        corpus.push_back({ "hdr_rgbe_rle", "hdr", encodeHdr(rgb) });
+
+        // formats that decode fast enough for file I/O to show up in the total
+        const char* fileBacked[] = { "tga_rgb24", "bmp_rgb24" };
+        for (const char* name : fileBacked)
+        {
+            for (size_t i = 0; i < corpus.size(); ++i)
+            {
+                if (corpus[i].name != name)
+                    continue;
+                string path = writeTempFile(name, corpus[i].data);
+                if (!path.empty())
+                    tempFiles.push_back(path);
+                addFileEntries(corpus, corpus[i], path);
+                break;
+            }
+        }
+        return corpus;
+    }
+
+    size_t peakRssBytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return counters.PeakWorkingSetSize;
+        return 0;
+#else
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return (size_t)usage.ru_maxrss;
+#else
+        return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+    }
+
+    // Linux lets us reset the high-water mark so each format gets its own peak
+    bool resetPeakRss()
+    {
+#ifdef __linux__
+        FILE* file = fopen("/proc/self/clear_refs", "w");
+        if (!file)
+            return false;
+        bool ok = fputs("5", file) >= 0;
+        return fclose(file) == 0 && ok;
+#else
+        return false;
+#endif
+    }
+
+    string simdLevel()
+    {
+#if defined(STBI_SSE2)
+        string level = stbi__sse2_available() ? "sse2" : "none (sse2 compiled, unavailable)";
+#elif defined(STBI_NEON)
+        string level = "neon";
+#else
+        string level = "none";
+#endif
+#ifdef __AVX2__
+        level += "+avx2-codegen";
+#endif
+        return level;
+    }
+
+    double seconds()
+    {
+        return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct Result
+    {
+        const CorpusEntry* entry;
+        int width = 0, height = 0, channels = 0;
+        int iterations = 0;
+        double msPerImage = 0, megapixelsPerSecond = 0, megabytesPerSecond = 0;
+        double threadedMegapixelsPerSecond = 0;
+        size_t uploadBytes = 0; // decoded bytes handed to the texture upload
+        size_t bytesAllocated = 0, peakAllocatedBytes = 0, peakRss = 0;
+        bool peakRssPerFormat = false; // otherwise it is the process-wide high-water mark so far
+        bool ok = false;
+        string error;
+    };
+
+    Result measure(const CorpusEntry& entry, double minTime, ThreadPool& pool)
+    {
+        Result result;
+        result.entry = &entry;
+        ImageDecodeOptions options;
+        options.MemoryMap = entry.memoryMap;
+        options.PlanarYCbCr = entry.planarYCbCr;
+        ImageRequest request = ImageRequest::FromMemory(entry.data.data(), entry.data.size(), options);
+        if (!entry.path.empty())
+            request = ImageRequest::FromFile(entry.path, options);
+
+        result.peakRssPerFormat = resetPeakRss();
+
+        // one decode to validate and count allocations
+        gAllocatedBytes = 0;
+        gPeakLiveBytes = gLiveBytes.load();
+        size_t liveBefore = gLiveBytes;
+        DecodedImage image = UDecodeImage(request);
+        if (!image.Pixels)
+        {
+            result.error = image.FailureReason ? image.FailureReason : "unknown";
+            return result;
+        }
+        result.bytesAllocated = gAllocatedBytes;
+        result.peakAllocatedBytes = gPeakLiveBytes - liveBefore;
+        result.width = image.Width;
+        result.height = image.Height;
+        result.channels = image.Channels;
+        result.uploadBytes = (size_t)image.Width * image.Height * image.Channels;
+        if (image.PlaneCount)
+        {
+            result.uploadBytes = 0;
+            for (int i = 0; i < image.PlaneCount; ++i)
+                result.uploadBytes += (size_t)image.Planes[i].Width * image.Planes[i].Height;
+        }
+        stbi_image_free(image.Pixels);
+
+        double megapixels = (double)result.width * result.height / 1e6;
+        double start = seconds(), elapsed = 0;
+        while (result.iterations < 3 || elapsed < minTime)
+        {
+            DecodedImage timed = UDecodeImage(request);
+            stbi_image_free(timed.Pixels);
+            ++result.iterations;
+            elapsed = seconds() - start;
+        }
+        result.msPerImage = elapsed * 1000.0 / result.iterations;
+        result.megapixelsPerSecond = megapixels * result.iterations / elapsed;
+        result.megabytesPerSecond = entry.data.size() / 1e6 * result.iterations / elapsed;
+
+        // the same image decoded as a batch across the pool, as scene loading does
+        if (pool.GetThreadCount() > 1)
+        {
+            vector<ImageRequest> batch(pool.GetThreadCount() * 2, request);
+            int rounds = 0;
+            start = seconds();
+            elapsed = 0;
+            while (rounds < 2 || elapsed < minTime)
+            {
+                UDecodeImages(batch, [](DecodedImage&) {}, pool);
+                ++rounds;
+                elapsed = seconds() - start;
+            }
+            result.threadedMegapixelsPerSecond = megapixels * batch.size() * rounds / elapsed;
+        }
+        else
+        {
+            result.threadedMegapixelsPerSecond = result.megapixelsPerSecond;
+        }
+
+        result.peakRss = peakRssBytes();
+        result.ok = true;
+        return result;
+    }
+
+    string jsonEscape(const string& text)
+    {
+        string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    string toJson(const vector<Result>& results, unsigned threads, double minTime)
+    {
+        ostringstream json;
+        json.setf(ios::fixed);
+        json.precision(3);
+        json << "{\n";
+        json << "  \"benchmark\": \"image_decode\",\n";
+        json << "  \"timestamp\": " << (long long)time(nullptr) << ",\n";
+        json << "  \"stb_image\": \"2.25\",\n";
+        json << "  \"threads\": " << threads << ",\n";
+        json << "  \"simd\": \"" << jsonEscape(simdLevel()) << "\",\n";
+        json << "  \"min_time_s\": " << minTime << ",\n";
+        json << "  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            json << "    {\"name\": \"" << r.entry->name << "\", \"format\": \"" << r.entry->format << "\", "
+                 << "\"source\": \"" << (r.entry->path.empty() ? "memory" : r.entry->memoryMap ? "mmap" : "stdio") << "\", ";
+            if (!r.ok)
+            {
+                json << "\"error\": \"" << jsonEscape(r.error) << "\"}";
+            }
+            else
+            {
+                json << "\"width\": " << r.width << ", \"height\": " << r.height << ", \"channels\": " << r.channels
+                     << ", \"encoded_bytes\": " << r.entry->data.size()
+                     << ", \"iterations\": " << r.iterations
+                     << ", \"ms_per_image\": " << r.msPerImage
+                     << ", \"mp_per_s\": " << r.megapixelsPerSecond
+                     << ", \"encoded_mb_per_s\": " << r.megabytesPerSecond
+                     << ", \"mp_per_s_threaded\": " << r.threadedMegapixelsPerSecond
+                     << ", \"upload_bytes\": " << r.uploadBytes
+                     << ", \"bytes_allocated\": " << r.bytesAllocated
+                     << ", \"peak_alloc_bytes\": " << r.peakAllocatedBytes
+                     << ", \"peak_rss_bytes\": " << r.peakRss
+                     << ", \"peak_rss_scope\": \"" << (r.peakRssPerFormat ? "format" : "process") << "\"}";
+            }
+            json << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        json << "  ]\n}\n";
+        return json.str();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned threads = 0;
+    double minTime = 0.5;
+    string corpusDir = ".";
+    string jsonPath;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+            threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--min-time" && i + 1 < argc)
+            minTime = atof(argv[++i]);
+        else if (arg == "--corpus" && i + 1 < argc)
+            corpusDir = argv[++i];
+        else if (arg == "--json" && i + 1 < argc)
+            jsonPath = argv[++i];
+        else
+        {
+            cerr << "usage: " << argv[0] << " [--threads N] [--min-time SECONDS] [--corpus DIR] [--json FILE]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    ThreadPool pool(threads);
+    vector<string> tempFiles;
+    vector<CorpusEntry> corpus = buildCorpus(corpusDir, tempFiles);
+
+    printf("stb_image decode benchmark: %u threads, simd %s\n", pool.GetThreadCount(), simdLevel().c_str());
+    printf("%-36s %11s %9s %10s %10s %10s %12s %12s %10s\n", "image", "size", "ms/img", "MP/s", "MP/s (mt)", "upload", "allocated", "peak alloc", "peak RSS");
+
+    vector<Result> results;
+    bool failed = false;
+    for (const CorpusEntry& entry : corpus)
+    {
+        Result result = measure(entry, minTime, pool);
+        if (!result.ok)
+        {
+            printf("%-36s FAILED: %s\n", entry.name.c_str(), result.error.c_str());
+            failed = true;
+        }
+        else
+        {
+            char size[32];
+            snprintf(size, sizeof(size), "%dx%dx%d", result.width, result.height, result.channels);
+            printf("%-36s %11s %9.2f %10.1f %10.1f %8.2fMB %10.2fMB %10.2fMB %8.1fMB\n", entry.name.c_str(), size, result.msPerImage,
+                result.megapixelsPerSecond, result.threadedMegapixelsPerSecond, result.uploadBytes / 1e6, result.bytesAllocated / 1e6,
+                result.peakAllocatedBytes / 1e6, result.peakRss / 1e6);
+        }
+        results.push_back(result);
+    }
+
+    for (const string& path : tempFiles)
+        remove(path.c_str());
+
+    string json = toJson(results, pool.GetThreadCount(), minTime);
+    if (!jsonPath.empty())
+    {
+        ofstream file(jsonPath);
+        file << json;
+        printf("wrote %s\n", jsonPath.c_str());
+    }
+    else
+    {
+        printf("%s", json.c_str());
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}